@@ -0,0 +1,319 @@
+/*
+ * async_reader.cpp:
+ *
+ * Read-ahead stage for Phase 1. See async_reader.h
+ */
+
+#include "config.h"
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+#include "async_reader.h"
+
+async_reader::async_reader(image_process &p_, size_t depth_, u_int threads_, alloc_func_t alloc_, numa_topology *numa_):
+    depth(depth_>0 ? depth_ : 1), p(p_), alloc(alloc_)
+{
+    if (numa_ && numa_->size() > 1 && p.pread_is_threadsafe()) {
+        numa = numa_;
+    }
+#ifdef USE_IO_URING
+    std::vector<image_process::extent_t> extents;
+    if (!numa && p.get_extents(0, 1, extents)) {
+        /* a page may span several segments, so leave room for more than one SQE per page */
+        if (io_uring_queue_init(depth * 4, &ring, 0) == 0) {
+            use_uring = true;
+        }
+    }
+#endif
+    if (!use_uring) {
+        if (threads_==0 || !p.pread_is_threadsafe()) {
+            threads_ = 1;               // a single reader still overlaps reading with scheduling
+        }
+        if (numa) {
+            /* at least one reader per node, and the runs go to the nodes as the readers do */
+            threads_ = std::max(threads_, static_cast<u_int>(numa->size()));
+            run_queues = numa->spread(threads_);
+            todo.resize(numa->size());
+        } else {
+            run_queues.push_back(0);
+            todo.resize(1);
+        }
+        max_run = std::max(static_cast<size_t>(1), depth / threads_);
+        for (u_int i=0; i<threads_; i++) {
+            size_t queue = numa ? run_queues[i] : 0;
+            if (numa) numa->nodes[queue].reader_threads += 1;
+            threads.push_back(new std::thread(&async_reader::run_thread, this, queue));
+        }
+    }
+}
+
+async_reader::~async_reader()
+{
+    {
+        std::unique_lock<std::mutex> lock(M);
+        stopping = true;
+    }
+    cv_work.notify_all();
+    for (auto &t : threads) {
+        t->join();
+        delete t;
+    }
+    threads.clear();
+#ifdef USE_IO_URING
+    if (use_uring) {
+        for (auto &s : slots) {
+            uring_wait(*s);             // the kernel may still be writing into the buffer
+        }
+        io_uring_queue_exit(&ring);
+    }
+#endif
+    /* Free the pages that were read but never delivered */
+    for (auto &s : slots) {
+        delete s->page.sbuf;
+        s->page.sbuf = nullptr;
+    }
+}
+
+std::string async_reader::backend() const
+{
+    if (use_uring) return "io_uring";
+    if (numa) return "threads:" + std::to_string(threads.size()) + " numa:" + std::to_string(numa->size());
+    return std::string("threads:") + std::to_string(threads.size());
+}
+
+/****************************************************************
+ *** threads backend
+ ****************************************************************/
+
+/* Each reader thread has its own iterator and claims a run of consecutive pages, so the
+ * threads read disjoint ranges of the image and each reuses the margin within its run.
+ * With --numa the thread runs on the node of its queue, so the sbufs it reads are allocated there.
+ */
+void async_reader::run_thread(size_t queue)
+{
+    if (numa) {
+        numa->pin_current_thread(queue);
+    }
+    image_process::iterator it = p.begin();
+    std::vector<std::shared_ptr<slot_t>> run;
+    auto &q = todo[queue];
+    for (;;) {
+        run.clear();
+        {
+            std::unique_lock<std::mutex> lock(M);
+            cv_work.wait(lock, [this, &q]{ return stopping || !q.empty(); });
+            if (stopping) return;
+            do {
+                run.push_back(q.front());
+                q.pop_front();
+            } while (run.size() < max_run && !q.empty()
+                     && q.front()->it.raw_offset == run.back()->it.raw_offset + p.pagesize);
+        }
+        for (auto &s : run) {
+            it.set_position(s->it);
+            try {
+                s->page.sbuf = alloc(s->page.pos0, [&it]{ return it.sbuf_alloc(); }, s->page.alloc_failures);
+            }
+            catch (...) {
+                s->page.error = std::current_exception();
+            }
+            {
+                std::unique_lock<std::mutex> lock(M);
+                s->done = true;
+                if (numa && s->page.sbuf) {
+                    numa->nodes[queue].pages_read += 1;
+                    numa->nodes[queue].bytes_read += s->page.sbuf->pagesize;
+                }
+            }
+            cv_done.notify_all();
+        }
+    }
+}
+
+/****************************************************************
+ *** io_uring backend
+ ****************************************************************/
+
+/* Record the completion of one extent. Short reads are finished synchronously. */
+void async_reader::uring_complete(slot_t &s, const image_process::extent_t &ext, uint8_t *dst, ssize_t res)
+{
+    if (res < 0) {
+        s.page.error = std::make_exception_ptr(image_process::ReadError());
+    } else if (res == 0 && ext.len > 0) {
+        s.page.error = std::make_exception_ptr(image_process::EndOfImage());
+    } else {
+        size_t got = res;
+        while (got < ext.len && !s.page.error) {
+            ssize_t r = ::pread(ext.fd, dst + got, ext.len - got, ext.offset + got);
+            if (r <= 0) {
+                s.page.error = std::make_exception_ptr(image_process::ReadError());
+                break;
+            }
+            got += r;
+        }
+    }
+    if (--s.pending == 0) {
+        s.done = true;
+    }
+}
+
+void async_reader::uring_submit(std::shared_ptr<slot_t> s)
+{
+    const uint64_t offset = s->it.raw_offset;
+    const uint64_t image_size = p.image_size();
+    if (offset >= image_size) {
+        s->page.error = std::make_exception_ptr(image_process::EndOfImage());
+        s->done = true;
+        return;
+    }
+    s->count = std::min(static_cast<uint64_t>(p.pagesize + p.margin), image_size - offset);
+    try {
+        s->page.sbuf = alloc(s->page.pos0, [this, &s]{
+            return sbuf_t::sbuf_malloc(s->page.pos0, s->count, std::min(p.pagesize, s->count));
+        }, s->page.alloc_failures);
+    }
+    catch (...) {
+        s->page.error = std::current_exception();
+        s->done = true;
+        return;
+    }
+    s->buf = static_cast<uint8_t *>(s->page.sbuf->malloc_buf());
+
+    /* The start of this page is the margin of the previous page.
+     * If that page is still in flight, next() copies it over when it is delivered;
+     * if it has already been delivered, its margin is in margin_buf.
+     */
+    const slot_t *prev = slots.empty() ? nullptr : slots.back().get();
+    if (prev) {
+        if (prev->page.sbuf && prev->it.raw_offset + p.pagesize == offset && prev->count > p.pagesize) {
+            s->head = std::min(prev->count - p.pagesize, s->count);
+            s->head_from_prev = true;
+        }
+    } else if (margin_buf.size() > 0 && margin_offset == offset) {
+        s->head = std::min(margin_buf.size(), s->count);
+        memcpy(s->buf, margin_buf.data(), s->head);
+        margin_buf.clear();
+    }
+
+    std::vector<image_process::extent_t> extents;
+    p.get_extents(offset + s->head, s->count - s->head, extents);
+    s->pending = extents.size();
+    if (s->pending == 0) {
+        s->done = true;
+        return;
+    }
+#ifdef USE_IO_URING
+    uint8_t *dst = s->buf + s->head;
+    for (const auto &ext : extents) {
+        struct io_uring_sqe *sqe = io_uring_get_sqe(&ring);
+        if (sqe == nullptr) {
+            io_uring_submit(&ring);     // ring is full; push what we have and try again
+            sqe = io_uring_get_sqe(&ring);
+        }
+        if (sqe == nullptr) {
+            uring_complete(*s, ext, dst, ::pread(ext.fd, dst, ext.len, ext.offset));
+        } else {
+            request_t *r = new request_t{s, ext, dst};
+            io_uring_prep_read(sqe, ext.fd, dst, ext.len, ext.offset);
+            io_uring_sqe_set_data(sqe, r);
+        }
+        dst += ext.len;
+    }
+    io_uring_submit(&ring);
+#endif
+}
+
+void async_reader::uring_wait(slot_t &s)
+{
+#ifdef USE_IO_URING
+    while (!s.done) {
+        struct io_uring_cqe *cqe = nullptr;
+        const int ret = io_uring_wait_cqe(&ring, &cqe);
+        if (ret == -EINTR) {
+            continue;                   // interrupted by a signal
+        }
+        if (ret < 0) {                  // the ring itself failed, so no read in flight will complete
+            std::cerr << "io_uring_wait_cqe: " << strerror(-ret) << std::endl;
+            throw image_process::ReadError();
+        }
+        request_t *r = static_cast<request_t *>(io_uring_cqe_get_data(cqe));
+        ssize_t res = cqe->res;
+        io_uring_cqe_seen(&ring, cqe);
+        uring_complete(*r->slot, r->ext, r->dst, res);
+        delete r;
+    }
+#endif
+}
+
+/****************************************************************
+ *** common
+ ****************************************************************/
+
+void async_reader::submit(const image_process::iterator &it)
+{
+    auto s = std::make_shared<slot_t>(it);
+    if (use_uring) {
+        uring_submit(s);
+        slots.push_back(s);
+        return;
+    }
+    slots.push_back(s);
+    {
+        std::unique_lock<std::mutex> lock(M);
+        todo[run_queues[submitted++ / max_run % run_queues.size()]].push_back(s);
+    }
+    if (todo.size() > 1) {
+        cv_work.notify_all();           // only the threads of the page's node can take it
+    } else {
+        cv_work.notify_one();
+    }
+}
+
+async_reader::page_t async_reader::next()
+{
+    assert(!slots.empty());
+    std::shared_ptr<slot_t> s = slots.front();
+    slots.pop_front();
+    if (!use_uring) {
+        std::unique_lock<std::mutex> lock(M);
+        cv_done.wait(lock, [&s]{ return s->done; });
+        return s->page;
+    }
+
+    uring_wait(*s);
+    if (s->page.error && s->page.sbuf) {
+        delete s->page.sbuf;
+        s->page.sbuf = nullptr;
+    }
+
+    /* Hand our margin to the page that follows, before our sbuf goes to the workers */
+    if (!slots.empty() && slots.front()->head_from_prev) {
+        slot_t &n = *slots.front();
+        if (s->page.sbuf) {
+            memcpy(n.buf, s->buf + p.pagesize, n.head);
+        } else {
+            /* we failed, so read the head of the next page ourselves */
+            try {
+                if (p.pread(n.buf, n.head, n.it.raw_offset) != static_cast<ssize_t>(n.head)) {
+                    throw image_process::ReadError();
+                }
+            }
+            catch (...) {
+                n.page.error = std::current_exception();
+            }
+        }
+    }
+    margin_buf.clear();
+    if (s->page.sbuf && s->count > p.pagesize) {
+        margin_buf.assign(s->buf + p.pagesize, s->buf + s->count);
+        margin_offset = s->it.raw_offset + p.pagesize;
+    }
+    return s->page;
+}
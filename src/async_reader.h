@@ -0,0 +1,128 @@
+/*
+ * async_reader.h:
+ *
+ * Read-ahead stage for Phase 1.
+ *
+ * The producer submits the pages it wants (as image_process iterators) and the reader keeps
+ * up to depth of them in flight. next() returns the pages in the order in which they were
+ * submitted, so the image hash can still be computed as the pages are scheduled.
+ *
+ * Two backends:
+ *  - io_uring  - used on Linux if liburing is present and the image is a set of plain files
+ *                (process_raw). Reads are issued directly against the segment files.
+ *  - threads   - a small pool of reader threads that call sbuf_alloc(). Works with every image type.
+ *                Each thread claims a run of consecutive pages. If the image's pread() is not
+ *                thread-safe only one reader thread is used.
+ *
+ * With --numa the threads backend is used, with a queue of pages for each NUMA node and reader
+ * threads pinned to each node. Runs of pages go to the queues in turn (see numa_topology.h).
+ */
+
+#ifndef ASYNC_READER_H
+#define ASYNC_READER_H
+
+#include "config.h"
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "be20_api/sbuf.h"
+#include "image_process.h"
+#include "numa_topology.h"
+
+#if defined(HAVE_LIBURING) && defined(HAVE_LIBURING_H)
+#include <liburing.h>
+#define USE_IO_URING
+#endif
+
+class async_reader {
+    async_reader(const async_reader &that) = delete;
+    async_reader &operator=(const async_reader &that) = delete;
+
+public:
+    /* Makes the sbuf of a page with make(), which reads it (threads) or only allocates it (io_uring) and
+     * may throw bad_alloc. Phase1 passes get_sbuf(), so its bad_alloc retries and its wait for the memory
+     * budget apply on both backends. It reports nothing itself, as it may run in a reader thread: it adds
+     * the what() of each failure it retried to failures, which next() returns with the page.
+     */
+    typedef std::function<sbuf_t *(const pos0_t &pos0, const std::function<sbuf_t *()> &make,
+                                   std::vector<std::string> &failures)> alloc_func_t;
+
+    struct page_t {
+        page_t(const pos0_t &pos0_):pos0(pos0_) {}
+        const pos0_t       pos0;
+        sbuf_t             *sbuf {nullptr};
+        std::exception_ptr error {};    // set if the read failed
+        std::vector<std::string> alloc_failures {}; // retried by alloc, in order
+    };
+
+    async_reader(image_process &p_, size_t depth_, u_int threads_, alloc_func_t alloc_, numa_topology *numa_ = nullptr);
+    ~async_reader();
+
+    void   submit(const image_process::iterator &it); // start reading the page at it
+    page_t next();                                    // wait for the oldest page; caller owns the sbuf
+                                                      // throws ReadError if the io_uring fails
+    bool   full()  const { return slots.size() >= depth; }
+    bool   empty() const { return slots.empty(); }
+    size_t in_flight() const { return slots.size(); }
+    std::string backend() const;
+
+    const size_t depth;                 // max pages in flight
+
+private:
+    struct slot_t {
+        slot_t(const image_process::iterator &it_):it(it_),page(it_.get_pos0()) {}
+        image_process::iterator it;     // position of the page
+        page_t   page;
+        bool     done {false};
+        /* io_uring only */
+        size_t   count {};              // bytes in the sbuf
+        size_t   head {};               // leading bytes that are copied from the previous page's margin
+        bool     head_from_prev {false}; // ... when the previous page is delivered (otherwise from margin_buf)
+        size_t   pending {};            // extents still being read
+        uint8_t  *buf {nullptr};
+    };
+    image_process    &p;
+    alloc_func_t     alloc;
+    std::deque<std::shared_ptr<slot_t>> slots {}; // in submission order
+
+    /* threads backend */
+    std::mutex              M {};
+    std::condition_variable cv_work {};
+    std::condition_variable cv_done {};
+    std::vector<std::deque<std::shared_ptr<slot_t>>> todo {}; // one queue, or one per NUMA node
+    std::vector<std::thread *> threads {};
+    bool                    stopping {false};
+    size_t                  max_run {1};    // most consecutive pages a thread claims at once
+    void run_thread(size_t queue);
+
+    /* --numa */
+    numa_topology           *numa {nullptr};
+    std::vector<size_t>     run_queues {};  // the queue of each run of max_run pages, in turn
+    uint64_t                submitted {0};
+
+    /* io_uring backend */
+    bool     use_uring {false};
+    uint64_t margin_offset {};          // cached margin of the last page delivered, as in image_process::iterator
+    std::vector<uint8_t> margin_buf {};
+    void uring_submit(std::shared_ptr<slot_t> s);
+    void uring_wait(slot_t &s);
+    void uring_complete(slot_t &s, const image_process::extent_t &ext, uint8_t *dst, ssize_t res);
+#ifdef USE_IO_URING
+    struct io_uring ring {};
+    struct request_t {              // one per extent in flight
+        std::shared_ptr<slot_t>   slot;
+        image_process::extent_t   ext;
+        uint8_t                   *dst;
+    };
+#endif
+};
+
+#endif
@@ -0,0 +1,232 @@
+/*
+ * block_hash_store.cpp:
+ *
+ * Persistent store of scanned 4 KiB blocks. See block_hash_store.h
+ */
+
+#include "config.h"
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+#ifdef HAVE_SYS_FILE_H
+#include <sys/file.h>
+#endif
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "block_hash_store.h"
+
+/****************************************************************
+ *** MurmurHash3_x64_128, by Austin Appleby (public domain)
+ ****************************************************************/
+
+static inline uint64_t rotl64(uint64_t x, int8_t r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t fmix64(uint64_t k)
+{
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+void block_hash_store::hash128(const uint8_t *buf, size_t len, uint64_t seed, uint64_t &h1, uint64_t &h2)
+{
+    const uint64_t c1 = 0x87c37b91114253d5ULL;
+    const uint64_t c2 = 0x4cf5ad432745937fULL;
+    const size_t nblocks = len / 16;
+    h1 = seed;
+    h2 = seed;
+
+    for (size_t i = 0; i < nblocks; i++) {
+        uint64_t k1, k2;
+        memcpy(&k1, buf + i*16, 8);
+        memcpy(&k2, buf + i*16 + 8, 8);
+
+        k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+        h1 = rotl64(h1, 27); h1 += h2; h1 = h1*5 + 0x52dce729;
+        k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+        h2 = rotl64(h2, 31); h2 += h1; h2 = h2*5 + 0x38495ab5;
+    }
+
+    const uint8_t *tail = buf + nblocks*16;
+    uint64_t k1 = 0;
+    uint64_t k2 = 0;
+    switch (len & 15) {
+    case 15: k2 ^= static_cast<uint64_t>(tail[14]) << 48; [[fallthrough]];
+    case 14: k2 ^= static_cast<uint64_t>(tail[13]) << 40; [[fallthrough]];
+    case 13: k2 ^= static_cast<uint64_t>(tail[12]) << 32; [[fallthrough]];
+    case 12: k2 ^= static_cast<uint64_t>(tail[11]) << 24; [[fallthrough]];
+    case 11: k2 ^= static_cast<uint64_t>(tail[10]) << 16; [[fallthrough]];
+    case 10: k2 ^= static_cast<uint64_t>(tail[ 9]) << 8;  [[fallthrough]];
+    case  9: k2 ^= static_cast<uint64_t>(tail[ 8]) << 0;
+        k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+        [[fallthrough]];
+    case  8: k1 ^= static_cast<uint64_t>(tail[ 7]) << 56; [[fallthrough]];
+    case  7: k1 ^= static_cast<uint64_t>(tail[ 6]) << 48; [[fallthrough]];
+    case  6: k1 ^= static_cast<uint64_t>(tail[ 5]) << 40; [[fallthrough]];
+    case  5: k1 ^= static_cast<uint64_t>(tail[ 4]) << 32; [[fallthrough]];
+    case  4: k1 ^= static_cast<uint64_t>(tail[ 3]) << 24; [[fallthrough]];
+    case  3: k1 ^= static_cast<uint64_t>(tail[ 2]) << 16; [[fallthrough]];
+    case  2: k1 ^= static_cast<uint64_t>(tail[ 1]) << 8;  [[fallthrough]];
+    case  1: k1 ^= static_cast<uint64_t>(tail[ 0]) << 0;
+        k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+    }
+
+    h1 ^= len; h2 ^= len;
+    h1 += h2;  h2 += h1;
+    h1 = fmix64(h1);
+    h2 = fmix64(h2);
+    h1 += h2;  h2 += h1;
+}
+
+/****************************************************************
+ *** block_hash_store
+ ****************************************************************/
+
+block_hash_store::block_hash_store(const std::filesystem::path &fname, uint64_t nslots, const std::string &config_fingerprint)
+{
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H)
+    uint64_t h2 = 0;
+    hash128(reinterpret_cast<const uint8_t *>(config_fingerprint.data()), config_fingerprint.size(), 0, seed, h2);
+
+    fd = ::open(fname.string().c_str(), O_RDWR|O_CREAT, 0666);
+    if (fd < 0) {
+        throw std::runtime_error("cannot open block hash store " + fname.string() + ": " + strerror(errno));
+    }
+#ifdef HAVE_SYS_FILE_H
+    /* One run at a time: two would claim the same empty slots. The lock goes with the descriptor. */
+    if (flock(fd, LOCK_EX|LOCK_NB) < 0) {
+        const int err = errno;
+        ::close(fd);
+        throw std::runtime_error("cannot lock block hash store " + fname.string()
+                                 + (err == EWOULDBLOCK ? ": another run is using it" : std::string(": ") + strerror(err)));
+    }
+#endif
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        ::close(fd);
+        throw std::runtime_error("cannot stat block hash store " + fname.string());
+    }
+    bool created = (st.st_size == 0);
+    if (created) {
+        uint64_t n = 1024;
+        while (n < nslots) n <<= 1;
+        map_len = sizeof(header_t) + n * sizeof(slot_t);
+        if (ftruncate(fd, map_len) < 0) { // sparse, so an empty store takes no space
+            ::close(fd);
+            throw std::runtime_error("cannot size block hash store " + fname.string() + ": " + strerror(errno));
+        }
+    } else {
+        map_len = st.st_size;
+    }
+    void *addr = mmap(nullptr, map_len, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+        ::close(fd);
+        throw std::runtime_error("cannot map block hash store " + fname.string() + ": " + strerror(errno));
+    }
+    header = static_cast<header_t *>(addr);
+    slots  = reinterpret_cast<slot_t *>(static_cast<uint8_t *>(addr) + sizeof(header_t));
+    if (created) {
+        memcpy(header->magic, MAGIC, sizeof(header->magic));
+        header->slots = (map_len - sizeof(header_t)) / sizeof(slot_t);
+    }
+    if (map_len < sizeof(header_t) ||
+        memcmp(header->magic, MAGIC, sizeof(header->magic)) != 0 ||
+        map_len != sizeof(header_t) + header->slots * sizeof(slot_t) ||
+        (header->slots & (header->slots - 1)) != 0) {
+        munmap(addr, map_len);
+        ::close(fd);
+        throw std::runtime_error(fname.string() + " is not a block hash store");
+    }
+    header->last_run += 1;
+    if (header->last_run == 0) header->last_run = 1; // 0 marks committed blocks
+    run = header->last_run;
+#else
+    throw std::runtime_error("the block hash store requires mmap");
+#endif
+}
+
+block_hash_store::~block_hash_store()
+{
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H)
+    if (header) munmap(header, map_len);
+    if (fd >= 0) ::close(fd);
+#endif
+}
+
+uint64_t block_hash_store::size() const
+{
+    return header->count;
+}
+
+/* Linear probing. Blocks left by a run that never committed match nothing, but are taken over when seen again. */
+bool block_hash_store::find_or_add(uint64_t h1, uint64_t h2, bool add)
+{
+    if (h1 == 0 && h2 == 0) h1 = 1;    // 0,0 is an empty slot
+    const uint64_t mask = header->slots - 1;
+    for (uint64_t i = h1 & mask;; i = (i + 1) & mask) {
+        slot_t &s = slots[i];
+        if (s.h1 == h1 && s.h2 == h2) {
+            if (s.run == 0 || s.run == run) return true;
+            if (add) s.run = run;       // left by a failed run; it is being scanned now
+            return false;
+        }
+        if (s.h1 == 0 && s.h2 == 0) {
+            if (!add) return false;
+            if (header->count >= header->slots * MAX_LOAD) {
+                blocks_not_added += 1;
+                return false;
+            }
+            s.h1  = h1;
+            s.h2  = h2;
+            s.run = run;
+            header->count += 1;
+            blocks_added += 1;
+            return false;
+        }
+    }
+}
+
+bool block_hash_store::check_and_add(const uint8_t *buf, size_t pagesize, size_t len)
+{
+    bool all_found = true;
+    for (size_t off = 0; off < len; off += BLOCK_SIZE) {
+        uint64_t h1, h2;
+        hash128(buf + off, std::min(BLOCK_SIZE, len - off), seed, h1, h2);
+        const bool in_page = off < pagesize;
+        if (in_page) blocks_checked += 1;
+        if (find_or_add(h1, h2, in_page)) {
+            if (in_page) blocks_found += 1;
+        } else {
+            all_found = false;
+        }
+    }
+    return all_found;
+}
+
+void block_hash_store::commit()
+{
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H)
+    for (uint64_t i = 0; i < header->slots; i++) {
+        if (slots[i].run == run) slots[i].run = 0;
+    }
+    msync(header, map_len, MS_SYNC);
+#endif
+}
@@ -0,0 +1,85 @@
+/*
+ * block_hash_store.h:
+ *
+ * A persistent set of the 4 KiB blocks that have already been scanned, so that the same blocks
+ * are not scanned again in the same image or in later images (e.g. many machines built from one image).
+ *
+ * The store is an open-addressed hash table in a file that is mapped into memory.
+ * Each block is keyed by a 128-bit MurmurHash3 of its contents, seeded with a fingerprint of the
+ * scanner configuration, so blocks scanned with other scanners or settings do not match.
+ *
+ * Blocks added during a run are tagged with the run's number and only become permanent when
+ * commit() is called after the scanners have finished. A run that dies before then leaves
+ * entries that later runs ignore, so a block is never treated as scanned when it was not.
+ *
+ * Block-level deduplication can miss a feature that spans two blocks which were each seen before,
+ * but never next to each other. Phase 1 reduces this by checking the margin as well as the page.
+ * Only the blocks of the page are added: the scanners report the features that start in the page,
+ * so the margin's blocks are scanned when they are the start of the next page.
+ *
+ * Only the thread that reads the image uses the store, so it is not locked within the process.
+ * The file is locked with flock() while it is open, so another run that opens it fails.
+ */
+
+#ifndef BLOCK_HASH_STORE_H
+#define BLOCK_HASH_STORE_H
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+
+class block_hash_store {
+    block_hash_store(const block_hash_store &that) = delete;
+    block_hash_store &operator=(const block_hash_store &that) = delete;
+
+public:
+    static constexpr size_t BLOCK_SIZE = 4096;
+    static constexpr uint64_t DEFAULT_SLOTS = 1ULL << 26;  // 64M blocks (256 GiB of unique data), a 1.5 GiB sparse file
+    static constexpr double MAX_LOAD = 0.75;           // stop adding blocks when the table is this full
+
+    /* Opens or creates the store. slots is only used when creating it (rounded up to a power of 2).
+     * Throws std::runtime_error if the file cannot be created, locked or mapped, or is not a store.
+     */
+    block_hash_store(const std::filesystem::path &fname, uint64_t slots, const std::string &config_fingerprint);
+    ~block_hash_store();
+
+    /* Returns true if every block of buf was already scanned. The blocks of the page, the first
+     * pagesize bytes, that were not are added; those of the margin, after it, are only looked up.
+     */
+    bool check_and_add(const uint8_t *buf, size_t pagesize, size_t len);
+    void commit();                      // the scanners have finished; make this run's blocks permanent
+
+    /* statistics for this run, of the blocks of pages */
+    uint64_t blocks_checked {0};
+    uint64_t blocks_found {0};
+    uint64_t blocks_added {0};
+    uint64_t blocks_not_added {0};      // because the table was full
+    uint64_t size() const;              // blocks in the store
+
+    static void hash128(const uint8_t *buf, size_t len, uint64_t seed, uint64_t &h1, uint64_t &h2);
+
+private:
+    struct header_t {
+        char     magic[8];
+        uint64_t slots;                 // a power of 2
+        uint64_t count;                 // slots in use
+        uint32_t last_run;              // run number of the most recent run
+        uint32_t reserved;
+    };
+    struct slot_t {
+        uint64_t h1, h2;                // h1==h2==0 is an empty slot
+        uint32_t run;                   // 0 once committed, otherwise the run that added it
+        uint32_t reserved;
+    };
+    static constexpr char MAGIC[9] = "BEBLKDB1";
+
+    int       fd {-1};
+    size_t    map_len {0};
+    header_t  *header {nullptr};
+    slot_t    *slots {nullptr};
+    uint32_t  run {0};                  // this run's number
+    uint64_t  seed {0};                 // from the configuration fingerprint
+    bool      find_or_add(uint64_t h1, uint64_t h2, bool add); // true if found
+};
+
+#endif
@@ -0,0 +1,114 @@
+/*
+ * block_sampler.cpp:
+ *
+ * Streaming random sampler for Phase 1. See block_sampler.h
+ */
+
+#include "config.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include "block_sampler.h"
+
+block_sampler::mode_t block_sampler::mode_for(const std::string &name)
+{
+    if (name=="bernoulli")  return BERNOULLI;
+    if (name=="stratified") return STRATIFIED;
+    throw std::invalid_argument("sampling mode must be bernoulli or stratified: " + name);
+}
+
+block_sampler::block_sampler(uint64_t max_blocks_, double frac_, unsigned passes_, uint64_t seed_, mode_t mode_):
+    max_blocks(max_blocks_), frac(frac_), passes(passes_>0 ? passes_ : 1), seed(seed_), mode(mode_)
+{
+    if (frac<=0 || frac>1) {
+        throw std::invalid_argument("sampling fraction must be 0<f<=1");
+    }
+    if (mode==STRATIFIED) {
+        stratum = std::max(static_cast<uint64_t>(1), static_cast<uint64_t>(std::llround(1.0 / frac)));
+        if (passes > stratum) {
+            throw std::invalid_argument("stratified sampling: passes must not exceed 1/fraction");
+        }
+    } else if (frac * passes > 1.0 + 1e-9) {
+        throw std::invalid_argument("bernoulli sampling: fraction * passes must not exceed 1");
+    }
+}
+
+/* splitmix64 of the seed and n. Cheap, and good enough to decide membership. */
+uint64_t block_sampler::hash(uint64_t n) const
+{
+    uint64_t z = seed + 0x9e3779b97f4a7c15ULL * (n + 1);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+/*
+ * bernoulli: the block's value u in [0,1) is in pass p's slice [p*frac, (p+1)*frac).
+ * stratified: each stratum is permuted by rotating it by a random amount; pass p takes the p'th block.
+ */
+bool block_sampler::sampled(uint64_t block, unsigned p) const
+{
+    if (block >= max_blocks) return false;
+    if (mode==STRATIFIED) {
+        uint64_t s = block / stratum;
+        return block == s * stratum + (hash(s) + p) % stratum;
+    }
+    double u = (hash(block) >> 11) * 0x1.0p-53;
+    return u >= p * frac && u < (p + 1) * frac;
+}
+
+bool block_sampler::next_block(uint64_t &block)
+{
+    if (mode==STRATIFIED) {
+        while (cursor * stratum < max_blocks) {
+            uint64_t s = cursor++;
+            block = s * stratum + (hash(s) + pass) % stratum;
+            if (block < max_blocks) return true; // the last stratum may be short
+        }
+        return false;
+    }
+    while (cursor < max_blocks) {
+        uint64_t b = cursor++;
+        if (sampled(b, pass)) {
+            block = b;
+            return true;
+        }
+    }
+    return false;
+}
+
+void block_sampler::next_pass()
+{
+    if (pass < passes) pass++;
+    cursor = 0;
+    have_pending = false;
+}
+
+bool block_sampler::next(uint64_t &start, uint64_t &count)
+{
+    while (pass < passes) {
+        uint64_t block;
+        if (have_pending) {
+            block = pending;
+            have_pending = false;
+        } else if (!next_block(block)) {
+            next_pass();                // this pass is done; start the next one from the beginning
+            continue;
+        }
+        start = block;
+        count = 1;
+        /* extend the run while the following block is also sampled */
+        while (next_block(block)) {
+            if (block != start + count) {
+                pending = block;
+                have_pending = true;
+                break;
+            }
+            count++;
+        }
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,53 @@
+/*
+ * block_sampler.h:
+ *
+ * Chooses the blocks of the image to read when random sampling (-s frac[:passes]).
+ *
+ * The sampler uses O(1) memory: whether a block is in the sample is a function of the seed and
+ * the block number, so it can be computed as the image is walked instead of being stored.
+ *
+ *  - bernoulli  - each block is in the sample with probability frac.
+ *  - stratified - the image is cut into strata of 1/frac blocks and one block of each is sampled,
+ *                 so the sample is spread evenly over the image.
+ *
+ * Each pass samples a different set of blocks: a block's random value decides which pass (if any)
+ * samples it, so a later pass never re-reads a block read by an earlier one.
+ * next() returns runs of adjacent sampled blocks, so that they can be read sequentially.
+ */
+
+#ifndef BLOCK_SAMPLER_H
+#define BLOCK_SAMPLER_H
+
+#include <cstdint>
+#include <string>
+
+class block_sampler {
+public:
+    enum mode_t { BERNOULLI, STRATIFIED };
+    static mode_t mode_for(const std::string &name); // throws std::invalid_argument
+
+    /* throws std::invalid_argument if the passes do not fit, i.e. frac * passes > 1 */
+    block_sampler(uint64_t max_blocks_, double frac_, unsigned passes_, uint64_t seed_, mode_t mode_);
+
+    bool     next(uint64_t &start, uint64_t &count); // next run of sampled blocks; false when all passes are done
+    void     next_pass();               // skip the rest of this pass, e.g. the blocks past -Y
+    bool     sampled(uint64_t block, unsigned pass) const;
+    unsigned get_pass() const { return pass; }
+
+    const uint64_t max_blocks;
+    const double   frac;
+    const unsigned passes;
+    const uint64_t seed;
+    const mode_t   mode;
+
+private:
+    uint64_t stratum {1};               // blocks per stratum (stratified)
+    unsigned pass {0};                  // the pass being returned by next()
+    uint64_t cursor {0};                // next block (bernoulli) or stratum (stratified) to look at
+    uint64_t hash(uint64_t n) const;    // random 64-bit value for block or stratum n
+    bool     next_block(uint64_t &block); // next sampled block of this pass
+    uint64_t pending {0};               // a block found by next_block() that did not fit in the last run
+    bool     have_pending {false};
+};
+
+#endif
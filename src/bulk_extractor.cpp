@@ -42,11 +42,14 @@ int _CRT_fmode = _O_BINARY;
 
 #include "bulk_extractor.h"
 #include "image_process.h"
+#include "numa_topology.h"
 #include "phase1.h"
 
 /* Bring in the definitions  */
 #include "bulk_extractor_scanners.h"
 #include "bulk_extractor_restarter.h"
+#include "bulk_extractor_batch.h"
+#include "bulk_extractor_shard.h"
 
 #include "cxxopts.hpp"
 
@@ -101,6 +104,9 @@ int _CRT_fmode = _O_BINARY;
  */
 void validate_path( const std::filesystem::path fn)
 {
+    if ( fn == "-" ) {
+        return;                         // stdin
+    }
     if ( !std::filesystem::exists( fn )){
         std::cerr << "file does not exist: " << fn << std::endl ;
         throw std::runtime_error( "file not found." );
@@ -221,11 +227,15 @@ int bulk_extractor_main( std::ostream &cout, std::ostream &cerr, int argc,char *
     options.add_options()
     ("image_name", image_name_help.c_str(), cxxopts::value<std::string>())
         ("A,offset_add", "Offset added (in bytes) to feature locations", cxxopts::value<int64_t>()->default_value("0"))
+        ("auto_pagesize", "tune the page size (-G is the first) to the scanners, threads and memory budget while running")
+        ("batch",        "scan each image in a manifest of <image> TAB <outdir> lines, in turn in this process, with the other options (each image still sets up its own scanners)", cxxopts::value<std::string>())
+        ("batch_jobs",   "with --batch, processes that scan images at once", cxxopts::value<int>()->default_value("1"))
         ("b,banner_file", "Path of file whose contents are prepended to top of all feature files",cxxopts::value<std::string>())
 	("C,context_window", "Size of context window reported in bytes",
          cxxopts::value<int>()->default_value(std::to_string(sc.context_window_default)))
         ("d,debug", "enable debugging", cxxopts::value<int>()->default_value("1"))
         ("D,debug_help", "help on debugging")
+        ("direct_io",  "read raw images and devices with direct I/O, bypassing the page cache")
         ("E,enable_exclusive", "disable all scanners except the one specified. Same as -x all -E scanner.", cxxopts::value<std::string>())
         ("e,enable",   "enable a scanner (can be repeated)", cxxopts::value<std::vector<std::string>>())
         ("x,disable",  "disable a scanner (can be repeated)", cxxopts::value<std::vector<std::string>>())
@@ -238,8 +248,10 @@ int bulk_extractor_main( std::ostream &cout, std::ostream &cerr, int argc,char *
 	("M,max_depth",   "max recursion depth", cxxopts::value<int>()->default_value(std::to_string(scanner_config::DEFAULT_MAX_DEPTH)))
 	("max_bad_alloc_errors", "max bad allocation errors", cxxopts::value<int>()->default_value(std::to_string(cfg.max_bad_alloc_errors)))
 	("max_minute_wait", "maximum number of minutes to wait until all data are read", cxxopts::value<int>()->default_value(std::to_string(60)))
+        ("merge",           "merge the output directories of the --shard runs of an image into -o (can be repeated; give the shards' scanner options)", cxxopts::value<std::vector<std::string>>())
         ("notify_main_thread", "Display notifications in the main thread after phase1 completes. Useful for running with ThreadSanitizer")
         ("notify_async", "Display notificaitons asynchronously (default)")
+        ("numa",            "pin the scanner threads to the NUMA nodes and interleave the pages across them; with -S scheduler=be2 a page is scanned by the workers of the node that holds it")
         ("o,outdir",        "output directory [REQUIRED]", cxxopts::value<std::string>())
         ("P,scanner_dir",
          "directories for scanner shared libraries (can be repeated). "
@@ -251,6 +263,7 @@ int bulk_extractor_main( std::ostream &cout, std::ostream &cerr, int argc,char *
         ("R,recurse",       "treat image file as a directory to recursively explore")
         ("S,set",           "set a name=value option (can be repeated)", cxxopts::value<std::vector<std::string>>())
         ("s,sampling",      "random sampling parameter frac[:passes]", cxxopts::value<std::string>())
+        ("shard",           "scan part <i>/<N> of the image: the i'th of N page-aligned ranges, for --merge", cxxopts::value<std::string>())
         ("V,version",       "Display PACKAGE_VERSION (currently) " PACKAGE_VERSION)
         ("w,stop_list",     "file to read stop list from", cxxopts::value<std::string>())
         ("Y,scan",          "specify <start>[-end] of area on disk to scan", cxxopts::value<std::string>())
@@ -265,6 +278,16 @@ int bulk_extractor_main( std::ostream &cout, std::ostream &cerr, int argc,char *
     options.positional_help( "image_name" );
     options.parse_positional( "image_name" );
     auto result = options.parse( argc, argv);
+
+    /* --batch runs this function again for each image in the manifest */
+    if ( result.count( "batch" )) {
+        if ( result.count( "outdir" ) || result.count( "image_name" )) {
+            throw std::runtime_error( "--batch takes the images and output directories from the manifest" );
+        }
+        bulk_extractor_batch batch( cout, cerr, bulk_extractor_batch::read_manifest( result["batch"].as<std::string>()),
+                                    result["batch_jobs"].as<int>());
+        return batch.run( bulk_extractor_batch::common_args( argc, argv ));
+    }
     if ( result.count( "debug_help" )){ debug_help(); return 3;}
 
     sc.offset_add  = result["offset_add"].as<int64_t>();
@@ -327,6 +350,22 @@ int bulk_extractor_main( std::ostream &cout, std::ostream &cerr, int argc,char *
     } catch ( cxxopts::option_has_no_value_exception &e ) { }
 
     cfg.opt_recurse = result.count( "recurse" );
+    cfg.opt_direct_io = result.count( "direct_io" );
+    cfg.opt_auto_pagesize = result.count( "auto_pagesize" );
+    if ( cfg.opt_auto_pagesize && cfg.opt_pagesize % page_tuner::MIN_PAGESIZE != 0 ) {
+        throw std::runtime_error("--auto_pagesize needs a page size that is a multiple of " + std::to_string(page_tuner::MIN_PAGESIZE));
+    }
+
+    /* Options that change what the scanners find, for the dedup store's fingerprint.
+     * The -S options that only change how the image is read are left out.
+     */
+    static const std::set<std::string> io_settings {
+        "notify_rate", "report_read_errors", "sequential_read", "raw_mmap", "read_ahead_depth", "read_ahead_threads",
+        "image_hashes", "memory_budget", "auto_pagesize_pages", "checkpoint_interval", "skip_holes", "skip_constant_pages", "known_blocks", "known_blocks_min_run",
+        "dedup_db", "dedup_db_slots", "sampling_seed", "sampling_mode", "scheduler", "recurse_depth_workers"};
+    std::vector<std::string> scan_settings;
+    if ( result.count( "alert_list" )) scan_settings.push_back( "-r " + result["alert_list"].as<std::string>());
+    if ( result.count( "stop_list" ))  scan_settings.push_back( "-w " + result["stop_list"].as<std::string>());
 
     try {
         for ( const auto &it : result["set"].as<std::vector<std::string>>() ) {
@@ -336,6 +375,7 @@ int bulk_extractor_main( std::ostream &cout, std::ostream &cerr, int argc,char *
                 return -1;
             }
             sc.set_config(kv[0], kv[1]);
+            if ( io_settings.count( kv[0] )==0) scan_settings.push_back( "-S " + it );
         }
     } catch ( cxxopts::option_has_no_value_exception &e ) { }
 
@@ -387,6 +427,26 @@ int bulk_extractor_main( std::ostream &cout, std::ostream &cerr, int argc,char *
     //sc.get_global_config( "write_feature_files",&opt_write_feature_files,"Write features to flat files" );
     //sc.get_global_config( "write_feature_sqlite3",&opt_write_sqlite3,"Write feature files to report.sqlite3" );
     sc.get_global_config( "report_read_errors",&cfg.opt_report_read_errors,"Report read errors" );
+    sc.get_global_config( "sequential_read",&cfg.opt_sequential_read,"Reuse each page's margin for the next page instead of re-reading it" );
+    sc.get_global_config( "raw_mmap",&cfg.opt_raw_mmap,"Map raw and split-raw images into memory instead of copying each page" );
+    sc.get_global_config( "read_ahead_depth",&cfg.opt_read_ahead_depth,"Number of pages to read ahead of the scanners (0 to disable)" );
+    sc.get_global_config( "read_ahead_threads",&cfg.opt_read_ahead_threads,"Reader threads used for read-ahead when io_uring is not available" );
+    sc.get_global_config( "image_hashes",&cfg.opt_image_hashes,"Digests of the image to report, any of md5,sha1,sha256, each hashed on its own thread (empty for none)" );
+    sc.get_global_config( "skip_holes",&cfg.opt_skip_holes,"Do not read holes in sparse raw images" );
+    sc.get_global_config( "skip_constant_pages",&cfg.opt_skip_constant_pages,"Do not scan pages that are a single repeated byte (e.g. all zeros)" );
+    sc.get_global_config( "memory_budget",&cfg.opt_memory_budget,"MiB of memory for pages and decoded data; reading and decoding wait above it (0, the default, for no limit)" );
+    sc.get_global_config( "auto_pagesize_pages",&cfg.opt_auto_pagesize_pages,"With --auto_pagesize, pages to measure before first choosing the page size" );
+    sc.get_global_config( "scheduler",&cfg.opt_scheduler,"Phase 1 workers: be1 runs every scanner on a page in turn; be2 runs each scanner on each page as a task of its own" );
+    sc.get_global_config( "recurse_depth_workers",&cfg.opt_recurse_depth_workers,"With -S scheduler=be2, the most workers scanning recursive sbufs of one depth at a time; 0 for all but one" );
+    sc.get_global_config( "scanner_time_budget",&cfg.opt_scanner_time_budget,"Seconds a scanner may spend on one sbuf before it is asked to stop; overruns are listed in report.xml (0 for no limit)" );
+    sc.get_global_config( "classify_pages",&cfg.opt_classify_pages,"With -S scheduler=be2, classify each page's 4KiB blocks (zero, text, UTF-16, high-entropy, mixed) and do not run text and AES scanners on pages none of their features can start in. Changes results: text runs of under 15 bytes in high-entropy blocks are not scanned" );
+    sc.get_global_config( "checkpoint_interval",&cfg.opt_checkpoint_interval,"Seconds between saves of the pages the scanners have finished to checkpoint.bin, for restarting (0, the default, for none)" );
+    sc.get_global_config( "known_blocks",&cfg.opt_known_blocks,"Database of known-good 4KiB block MD5s (sorted binary, or one hex digest per line) not to scan" );
+    sc.get_global_config( "known_blocks_min_run",&cfg.opt_known_blocks_min_run,"Shortest run of known-good blocks to leave out of a page" );
+    sc.get_global_config( "dedup_db",&cfg.opt_dedup_db,"File of 4KiB blocks already scanned; pages whose blocks are all in it are skipped" );
+    sc.get_global_config( "dedup_db_slots",&cfg.opt_dedup_db_slots,"Number of blocks a new dedup_db can hold" );
+    sc.get_global_config( "sampling_seed",&cfg.sampling_seed,"Seed for random sampling (-s); the same seed samples the same blocks" );
+    sc.get_global_config( "sampling_mode",&cfg.sampling_mode,"Random sampling: bernoulli (each block with probability frac) or stratified (one block in every 1/frac)" );
 
     /* If we are getting help or info scanners, make a fake scanner set with new output directory,
      * then apply the scanner commands so we can get the feature recorders created...
@@ -408,16 +468,22 @@ int bulk_extractor_main( std::ostream &cout, std::ostream &cerr, int argc,char *
         }
     }
 
+    /* --merge reads the output directories of the shards instead of an image */
+    if ( result.count( "merge" ) && ( result.count( "image_name" ) || result.count( "shard" ))) {
+        throw std::runtime_error( "--merge takes the output directories of the shards, not an image" );
+    }
     try {
         sc.input_fname = result["image_name"].as<std::string>();
     } catch ( cxxopts::option_has_no_value_exception &e ) {
-        if ( cfg.opt_recurse ) {
-            cerr << "filedir not provided" << std::endl ;
-        } else {
-            cerr << "imagefile not provided" << std::endl ;
+        if ( result.count( "merge" ) == 0 ) {
+            if ( cfg.opt_recurse ) {
+                cerr << "filedir not provided" << std::endl ;
+            } else {
+                cerr << "imagefile not provided" << std::endl ;
+            }
+            cout << options.help() << std::endl;
+            return 3;
         }
-        cout << options.help() << std::endl;
-        return 3;
     }
 
 
@@ -425,6 +491,7 @@ int bulk_extractor_main( std::ostream &cout, std::ostream &cerr, int argc,char *
     try {
         for ( const auto &it : result["find"].as<std::vector<std::string>>() ) {
             sc.add_find_pattern( it );
+            scan_settings.push_back( "-f " + it );
         }
     } catch ( cxxopts::option_has_no_value_exception &e ) { }
 
@@ -432,6 +499,7 @@ int bulk_extractor_main( std::ostream &cout, std::ostream &cerr, int argc,char *
         /* For each 'find_file' option, add its path to the scanner config */
         for ( const auto &it : result["find_file"].as<std::vector<std::string>>() ) {
             sc.add_find_path( it );
+            scan_settings.push_back( "-F " + it );
         }
     } catch ( cxxopts::option_has_no_value_exception &e ) { }
 
@@ -492,9 +560,24 @@ int bulk_extractor_main( std::ostream &cout, std::ostream &cerr, int argc,char *
         throw std::runtime_error( "find words are specified with -F but no find scanner is enabled.");
     }
 
+    if ( result.count( "merge" )) {
+        if ( std::filesystem::exists( sc.outdir / Phase1::REPORT_FILENAME )) {
+            throw std::runtime_error( "--merge: " + sc.outdir.string() + " already has a " + Phase1::REPORT_FILENAME );
+        }
+        std::vector<std::filesystem::path> outdirs;
+        for ( const auto &it : result["merge"].as<std::vector<std::string>>() ) {
+            outdirs.push_back( it );
+        }
+        bulk_extractor_shard merger( cout, outdirs );
+        merger.read_reports();
+        merger.merge( ss, sc.outdir, original_argc, original_argv );
+        return 0;
+    }
+
     if ( result.count( "path" ) == 0 ){
         /* We are not running the path printer. See if we are restarting. */
 
+        cfg.checkpoint_fname = sc.outdir / Phase1::CHECKPOINT_FILENAME;
         if ( std::filesystem::exists( sc.outdir/"report.xml" )){
             /* We are restarting! */
             bulk_extractor_restarter r( sc,cfg);
@@ -518,6 +601,36 @@ int bulk_extractor_main( std::ostream &cout, std::ostream &cerr, int argc,char *
         std::cerr << "error: " << e.what() << " is a directory but -R (opt_recurse) not set" << std::endl;
         return 7;
     };
+    p->set_sequential_read( cfg.opt_sequential_read );
+    if (cfg.opt_direct_io && cfg.opt_raw_mmap) {
+        throw std::runtime_error("--direct_io and -S raw_mmap=1 conflict");
+    }
+    p->set_mmap( cfg.opt_raw_mmap );
+    p->set_direct_io( cfg.opt_direct_io );
+    if ( !p->seekable() ) {
+        if ( cfg.sampling_fraction < 1.0 ) {
+            throw std::runtime_error( "-s (sampling) needs to seek, and " + sc.input_fname.string() + " is a stream" );
+        }
+        if ( result.count( "path" ) ) {
+            throw std::runtime_error( "-p (path printing) needs to seek, and " + sc.input_fname.string() + " is a stream" );
+        }
+    }
+
+    /* --shard scans its range as -Y would */
+    unsigned shard_index = 0, shard_count = 0;
+    bulk_extractor_shard::range_t shard_range;
+    if ( result.count( "shard" )) {
+        if ( result.count( "scan" ) || cfg.sampling_fraction < 1.0 || cfg.opt_auto_pagesize ) {
+            throw std::runtime_error( "--shard conflicts with -Y, -s and --auto_pagesize" );
+        }
+        if ( !p->seekable() || !p->fixed_pages() ) {
+            throw std::runtime_error( "--shard needs a disk image, not a stream or a directory" );
+        }
+        bulk_extractor_shard::parse( result["shard"].as<std::string>(), shard_index, shard_count );
+        shard_range = bulk_extractor_shard::range( shard_index, shard_count, p->image_size(), cfg.opt_pagesize );
+        cfg.opt_scan_start = shard_range.start;
+        cfg.opt_scan_end   = shard_range.end;
+    }
 
     /* are we supposed to run the path printer? If so, we can use cout_, since the notify stream won't be running. */
     if ( result.count( "path" ) ) {
@@ -544,6 +657,20 @@ int bulk_extractor_main( std::ostream &cout, std::ostream &cerr, int argc,char *
     /* Start the clock */
     master_timer.start();
 
+    /* Blocks scanned with other scanners or settings must not match in the dedup store */
+    cfg.dedup_fingerprint = std::string(PACKAGE_VERSION)
+        + " pagesize=" + ( cfg.opt_auto_pagesize ? std::string("auto") : std::to_string(cfg.opt_pagesize))
+        + " marginsize=" + std::to_string(cfg.opt_marginsize) + " scanners=";
+    for ( auto const &it : ss.get_enabled_scanners()){
+        cfg.dedup_fingerprint += it + ",";
+    }
+    std::sort( scan_settings.begin(), scan_settings.end());
+    for ( auto const &it : scan_settings){
+        cfg.dedup_fingerprint += " " + it;
+    }
+
+    memory_budget::set_limit( cfg.opt_memory_budget * Phase1::Config::MiB );
+
     Phase1 phase1( cfg, *p, ss, cout);
 
     /* Validate the args */
@@ -591,16 +718,43 @@ int bulk_extractor_main( std::ostream &cout, std::ostream &cerr, int argc,char *
         fs.db_transaction_begin();
     }
 #endif
-    /* Go multi-threaded if requested */
-    if ( cfg.num_threads > 0){
+    /* --numa: the readers need pages to read ahead, and the workers are pinned as they start */
+    std::unique_ptr<numa_topology> numa;
+    if ( result.count( "numa" ) && cfg.num_threads > 0 ) {
+        numa = std::make_unique<numa_topology>();
+        if ( numa->size() > 1 ) {
+            cfg.numa = numa.get();
+            if ( cfg.opt_read_ahead_depth == 0 ) {
+                cfg.opt_read_ahead_depth = 4 * numa->size();
+            }
+        } else {
+            cout << "--numa: only one NUMA node; threads are not pinned" << std::endl;
+            numa.reset();
+        }
+    }
+
+    /* Go multi-threaded if requested. With be2, Phase 1 starts its own workers. */
+    if ( cfg.opt_scheduler != "be1" && cfg.opt_scheduler != "be2" ) {
+        throw std::runtime_error( "-S scheduler=" + cfg.opt_scheduler + ": must be be1 or be2" );
+    }
+    if ( cfg.num_threads > 0 && cfg.opt_scheduler == "be2" ) {
+        cout << "going multi-threaded...( " << cfg.num_threads << ", a task per page and scanner )" << std::endl ;
+    } else if ( cfg.num_threads > 0){
         cout << "going multi-threaded...( " << cfg.num_threads << " )" << std::endl ;
+        auto threads_before = numa_topology::threads();
         ss.launch_workers( cfg.num_threads);
+        if ( numa ) {
+            numa->place_workers( threads_before );
+        }
     } else {
         cout << "running single-threaded (DEBUG)..." << std::endl ;
     }
 
     phase1.dfxml_write_create( original_argc, original_argv);
     xreport->xmlout( "provided_filename", sc.input_fname ); // save this information
+    if ( shard_count > 0 ) {
+        xreport->xmlout( "shard", "", bulk_extractor_shard::xml_attrs( shard_index, shard_count, shard_range ), false );
+    }
     xreport->add_timestamp( "phase1 start" );
 
     if ( cfg.opt_notification) {
@@ -659,6 +813,10 @@ int bulk_extractor_main( std::ostream &cout, std::ostream &cerr, int argc,char *
     if ( !cfg.opt_quiet) cout << "Phase 3. Generating stats and printing final usage information" << std::endl;
     xreport->push( "report" );
     xreport->xmlout( "total_bytes",phase1.total_bytes);
+    xreport->xmlout( "skipped_hole_bytes",phase1.skipped_hole_bytes);
+    xreport->xmlout( "skipped_constant_bytes",phase1.skipped_constant_bytes);
+    xreport->xmlout( "skipped_known_bytes",phase1.skipped_known_bytes);
+    xreport->xmlout( "skipped_duplicate_bytes",phase1.skipped_duplicate_bytes);
     xreport->xmlout( "elapsed_seconds",master_timer.elapsed_seconds());
     xreport->xmlout( "max_depth_seen",ss.get_max_depth_seen());
     xreport->xmlout( "dup_bytes_encountered",ss.get_dup_bytes_encountered());
@@ -667,6 +825,33 @@ int bulk_extractor_main( std::ostream &cout, std::ostream &cerr, int argc,char *
     xreport->xmlout( "producer_timer_ns", ss.producer_wait_ns() );
     xreport->xmlout( "consumer_wait_ns", ss.consumer_wait_ns() );
     xreport->xmlout( "consumer_wait_ns_per_worker", ss.consumer_wait_ns_per_worker() );
+    if ( numa ) {
+        if ( cfg.opt_scheduler == "be2" ) {
+            uint64_t local = 0, remote = 0;
+            for ( const auto &node : numa->nodes ) {
+                local += node.tasks_local;
+                remote += node.tasks_remote;
+            }
+            std::stringstream attrs;
+            attrs << "tasks_local='" << local << "' tasks_remote='" << remote
+                  << "' local_fraction='" << ( local + remote ? static_cast<double>( local ) / ( local + remote ) : 0 ) << "'";
+            xreport->xmlout( "numa_page_placement", "node_local", attrs.str(), false );
+        } else {
+            xreport->xmlout( "numa_page_placement", "interleaved", "node_local_workers='0'", false );
+        }
+        for ( const auto &node : numa->nodes ) {
+            std::stringstream attrs;
+            attrs << "id='" << node.id << "' cpus='" << node.cpus.size() << "' workers='" << node.workers.size()
+                  << "' reader_threads='" << node.reader_threads << "' pages_read='" << node.pages_read
+                  << "' bytes_read='" << node.bytes_read << "' worker_cpu_seconds='" << node.worker_cpu_seconds
+                  << "' read_mb_per_sec='" << node.bytes_read / 1000000.0 / master_timer.elapsed_seconds() << "'";
+            if ( cfg.opt_scheduler == "be2" ) {
+                attrs << " pages_placed='" << node.pages_placed << "' tasks_local='" << node.tasks_local
+                      << "' tasks_remote='" << node.tasks_remote << "'";
+            }
+            xreport->xmlout( "numa_node", "", attrs.str(), false );
+        }
+    }
     ss.dump_scanner_stats();
     ss.dump_name_count_stats();
     xreport->pop( "report" );
@@ -681,6 +866,12 @@ int bulk_extractor_main( std::ostream &cout, std::ostream &cerr, int argc,char *
         cout.precision( 4 );
         cout << "Elapsed time: "        << master_timer.elapsed_seconds()     << " sec." << std::endl
              << "Total MB processed: "  << int( phase1.total_bytes / 1000000) << std::endl
+             << "Total MB skipped:   "  << int( ( phase1.skipped_hole_bytes + phase1.skipped_constant_bytes
+                                              + phase1.skipped_known_bytes + phase1.skipped_duplicate_bytes) / 1000000)
+             << " ( holes: " << int( phase1.skipped_hole_bytes / 1000000)
+             << ", constant pages: " << int( phase1.skipped_constant_bytes / 1000000)
+             << ", known: " << int( phase1.skipped_known_bytes / 1000000)
+             << ", duplicates: " << int( phase1.skipped_duplicate_bytes / 1000000) << ")" << std::endl
              << "Overall performance: " << mb_per_sec << " MBytes/sec ";
         if ( cfg.num_threads>0){
             cout << mb_per_sec/cfg.num_threads << " (MBytes/sec/thread)" << std::endl ;
@@ -719,6 +910,10 @@ int bulk_extractor_main( std::ostream &cout, std::ostream &cerr, int argc,char *
         cout << "Did not scan for email addresses." << std::endl;
     }
 
+    /* The image may hold sbufs of its own (mmap mode), so free it before checking for leaks */
+    delete p;
+    p = nullptr;
+
     if (start_sbuf_count != sbuf_t::sbuf_count) {
         cerr << "sbuf_t leak detected. Initial sbuf_t.sbuf_total="
              << start_sbuf_count << "  end sbuf_count=" << sbuf_t::sbuf_count << std::endl;
@@ -737,8 +932,6 @@ int bulk_extractor_main( std::ostream &cout, std::ostream &cerr, int argc,char *
 
     delete xreport;                     // no longer needed
     xreport=nullptr;                    // and zero it out.
-    delete p;
-    p = nullptr;
 
     muntrace();
     return( 0 );
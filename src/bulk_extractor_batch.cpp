@@ -0,0 +1,162 @@
+/*
+ * bulk_extractor_batch.cpp:
+ *
+ * --batch mode. See bulk_extractor_batch.h
+ */
+
+#include "config.h"
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#ifdef HAVE_SYS_WAIT_H
+#include <sys/wait.h>
+#endif
+
+#include <algorithm>
+#include <fstream>
+#include <set>
+#include <stdexcept>
+
+#include "bulk_extractor.h"
+#include "bulk_extractor_batch.h"
+#include "phase1.h"
+
+std::vector<bulk_extractor_batch::entry_t> bulk_extractor_batch::read_manifest(const std::filesystem::path &fname)
+{
+    std::ifstream in(fname);
+    if (!in.is_open()) {
+        throw std::runtime_error("cannot open manifest " + fname.string());
+    }
+    std::vector<entry_t> entries;
+    std::set<std::filesystem::path> outdirs;
+    std::string line;
+    for (int lineno = 1; std::getline(in, line); lineno++) {
+        if (line.size() > 0 && line.back() == '\r') line.pop_back();
+        if (line.empty() || line[0] == '#') continue;
+        size_t tab = line.find('\t');
+        if (tab == std::string::npos || tab == 0 || tab + 1 == line.size() || line.find('\t', tab + 1) != std::string::npos) {
+            throw std::runtime_error(fname.string() + " line " + std::to_string(lineno) + ": expected <image> TAB <outdir>");
+        }
+        entry_t entry {line.substr(0, tab), line.substr(tab + 1)};
+        if (!outdirs.insert(entry.outdir.lexically_normal()).second) {
+            throw std::runtime_error(fname.string() + " line " + std::to_string(lineno) + ": " + entry.outdir.string() + " is used twice");
+        }
+        entries.push_back(entry);
+    }
+    return entries;
+}
+
+std::vector<std::string> bulk_extractor_batch::common_args(int argc, char * const *argv)
+{
+    std::vector<std::string> args;
+    for (int i = 0; i < argc; i++) {
+        const std::string arg(argv[i]);
+        if (arg == "--batch" || arg == "--batch_jobs") {
+            i++;                        // and its value
+            continue;
+        }
+        if (arg.rfind("--batch=", 0) == 0 || arg.rfind("--batch_jobs=", 0) == 0) {
+            continue;
+        }
+        args.push_back(arg);
+    }
+    return args;
+}
+
+std::vector<std::string> bulk_extractor_batch::image_args(const std::vector<std::string> &common, const entry_t &entry)
+{
+    std::vector<std::string> args(common);
+    args.push_back("-o");
+    args.push_back(entry.outdir.string());
+    args.push_back(entry.image.string());
+    return args;
+}
+
+/* A run that finished ends report.xml by closing the dfxml element */
+bool bulk_extractor_batch::finished(const std::filesystem::path &outdir)
+{
+    std::ifstream in(outdir / Phase1::REPORT_FILENAME, std::ios::binary | std::ios::ate);
+    if (!in.is_open()) return false;
+    const std::streamoff size = in.tellg();
+    const std::streamoff tail = std::min(size, static_cast<std::streamoff>(64));
+    std::string buf(tail, '\0');
+    in.seekg(size - tail);
+    in.read(&buf[0], tail);
+    return buf.find("</dfxml>") != std::string::npos;
+}
+
+bulk_extractor_batch::bulk_extractor_batch(std::ostream &cout_, std::ostream &cerr_, const std::vector<entry_t> &entries_, unsigned jobs_):
+    cout(cout_), cerr(cerr_), entries(entries_), jobs(jobs_ > 0 ? jobs_ : 1)
+{
+}
+
+unsigned bulk_extractor_batch::run_entries(const std::vector<std::string> &common, size_t first, size_t step)
+{
+    unsigned failures = 0;
+    for (size_t i = first; i < entries.size(); i += step) {
+        const entry_t &entry = entries[i];
+        if (finished(entry.outdir)) {
+            cout << "batch: " << entry.image << " already scanned in " << entry.outdir << std::endl;
+            continue;
+        }
+        cout << "batch: scanning " << entry.image << " (" << i + 1 << " of " << entries.size() << ")" << std::endl;
+        auto args = image_args(common, entry);
+        std::vector<char *> argv;
+        for (auto &arg : args) {
+            argv.push_back(&arg[0]);
+        }
+        argv.push_back(nullptr);
+        int ret = -1;
+        try {
+            ret = bulk_extractor_main(cout, cerr, static_cast<int>(args.size()), argv.data());
+        }
+        catch (const std::exception &e) {
+            cerr << "batch: " << entry.image << ": " << e.what() << std::endl;
+        }
+        if (ret != 0) {
+            cerr << "batch: " << entry.image << " failed (" << ret << ")" << std::endl;
+            failures += 1;
+        }
+    }
+    return failures;
+}
+
+int bulk_extractor_batch::run(const std::vector<std::string> &common)
+{
+    unsigned failures = 0;
+#if defined(HAVE_FORK) && defined(HAVE_SYS_WAIT_H)
+    if (jobs > 1 && entries.size() > 1) {
+        const size_t children = std::min(static_cast<size_t>(jobs), entries.size());
+        std::vector<pid_t> pids;
+        cout.flush();
+        cerr.flush();
+        for (size_t child = 0; child < children; child++) {
+            pid_t pid = fork();
+            if (pid < 0) {
+                throw std::runtime_error("batch: fork failed");
+            }
+            if (pid == 0) {
+                unsigned child_failures = run_entries(common, child, children);
+                cout.flush();
+                cerr.flush();
+                _exit(child_failures > 0 ? 1 : 0);
+            }
+            pids.push_back(pid);
+        }
+        for (auto pid : pids) {
+            int status = 0;
+            if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+                failures += 1;
+            }
+        }
+        cout << "batch: " << entries.size() << " images in " << children << " processes; "
+             << failures << " processes had failures" << std::endl;
+        return failures > 0 ? 1 : 0;
+    }
+#endif
+    failures = run_entries(common, 0, 1);
+    cout << "batch: " << entries.size() << " images; " << failures << " failed" << std::endl;
+    return failures > 0 ? 1 : 0;
+}
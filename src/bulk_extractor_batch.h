@@ -0,0 +1,55 @@
+/*
+ * bulk_extractor_batch.h:
+ *
+ * --batch: scan many images with the same options in one process.
+ *
+ * The manifest has a line for each image: the image, a tab, and its output directory.
+ * Blank lines and lines that begin with # are ignored. Each image is scanned by
+ * bulk_extractor_main() with the other options of the command line, so it gets its own
+ * scanner_set, feature files and report.xml, and is restarted like any other run if its
+ * report.xml is incomplete. Images whose report.xml is complete are skipped.
+ *
+ * What one process saves is starting a process for each image: exec, loading the program and its
+ * libraries, and scan_find's regexes, which are compiled again only when they change. Each image
+ * still builds its scanner_set and runs every scanner's PHASE_INIT, because be20_api binds the
+ * feature recorders to the output directory when the scanner_set is built. batch_startup_benchmark
+ * in test_be3.cpp measures the time per image both ways.
+ * The scanners keep process-wide state, so images are not scanned on threads of one process:
+ * with --batch_jobs N, N child processes are forked and each scans every Nth image back to back.
+ */
+
+#ifndef BULK_EXTRACTOR_BATCH_H
+#define BULK_EXTRACTOR_BATCH_H
+
+#include <filesystem>
+#include <ostream>
+#include <string>
+#include <vector>
+
+class bulk_extractor_batch {
+public:
+    struct entry_t {
+        std::filesystem::path image {};
+        std::filesystem::path outdir {};
+    };
+
+    /* Throws std::runtime_error with the line number for a line that is not <image> TAB <outdir>,
+     * or for an output directory that appears twice.
+     */
+    static std::vector<entry_t> read_manifest(const std::filesystem::path &fname);
+    static std::vector<std::string> common_args(int argc, char * const *argv); // argv without the --batch options
+    static std::vector<std::string> image_args(const std::vector<std::string> &common, const entry_t &entry);
+    static bool finished(const std::filesystem::path &outdir); // report.xml is complete
+
+    bulk_extractor_batch(std::ostream &cout_, std::ostream &cerr_, const std::vector<entry_t> &entries_, unsigned jobs_);
+    int run(const std::vector<std::string> &common); // returns 0 if every image was scanned
+
+private:
+    std::ostream &cout;
+    std::ostream &cerr;
+    const std::vector<entry_t> entries;
+    const unsigned jobs;
+    unsigned run_entries(const std::vector<std::string> &common, size_t first, size_t step); // returns failures
+};
+
+#endif
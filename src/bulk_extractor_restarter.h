@@ -54,9 +54,7 @@ public:;
         class bulk_extractor_restarter &self = *(bulk_extractor_restarter *)userData;
         self.cdata.write(s,len);
     }
-    void restart() {
-        std::filesystem::path report_path = sc.outdir / Phase1::REPORT_FILENAME;
-
+    void parse_report(const std::filesystem::path &report_path) {
         XML_Parser parser = XML_ParserCreate(NULL);
         XML_SetUserData(parser, this);
         XML_SetElementHandler(parser, startElement, endElement);
@@ -83,14 +81,23 @@ public:;
         }
         XML_ParserFree(parser);
         in.close();
-        /* Now rename the report filename */
-        std::filesystem::path report_path_bak = report_path.string() + "." + std::to_string(time( nullptr));
-        std::filesystem::rename(report_path, report_path_bak);
     }
 #else
-    void restart() {
+    void parse_report(const std::filesystem::path &report_path) {
         throw std::runtime_error("Compiled without libexpat; cannot restart.");
     }
 #endif
+    /* Find the pages done in the checkpoint if there is one, otherwise in report.xml */
+    void restart() {
+        std::filesystem::path report_path = sc.outdir / Phase1::REPORT_FILENAME;
+        if (page_checkpoint::valid(cfg.checkpoint_fname, cfg.checkpoint_unit())) {
+            cfg.restart_from_checkpoint = true;
+        } else {
+            parse_report(report_path);
+        }
+        /* Now rename the report filename */
+        std::filesystem::path report_path_bak = report_path.string() + "." + std::to_string(time( nullptr));
+        std::filesystem::rename(report_path, report_path_bak);
+    }
 };
 #endif
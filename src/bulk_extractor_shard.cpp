@@ -0,0 +1,397 @@
+/*
+ * bulk_extractor_shard.cpp:
+ *
+ * --shard and --merge. See bulk_extractor_shard.h
+ */
+
+#include "config.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+
+#ifdef HAVE_EXPAT_H
+#include <expat.h>
+#endif
+
+#include "dfxml_cpp/src/dfxml_writer.h"
+
+#include "bulk_extractor_batch.h"
+#include "bulk_extractor_shard.h"
+#include "phase1.h"
+
+void bulk_extractor_shard::parse(const std::string &spec, unsigned &index, unsigned &count)
+{
+    const size_t slash = spec.find('/');
+    if (slash == std::string::npos || slash == 0 || slash + 1 == spec.size()
+        || spec.find_first_not_of("0123456789/") != std::string::npos || spec.find('/', slash + 1) != std::string::npos) {
+        throw std::invalid_argument("--shard " + spec + ": expected <i>/<N>");
+    }
+    index = std::stoul(spec.substr(0, slash));
+    count = std::stoul(spec.substr(slash + 1));
+    if (index < 1 || index > count) {
+        throw std::invalid_argument("--shard " + spec + ": i must be from 1 to N");
+    }
+}
+
+bulk_extractor_shard::range_t bulk_extractor_shard::range(unsigned index, unsigned count, uint64_t image_size, uint64_t pagesize)
+{
+    const uint64_t pages = pagesize > 0 ? (image_size + pagesize - 1) / pagesize : 0;
+    if (count > pages) {
+        throw std::invalid_argument(std::to_string(count) + " shards, but the image has only "
+                                    + std::to_string(pages) + " pages");
+    }
+    range_t r;
+    r.start = (index - 1) * pages / count * pagesize;
+    r.end   = index == count ? image_size : index * pages / count * pagesize;
+    return r;
+}
+
+std::string bulk_extractor_shard::xml_attrs(unsigned index, unsigned count, const range_t &r)
+{
+    return "index='" + std::to_string(index) + "' count='" + std::to_string(count)
+        + "' start='" + std::to_string(r.start) + "' end='" + std::to_string(r.end) + "'";
+}
+
+/****************************************************************
+ ** Combining report.xml blocks
+ **/
+
+static bool is_number(const std::string &str)
+{
+    if (str.empty()) return false;
+    char *end = nullptr;
+    strtod(str.c_str(), &end);
+    return *end == '\0';
+}
+
+static bool is_integer(const std::string &str)
+{
+    return str.find_first_not_of("-0123456789") == std::string::npos;
+}
+
+/* The shards ran at the same time, so these are the longest of them rather than the total */
+static bool is_max(const std::string &name)
+{
+    return name == "elapsed_seconds" || name == "clocktime" || name == "maxrss" || name == "max_depth_seen";
+}
+
+/* Elements are the same if they have the same name and attributes, and the same text in their
+ * children that are not numbers (such as the name of a scanner). Numbers are what is added up.
+ */
+static std::string key(const bulk_extractor_shard::element_t &e)
+{
+    std::string k = e.name + " " + e.attrs;
+    if (e.children.empty()) {
+        return is_number(e.text) ? k : k + " " + e.text;
+    }
+    for (const auto &child : e.children) {
+        if (child.children.empty() && !is_number(child.text)) {
+            k += " " + child.name + "=" + child.text;
+        }
+    }
+    return k;
+}
+
+static std::string add(const std::string &name, const std::string &a, const std::string &b)
+{
+    if (is_integer(a) && is_integer(b)) {
+        const int64_t x = std::stoll(a), y = std::stoll(b);
+        return std::to_string(is_max(name) ? std::max(x, y) : x + y);
+    }
+    const double x = std::stod(a), y = std::stod(b);
+    std::stringstream ss;
+    ss << (is_max(name) ? std::max(x, y) : x + y);
+    return ss.str();
+}
+
+void bulk_extractor_shard::combine(element_t &into, const element_t &from)
+{
+    for (const auto &child : from.children) {
+        const std::string k = key(child);
+        auto match = std::find_if(into.children.begin(), into.children.end(),
+                                  [&k](const element_t &e) { return key(e) == k; });
+        if (match == into.children.end()) {
+            into.children.push_back(child);
+        } else if (child.children.empty()) {
+            if (is_number(child.text) && is_number(match->text)) {
+                match->text = add(child.name, match->text, child.text);
+            }
+        } else {
+            combine(*match, child);
+        }
+    }
+}
+
+static void write_element(dfxml_writer &xreport, const bulk_extractor_shard::element_t &e)
+{
+    if (e.children.empty()) {
+        xreport.xmlout(e.name, e.text, e.attrs, true);
+        return;
+    }
+    xreport.push(e.name, e.attrs);
+    for (const auto &child : e.children) {
+        write_element(xreport, child);
+    }
+    xreport.pop(e.name);
+}
+
+/****************************************************************
+ ** Feature lines
+ **/
+
+uint64_t bulk_extractor_shard::feature_offset(const std::string &line)
+{
+    return strtoull(line.c_str(), nullptr, 10);
+}
+
+/* "1234" is offset 1234 of the image; "1234-GZIP-56" is offset 56 of the data decompressed at 1234 */
+pos0_t bulk_extractor_shard::parse_pos0(const std::string &str)
+{
+    const size_t dash = str.rfind('-');
+    const std::string offset = dash == std::string::npos ? str : str.substr(dash + 1);
+    if (offset.empty() || offset.find_first_not_of("0123456789") != std::string::npos) {
+        return pos0_t(str, 0);
+    }
+    return pos0_t(dash == std::string::npos ? "" : str.substr(0, dash), std::stoull(offset));
+}
+
+std::string bulk_extractor_shard::unescape(const std::string &str)
+{
+    std::string ret;
+    ret.reserve(str.size());
+    for (size_t i = 0; i < str.size(); i++) {
+        if (str[i] == '\\' && i + 3 < str.size() && str[i + 1] == 'x'
+            && isxdigit(static_cast<unsigned char>(str[i + 2])) && isxdigit(static_cast<unsigned char>(str[i + 3]))) {
+            ret.push_back(static_cast<char>(std::stoi(str.substr(i + 2, 2), nullptr, 16)));
+            i += 3;
+        } else {
+            ret.push_back(str[i]);
+        }
+    }
+    return ret;
+}
+
+/****************************************************************
+ ** Reading the shards' reports
+ **/
+
+bulk_extractor_shard::bulk_extractor_shard(std::ostream &cout_, const std::vector<std::filesystem::path> &outdirs_):
+    cout(cout_), outdirs(outdirs_)
+{
+}
+
+#ifdef HAVE_LIBEXPAT
+namespace {
+struct report_reader {
+    bulk_extractor_shard::shard_t &shard;
+    std::vector<std::string> path {};                   // of the element being read
+    std::vector<bulk_extractor_shard::element_t *> open {}; // elements of <report> and <rusage> being read
+    std::string cdata {};
+
+    static void start_element(void *data, const char *name_, const char **attrs) {
+        report_reader &self = *static_cast<report_reader *>(data);
+        const std::string name(name_);
+        std::string attr_str;
+        for (int i = 0; attrs[i] && attrs[i + 1]; i += 2) {
+            attr_str += (attr_str.empty() ? "" : " ") + std::string(attrs[i]) + "='" + attrs[i + 1] + "'";
+            if (name == "shard" && self.path.size() == 1) {
+                if (strcmp(attrs[i], "index") == 0) self.shard.index = std::stoul(attrs[i + 1]);
+                if (strcmp(attrs[i], "count") == 0) self.shard.count = std::stoul(attrs[i + 1]);
+                if (strcmp(attrs[i], "start") == 0) self.shard.range.start = std::stoull(attrs[i + 1]);
+                if (strcmp(attrs[i], "end") == 0)   self.shard.range.end = std::stoull(attrs[i + 1]);
+            }
+        }
+        if (self.path.size() == 1 && (name == "report" || name == "rusage")) {
+            auto &e = name == "report" ? self.shard.report : self.shard.rusage;
+            e = bulk_extractor_shard::element_t{name, attr_str};
+            self.open.push_back(&e);
+        } else if (!self.open.empty()) {
+            auto &children = self.open.back()->children;
+            children.push_back(bulk_extractor_shard::element_t{name, attr_str});
+            self.open.push_back(&children.back());
+        }
+        self.path.push_back(name);
+        self.cdata.clear();
+    }
+    static void end_element(void *data, const char *name_) {
+        report_reader &self = *static_cast<report_reader *>(data);
+        const std::string name(name_);
+        std::string text = self.cdata;
+        text.erase(0, text.find_first_not_of(" \t\r\n"));
+        text.erase(text.find_last_not_of(" \t\r\n") + 1);
+        if (!self.open.empty()) {
+            self.open.back()->text = text;
+            self.open.pop_back();
+        }
+        if (name == "provided_filename" && self.path.size() == 2) self.shard.provided_filename = text;
+        if (name == "image_size" && self.path.size() == 3 && self.path[1] == "source") self.shard.image_size = text;
+        self.path.pop_back();
+        self.cdata.clear();
+    }
+    static void character_data(void *data, const XML_Char *s, int len) {
+        static_cast<report_reader *>(data)->cdata.append(s, len);
+    }
+};
+}
+
+void bulk_extractor_shard::read_report(shard_t &shard)
+{
+    const std::filesystem::path report_path = shard.outdir / Phase1::REPORT_FILENAME;
+    std::ifstream in(report_path, std::ios::binary);
+    if (!in.is_open()) {
+        throw std::runtime_error("cannot open " + report_path.string());
+    }
+    report_reader reader{shard};
+    XML_Parser parser = XML_ParserCreate(NULL);
+    XML_SetUserData(parser, &reader);
+    XML_SetElementHandler(parser, report_reader::start_element, report_reader::end_element);
+    XML_SetCharacterDataHandler(parser, report_reader::character_data);
+    std::vector<char> buf(1024 * 1024);
+    bool ok = true;
+    while (ok && in) {
+        in.read(buf.data(), buf.size());
+        ok = XML_Parse(parser, buf.data(), in.gcount(), in.eof()) != XML_STATUS_ERROR;
+    }
+    const std::string error = ok ? "" : std::string(XML_ErrorString(XML_GetErrorCode(parser)))
+        + " at line " + std::to_string(XML_GetCurrentLineNumber(parser));
+    XML_ParserFree(parser);
+    if (!ok) {
+        throw std::runtime_error(report_path.string() + ": " + error);
+    }
+}
+#else
+void bulk_extractor_shard::read_report(shard_t &shard)
+{
+    throw std::runtime_error("Compiled without libexpat; cannot merge.");
+}
+#endif
+
+void bulk_extractor_shard::read_reports()
+{
+    shards.clear();
+    for (const auto &outdir : outdirs) {
+        if (!bulk_extractor_batch::finished(outdir)) {
+            throw std::runtime_error("--merge: " + outdir.string() + " does not have a complete " + Phase1::REPORT_FILENAME);
+        }
+        shard_t shard;
+        shard.outdir = outdir;
+        read_report(shard);
+        if (shard.count == 0) {
+            throw std::runtime_error("--merge: " + outdir.string() + " was not scanned with --shard");
+        }
+        shards.push_back(shard);
+    }
+    std::sort(shards.begin(), shards.end(), [](const shard_t &a, const shard_t &b) { return a.index < b.index; });
+    for (size_t i = 0; i < shards.size(); i++) {
+        const shard_t &shard = shards[i];
+        if (shard.count != shards.size() || shard.index != i + 1) {
+            throw std::runtime_error("--merge: needs shards 1 to " + std::to_string(shard.count) + " once each; "
+                                     + shard.outdir.string() + " is shard " + std::to_string(shard.index)
+                                     + "/" + std::to_string(shard.count));
+        }
+        if (shard.provided_filename != shards[0].provided_filename) {
+            throw std::runtime_error("--merge: " + shard.outdir.string() + " is a shard of " + shard.provided_filename
+                                     + ", not " + shards[0].provided_filename);
+        }
+        if (i > 0 && shard.range.start != shards[i - 1].range.end) {
+            throw std::runtime_error("--merge: " + shard.outdir.string() + " does not start where shard "
+                                     + std::to_string(i) + " ends (the page sizes differ)");
+        }
+    }
+}
+
+/****************************************************************
+ ** Merging
+ **/
+
+/* Each shard's lines are sorted by offset. The lines a shard found in its margin are carried into
+ * the next shard's lines, unless the next shard found the same line.
+ */
+uint64_t bulk_extractor_shard::merge_feature_file(feature_recorder &fr, const std::string &name)
+{
+    typedef std::pair<uint64_t, std::string> line_t; // (offset, line)
+    uint64_t dropped = 0;
+    std::vector<line_t> carried;
+    for (size_t i = 0; i < shards.size(); i++) {
+        std::vector<line_t> lines;
+        std::ifstream in(shards[i].outdir / (name + ".txt"), std::ios::binary);
+        std::string line;
+        while (std::getline(in, line)) {
+            if (line.compare(0, 3, "\xEF\xBB\xBF") == 0) line.erase(0, 3); // BOM
+            if (line.empty() || line[0] == '#') continue;
+            lines.push_back(line_t(feature_offset(line), line));
+        }
+        std::sort(lines.begin(), lines.end());
+        std::vector<line_t> kept;
+        for (const auto &c : carried) {
+            if (std::binary_search(lines.begin(), lines.end(), c)) {
+                dropped += 1;
+            } else {
+                kept.push_back(c);
+            }
+        }
+        std::vector<line_t> merged;
+        std::merge(lines.begin(), lines.end(), kept.begin(), kept.end(), std::back_inserter(merged));
+        lines.clear();
+        carried.clear();
+        for (const auto &[offset, text] : merged) {
+            if (i + 1 < shards.size() && offset >= shards[i].range.end) {
+                carried.push_back(line_t(offset, text));
+                continue;
+            }
+            const size_t tab1 = text.find('\t');
+            if (tab1 == std::string::npos) continue;
+            const size_t tab2 = text.find('\t', tab1 + 1);
+            const std::string feature = text.substr(tab1 + 1, tab2 == std::string::npos ? std::string::npos : tab2 - tab1 - 1);
+            const std::string context = tab2 == std::string::npos ? "" : text.substr(tab2 + 1);
+            fr.write(parse_pos0(text.substr(0, tab1)), unescape(feature), unescape(context));
+        }
+    }
+    return dropped;
+}
+
+void bulk_extractor_shard::merge(scanner_set &ss, const std::filesystem::path &outdir, int argc, char * const *argv)
+{
+    dfxml_writer *xreport = new dfxml_writer(outdir / Phase1::REPORT_FILENAME, false);
+    ss.set_dfxml_writer(xreport);
+    xreport->push("dfxml", "xmloutputversion='1.0'");
+    xreport->add_DFXML_creator(PACKAGE_NAME, PACKAGE_VERSION, "", argc, argv);
+    xreport->xmlout("provided_filename", shards[0].provided_filename);
+    xreport->push("source");
+    xreport->xmlout("image_filename", shards[0].provided_filename);
+    xreport->xmlout("image_size", shards[0].image_size);
+    xreport->pop("source");
+    xreport->push("merge");
+    for (const auto &shard : shards) {
+        xreport->xmlout("shard", shard.outdir.string(), xml_attrs(shard.index, shard.count, shard.range), true);
+    }
+
+    ss.phase_scan();
+    uint64_t dropped = 0;
+    for (const auto &name : ss.feature_file_list()) {
+        dropped += merge_feature_file(ss.named_feature_recorder(name), name);
+    }
+    xreport->xmlout("overlap_duplicates_dropped", dropped);
+    xreport->pop("merge");
+    cout << "merge: " << shards.size() << " shards; " << dropped << " duplicate features in the margins dropped" << std::endl;
+    cout << "Computing final histograms and shutting down..." << std::endl;
+    ss.shutdown();
+
+    element_t report = shards[0].report;
+    element_t rusage = shards[0].rusage;
+    for (size_t i = 1; i < shards.size(); i++) {
+        combine(report, shards[i].report);
+        combine(rusage, shards[i].rusage);
+    }
+    if (!report.name.empty()) write_element(*xreport, report);
+    if (!rusage.name.empty()) write_element(*xreport, rusage);
+    xreport->pop("dfxml");
+    xreport->close();
+    delete xreport;
+}
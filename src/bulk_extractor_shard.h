@@ -0,0 +1,84 @@
+/*
+ * bulk_extractor_shard.h:
+ *
+ * --shard i/N: scan one of N parts of an image, so that an image can be spread over processes or hosts.
+ * --merge: join the output directories of the N shards into one.
+ *
+ * The image is split on page boundaries into N ranges of about the same number of pages, and
+ * shard i scans the i'th range (1 <= i <= N) as -Y start-end would. The last page of a shard is
+ * read with its margin like any other page, so a feature that crosses into the next range is found.
+ * Each shard records its range in a <shard> element of its report.xml.
+ *
+ * The merge reads the feature files of the shards in order, sorts each by pos0 and writes the features
+ * through the feature recorders of the merged directory, so the histograms are rebuilt from the merged
+ * features when the scanners shut down. A feature a shard reports in its margin is dropped if the next
+ * shard reports the same line. The <report> and <rusage> blocks of the shards are added up; the
+ * elapsed and clock times are the longest of the shards, since they ran at the same time.
+ *
+ * The merge must be run with the scanners of the shards (the same -e, -x and -S options).
+ * Only one shard's feature file is held in memory at a time. Carved files stay in the shard directories.
+ */
+
+#ifndef BULK_EXTRACTOR_SHARD_H
+#define BULK_EXTRACTOR_SHARD_H
+
+#include <cstdint>
+#include <filesystem>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "be20_api/scanner_set.h"
+
+class bulk_extractor_shard {
+public:
+    struct range_t {
+        uint64_t start {};
+        uint64_t end {};                // first byte after the range
+    };
+
+    /* "i/N" with 1 <= i <= N. Throws std::invalid_argument. */
+    static void parse(const std::string &spec, unsigned &index, unsigned &count);
+    /* Throws std::invalid_argument if there are more shards than pages */
+    static range_t range(unsigned index, unsigned count, uint64_t image_size, uint64_t pagesize);
+    static std::string xml_attrs(unsigned index, unsigned count, const range_t &r); // of the <shard> element
+
+    /* A report.xml element and everything in it */
+    struct element_t {
+        std::string name {};
+        std::string attrs {};
+        std::string text {};
+        std::vector<element_t> children {};
+    };
+    static void combine(element_t &into, const element_t &from); // add up numbers, keep the largest times
+
+    static uint64_t feature_offset(const std::string &line);     // the image offset of a feature line's pos0
+    static pos0_t parse_pos0(const std::string &str);
+    static std::string unescape(const std::string &str);        // undo the \xHH escapes of feature files
+
+    bulk_extractor_shard(std::ostream &cout_, const std::vector<std::filesystem::path> &outdirs_);
+    /* Read and check the shards' reports; throws std::runtime_error */
+    void read_reports();
+    /* Write the merged features, histograms and report.xml to outdir, the output directory of ss */
+    void merge(scanner_set &ss, const std::filesystem::path &outdir, int argc, char * const *argv);
+
+    struct shard_t {
+        std::filesystem::path outdir {};
+        unsigned  index {};
+        unsigned  count {};
+        range_t   range {};
+        std::string provided_filename {};
+        std::string image_size {};
+        element_t report {};
+        element_t rusage {};
+    };
+    std::vector<shard_t> shards {};      // in range order after read_reports()
+
+private:
+    std::ostream &cout;
+    const std::vector<std::filesystem::path> outdirs;
+    void read_report(shard_t &shard);
+    uint64_t merge_feature_file(feature_recorder &fr, const std::string &name); // returns lines dropped
+};
+
+#endif
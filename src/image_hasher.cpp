@@ -0,0 +1,142 @@
+/*
+ * image_hasher.cpp:
+ *
+ * Image hashing stage for Phase 1. See image_hasher.h
+ */
+
+#include "config.h"
+
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+
+#include "be20_api/utils.h"
+#include "be20_api/dfxml_cpp/src/hash_t.h"
+
+#include "image_hasher.h"
+
+template <typename GENERATOR>
+void image_hasher::add_alg(const std::string &type)
+{
+    auto g = std::make_shared<GENERATOR>();
+    alg_t alg;
+    alg.type      = type;
+    alg.update    = [g](const uint8_t *buf, size_t len) { g->update(buf, len); };
+    alg.hexdigest = [g]() { return g->digest().hexdigest(); };
+    algs.push_back(std::move(alg));
+}
+
+image_hasher::image_hasher(const std::string &names, size_t depth_):
+    depth(depth_>0 ? depth_ : 1)
+{
+    for (const auto &name : split(names, ',')) {
+        if (name=="md5") {
+            add_alg<dfxml::md5_generator>("MD5");
+        } else if (name=="sha1") {
+            add_alg<dfxml::sha1_generator>("SHA1");
+        } else if (name=="sha256") {
+            add_alg<dfxml::sha256_generator>("SHA256");
+        } else if (name.size()>0) {
+            throw std::invalid_argument("unknown image hash algorithm: " + name);
+        }
+    }
+    for (auto &alg : algs) {
+        alg.worker = new std::thread(&image_hasher::run, this, std::ref(alg));
+    }
+}
+
+image_hasher::~image_hasher()
+{
+    {
+        std::unique_lock<std::mutex> lock(M);
+        finished = true;
+    }
+    cv_work.notify_all();
+    for (auto &alg : algs) {
+        alg.worker->join();
+        delete alg.worker;
+        alg.worker = nullptr;
+    }
+}
+
+void image_hasher::update(const sbuf_t &sbuf)
+{
+    /* copy outside the lock; the scanners may delete the sbuf as soon as it is scheduled */
+    enqueue(sbuf.pos0.offset, sbuf.pagesize, [&sbuf](std::vector<uint8_t> &buf) {
+        buf.assign(sbuf.get_buf(), sbuf.get_buf() + sbuf.pagesize);
+    });
+}
+
+void image_hasher::update_zeros(uint64_t offset, size_t len)
+{
+    enqueue(offset, len, [len](std::vector<uint8_t> &buf) { buf.assign(len, 0); });
+}
+
+/* Queue len bytes at offset, which fill() puts into a buffer. Returns false if not hashing. */
+bool image_hasher::enqueue(uint64_t offset, size_t len, const std::function<void(std::vector<uint8_t> &)> &fill)
+{
+    if (algs.empty() || had_gap) return false;
+    if (offset != next_offset) {
+        had_gap = true;                 // we had a logical gap; stop hashing
+        return false;
+    }
+    next_offset += len;
+
+    auto page = std::make_shared<page_t>();
+    {
+        std::unique_lock<std::mutex> lock(M);
+        cv_free.wait(lock, [this]{ return busy < depth; });
+        busy += 1;
+        if (!spare.empty()) {
+            page->buf = std::move(spare.back());
+            spare.pop_back();
+        }
+    }
+    fill(page->buf);
+    page->hashers_left = algs.size();
+    {
+        std::unique_lock<std::mutex> lock(M);
+        for (auto &alg : algs) {
+            alg.queue.push_back(page);
+        }
+    }
+    cv_work.notify_all();
+    return true;
+}
+
+/* The thread of one algorithm. The last algorithm to hash a page recycles its buffer. */
+void image_hasher::run(alg_t &alg)
+{
+    for (;;) {
+        std::shared_ptr<page_t> page;
+        {
+            std::unique_lock<std::mutex> lock(M);
+            cv_work.wait(lock, [this, &alg]{ return finished || !alg.queue.empty(); });
+            if (alg.queue.empty()) return;  // finished, and nothing left to hash
+            page = std::move(alg.queue.front());
+            alg.queue.pop_front();
+        }
+        alg.update(page->buf.data(), page->buf.size());
+        {
+            std::unique_lock<std::mutex> lock(M);
+            if (--page->hashers_left > 0) continue;
+            spare.push_back(std::move(page->buf));
+            busy -= 1;
+        }
+        cv_free.notify_all();
+    }
+}
+
+image_hasher::digests_t image_hasher::digests()
+{
+    digests_t ret;
+    {
+        std::unique_lock<std::mutex> lock(M);
+        cv_free.wait(lock, [this]{ return busy == 0; });
+    }
+    if (had_gap) return ret;
+    for (auto &alg : algs) {
+        ret.push_back(std::make_pair(alg.type, alg.hexdigest()));
+    }
+    return ret;
+}
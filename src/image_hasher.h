@@ -0,0 +1,76 @@
+/*
+ * image_hasher.h:
+ *
+ * Hashes the image on a thread of its own, so that the producer only copies each page.
+ *
+ * Phase 1 hands every page to update() in image order. The page is copied once into one of a few
+ * recycled buffers, which is queued for each requested algorithm. Each algorithm runs on a thread of
+ * its own, so asking for md5, sha1 and sha256 takes as long as the slowest of them, not their sum;
+ * the buffer is recycled when the last of them is done with it. The digests come from dfxml's hash generators (OpenSSL), which use SHA-NI and AVX2 where the CPU has them.
+ *
+ * A hash of the image can only be computed if the pages arrive contiguously from offset 0;
+ * after a gap (sampling, restarting, -Y) hashing stops and no digests are reported.
+ */
+
+#ifndef IMAGE_HASHER_H
+#define IMAGE_HASHER_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "be20_api/sbuf.h"
+
+class image_hasher {
+    image_hasher(const image_hasher &that) = delete;
+    image_hasher &operator=(const image_hasher &that) = delete;
+
+public:
+    typedef std::vector<std::pair<std::string, std::string>> digests_t; // (DFXML type, hex digest)
+    static const size_t DEFAULT_DEPTH = 8;
+
+    /* algs is a comma-separated list of md5, sha1 and sha256. Throws std::invalid_argument. */
+    image_hasher(const std::string &algs, size_t depth = DEFAULT_DEPTH);
+    ~image_hasher();
+
+    void      update(const sbuf_t &sbuf); // hash the page part of sbuf; blocks only if depth pages are queued
+    void      update_zeros(uint64_t offset, size_t len); // hash len zero bytes at offset, e.g. for a hole that was not read
+    digests_t digests();                  // wait for the queue to drain and return the digests; empty after a gap
+    bool      gap() const { return had_gap; }
+
+private:
+    struct page_t {
+        std::vector<uint8_t> buf {};
+        size_t  hashers_left {0};       // algorithms that have not hashed it yet
+    };
+    struct alg_t {
+        std::string type;               // as written in <hashdigest type=...>
+        std::function<void(const uint8_t *, size_t)> update;
+        std::function<std::string()> hexdigest;
+        std::deque<std::shared_ptr<page_t>> queue {}; // pages this algorithm has yet to hash
+        std::thread *worker {nullptr};
+    };
+    std::vector<alg_t> algs {};
+    template <typename GENERATOR> void add_alg(const std::string &type);
+
+    const size_t            depth;
+    uint64_t                next_offset {0};    // where the next page must start
+    bool                    had_gap {false};
+    bool                    finished {false};
+
+    std::mutex              M {};
+    std::condition_variable cv_work {};
+    std::condition_variable cv_free {};
+    std::vector<std::vector<uint8_t>> spare {}; // buffers to reuse
+    size_t                  busy {0};           // pages queued or being hashed
+    void run(alg_t &alg);
+    bool enqueue(uint64_t offset, size_t len, const std::function<void(std::vector<uint8_t> &)> &fill);
+};
+
+#endif
@@ -3,8 +3,9 @@
  *
  * Implements:
  *   - process_ewf (if libewf is installed)
- *   - process_raw (using std::iostream's 64-bit support.
+ *   - process_raw (using pread(2) on each segment)
  *   - process_dir (for scanning files in a directory
+ *   - process_stream (for reading a pipe or stdin once)
  */
 
 #include "config.h"
@@ -25,14 +26,22 @@
 #include <sys/fcntl.h>
 #endif
 
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
 #ifndef PATH_MAX
 #define PATH_MAX 65536
 #endif
 
 #include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <ctime>
 #include <stdexcept>
 #include <functional>
 #include <locale>
+#include <new>
 #include <string>
 #include <vector>
 
@@ -52,15 +61,80 @@ image_process::image_process(std::filesystem::path fn, size_t pagesize_, size_t
 }
 
 image_process::~image_process()
+{
+    delete buffer_pool;
+}
+
+aligned_buffer_pool::aligned_buffer_pool(size_t align_, size_t bufsize_):
+    align(align_), bufsize((bufsize_ + align_ - 1) / align_ * align_)
 {
 }
 
+aligned_buffer_pool::~aligned_buffer_pool()
+{
+    for (auto &buf : free_bufs) {
+        ::operator delete(buf, std::align_val_t(align));
+    }
+}
+
+uint8_t *aligned_buffer_pool::get()
+{
+    {
+        const std::lock_guard<std::mutex> lock(M);
+        if (!free_bufs.empty()) {
+            uint8_t *buf = free_bufs.back();
+            free_bufs.pop_back();
+            return buf;
+        }
+    }
+    return static_cast<uint8_t *>(::operator new(bufsize, std::align_val_t(align)));
+}
+
+void aligned_buffer_pool::put(uint8_t *buf)
+{
+    const std::lock_guard<std::mutex> lock(M);
+    free_bufs.push_back(buf);
+}
+
 
 std::filesystem::path image_process::image_fname() const
 {
     return image_fname_;
 }
 
+/**
+ * Read a page plus its margin. Pages overlap by the margin, so when the iterator advances
+ * sequentially the first margin bytes of this page are the last margin bytes of the previous
+ * read. Rather than reading (and, for EWF, decompressing) them a second time, they are copied
+ * from the iterator's margin cache and only the new bytes are read from the image.
+ * After a seek (sampling, -Y, restart) the cache offset does not match and we do a full read.
+ */
+ssize_t image_process::pread_page(image_process::iterator &it, uint8_t *buf, size_t count) const
+{
+    size_t reused = 0;
+    if (sequential_read && it.margin_buf.size() > 0 && it.margin_offset == it.raw_offset) {
+        reused = std::min(it.margin_buf.size(), count);
+        memcpy(buf, it.margin_buf.data(), reused);
+    }
+    ssize_t count_read = 0;
+    if (count > reused) {
+        count_read = this->pread(buf + reused, count - reused, it.raw_offset + reused);
+        if (count_read < 0) {
+            it.margin_buf.clear();
+            return count_read;
+        }
+    }
+    size_t total = reused + count_read;
+
+    /* Save the tail for the next page, which starts pagesize bytes after this one. */
+    it.margin_buf.clear();
+    if (sequential_read && total > pagesize) {
+        it.margin_buf.assign(buf + pagesize, buf + total);
+        it.margin_offset = it.raw_offset + pagesize;
+    }
+    return total;
+}
+
 
 
 bool image_process::fn_ends_with(std::filesystem::path path, std::string suffix)
@@ -129,24 +203,34 @@ std::string image_process::make_list_template(std::filesystem::path path_,int *s
 
 process_ewf::~process_ewf()
 {
-#ifdef HAVE_LIBEWF_HANDLE_CLOSE
-    if (handle){
-	libewf_handle_close(handle,NULL);
-	libewf_handle_free(&handle,NULL);
+    /* handle is one of spare_handles once reading is done */
+    for (auto &h : spare_handles) {
+        if (h != handle) close_handle(h);
     }
+    spare_handles.clear();
+    if (handle) close_handle(handle);
+    handle = nullptr;
+}
+
+void process_ewf::close_handle(libewf_handle_t *h) const
+{
+#ifdef HAVE_LIBEWF_HANDLE_CLOSE
+    libewf_handle_close(h,NULL);
+    libewf_handle_free(&h,NULL);
 #else
-    if (handle){
-	libewf_close(handle);
-    }
+    libewf_close(h);
 #endif
 }
 
-
-int process_ewf::open()
+/**
+ * Open a new handle on all of the segment files of the image.
+ */
+libewf_handle_t *process_ewf::open_handle(bool verbose) const
 {
     std::filesystem::path fname = image_fname();
     LIBEWF_CHAR **libewf_filenames = NULL;
     int amount_of_filenames = 0;
+    libewf_handle_t *h = nullptr;
 
 #ifdef HAVE_LIBEWF_HANDLE_CLOSE
     libewf_error_t *error=0;
@@ -157,15 +241,17 @@ int process_ewf::open()
         libewf_error_free(&error);
         throw std::invalid_argument("libewf_glob");
     }
-    for(int i=0;i<amount_of_filenames;i++){
-        std::cout << "opening " << libewf_filenames[i] << std::endl;
+    if (verbose) {
+        for(int i=0;i<amount_of_filenames;i++){
+            std::cout << "opening " << libewf_filenames[i] << std::endl;
+        }
     }
 
-    if (libewf_handle_initialize( &handle, nullptr) <0 ){
+    if (libewf_handle_initialize( &h, nullptr) <0 ){
 	throw image_process::NoSuchFile("Cannot initialize EWF handle?");
     }
 
-    if (LIBEWF_HANDLE_OPEN( handle, libewf_filenames, amount_of_filenames,
+    if (LIBEWF_HANDLE_OPEN( h, libewf_filenames, amount_of_filenames,
                            LIBEWF_OPEN_READ,&error) <0 ){
 	if (error) libewf_error_fprint(error, stderr);
         fflush(stderr);
@@ -177,24 +263,56 @@ int process_ewf::open()
         if (error) libewf_error_fprint(error,stdout);
         throw image_process::NoSuchFile("libewf_glob_free");
     }
-    libewf_handle_get_media_size(handle,static_cast<size64_t *>(&ewf_filesize), NULL);
 #else
     amount_of_filenames = libewf_glob(fname,strlen(fname),LIBEWF_FORMAT_UNKNOWN,&libewf_filenames);
     if (amount_of_filenames<0){
 	err(1,"libewf_glob");
     }
-    handle = LIBEWF_OPEN( libewf_filenames, amount_of_filenames, LIBEWF_OPEN_READ);
-    if (handle==0){
+    h = LIBEWF_OPEN( libewf_filenames, amount_of_filenames, LIBEWF_OPEN_READ);
+    if (h==0){
 	fprintf(stderr,"amount_of_filenames:%d\n",amount_of_filenames);
 	for(int i=0;i<amount_of_filenames;i++){
 	    fprintf(stderr,"  %s\n",libewf_filenames[i]);
 	}
 	throw image_process::NoSuchFile("libewf_open");
     }
+#endif
+    handles_open++;
+    return h;
+}
+
+/* Take a handle that no other thread is using */
+libewf_handle_t *process_ewf::get_handle() const
+{
+    {
+        const std::lock_guard<std::mutex> lock(Mhandles);
+        if (!spare_handles.empty()) {
+            libewf_handle_t *h = spare_handles.back();
+            spare_handles.pop_back();
+            return h;
+        }
+    }
+    return open_handle(false);
+}
+
+void process_ewf::put_handle(libewf_handle_t *h) const
+{
+    const std::lock_guard<std::mutex> lock(Mhandles);
+    spare_handles.push_back(h);
+}
+
+int process_ewf::open()
+{
+    handle = open_handle(true);
+    spare_handles.push_back(handle);
+#ifdef HAVE_LIBEWF_HANDLE_CLOSE
+    libewf_handle_get_media_size(handle,static_cast<size64_t *>(&ewf_filesize), NULL);
+#else
     libewf_get_media_size(handle,(size64_t *)&ewf_filesize);
 #endif
 
 #ifdef HAVE_LIBEWF_HANDLE_GET_UTF8_HEADER_VALUE_NOTES
+    libewf_error_t *error=0;
     uint8_t ewfbuf[65536];
     int status= libewf_handle_get_utf8_header_value_notes(handle, ewfbuf, sizeof(ewfbuf)-1, &error);
     if (status == 1 && strlen(ewfbuf)>0){
@@ -231,27 +349,68 @@ std::vector<std::string> process_ewf::getewfdetails() const
 }
 
 
+/* CPU time used by the calling thread, in nanoseconds; 0 if the platform cannot tell us */
+static uint64_t thread_cpu_ns()
+{
+#if defined(CLOCK_THREAD_CPUTIME_ID)
+    struct timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts)==0) {
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+    }
+#endif
+    return 0;
+}
+
+/* Each handle is used by one thread at a time, so reads on different threads
+ * inflate their chunks in parallel.
+ */
+bool process_ewf::pread_is_threadsafe() const
+{
+#ifdef HAVE_LIBEWF_HANDLE_CLOSE
+    return true;
+#else
+    return false;
+#endif
+}
+
 ssize_t process_ewf::pread(void *buf,size_t bytes,uint64_t offset) const
 {
+    auto     wall0 = std::chrono::steady_clock::now();
+    uint64_t cpu0  = thread_cpu_ns();
 #ifdef HAVE_LIBEWF_HANDLE_CLOSE
+    libewf_handle_t *h = get_handle();
     libewf_error_t *error=0;
 #if defined(HAVE_LIBEWF_HANDLE_READ_RANDOM)
-    int ret = libewf_handle_read_random(handle,buf,bytes,offset,&error);
+    int ret = libewf_handle_read_random(h,buf,bytes,offset,&error);
 #endif
 #if defined(HAVE_LIBEWF_HANDLE_READ_BUFFER_AT_OFFSET) && !defined(HAVE_LIBEWF_HANDLE_READ_RANDOM)
-    int ret = libewf_handle_read_buffer_at_offset(handle,buf,bytes,offset,&error);
+    int ret = libewf_handle_read_buffer_at_offset(h,buf,bytes,offset,&error);
 #endif
+    put_handle(h);
     if (ret<0){
 	if (report_read_errors) libewf_error_fprint(error,stderr);
 	libewf_error_free(&error);
     }
-    return ret;
 #else
     if ((int64_t)bytes+offset > (int64_t)ewf_filesize) {
 	bytes = ewf_filesize - offset;
     }
-    return libewf_read_random(handle,buf,bytes,offset);
+    ssize_t ret = libewf_read_random(handle,buf,bytes,offset);
 #endif
+    uint64_t cpu  = thread_cpu_ns() - cpu0;
+    uint64_t wall = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - wall0).count();
+    inflate_ns += cpu;
+    read_ns    += wall > cpu ? wall - cpu : 0;
+    return ret;
+}
+
+image_process::io_stats_t process_ewf::io_stats() const
+{
+    return {
+        {"ewf_handles",         std::to_string(handles_open)},
+        {"ewf_read_seconds",    std::to_string(read_ns / 1.0e9)},
+        {"ewf_inflate_seconds", std::to_string(inflate_ns / 1.0e9)},
+    };
 }
 
 int64_t process_ewf::image_size() const
@@ -297,7 +456,7 @@ sbuf_t *process_ewf::sbuf_alloc(image_process::iterator &it) const
 
     auto sbuf = sbuf_t::sbuf_malloc(get_pos0(it), count, this_pagesize);
     unsigned char *buf = static_cast<unsigned char *>(sbuf->malloc_buf());
-    int count_read = this->pread(buf, count, it.raw_offset);
+    ssize_t count_read = this->pread_page(it, buf, count);
     if (count_read<0){
         delete sbuf;
 	throw read_error();
@@ -349,13 +508,37 @@ uint64_t process_ewf::seek_block(image_process::iterator &it,uint64_t block) con
  *** RAW
  ****************************************************************/
 
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+process_raw::file_info::file_info(const std::filesystem::path path_,uint64_t offset_,uint64_t length_):
+    path(path_),offset(offset_),length(length_)
+{
+    fd = ::open(path.string().c_str(), O_RDONLY|O_BINARY);
+    if (fd<0){
+        throw image_process::NoSuchFile( path_.string() );
+    }
+}
+
+process_raw::file_info::~file_info()
+{
+    if (fd>=0) ::close(fd);
+    if (direct_fd>=0) ::close(direct_fd);
+}
+
 process_raw::process_raw(std::filesystem::path fname, size_t pagesize_, size_t margin_)
-    :image_process(fname, pagesize_, margin_)
+    :image_process(fname, pagesize_, margin_), chunk_bytes(MMAP_CHUNK_PAGES * pagesize_)
 {
 }
 
 process_raw::~process_raw()
 {
+    {
+        const std::lock_guard<std::mutex> lock(Mmapped);
+        last_chunk = chunk_key_t(nullptr, 0);
+        reclaim_windows();
+    }
     file_list.clear();
 }
 
@@ -401,6 +584,43 @@ static size_t pread64(int d,void *buf,size_t nbyte,int64_t offset)
 }
 #endif
 
+/* Positional read that does not use the descriptor's file pointer. */
+static ssize_t raw_pread(int fd, void *buf, size_t nbyte, uint64_t offset)
+{
+#if defined(HAVE_PREAD)
+    return ::pread(fd, buf, nbyte, offset);
+#else
+    return pread64(fd, buf, nbyte, offset); // emulated with _lseeki64; not thread-safe
+#endif
+}
+
+/* Read exactly nbyte, or throw */
+static void raw_pread_fully(int fd, void *buf, size_t nbyte, uint64_t offset)
+{
+    size_t got = 0;
+    while (got < nbyte) {
+        ssize_t r = raw_pread(fd, static_cast<char *>(buf) + got, nbyte - got, offset + got);
+        if (r<0) {
+            std::cerr << "read error " << strerror(errno) << " bytes=" << nbyte << std::endl;
+            throw image_process::ReadError();
+        }
+        if (r==0) {
+            std::cerr << "read error  eof bytes=" << nbyte << std::endl;
+            throw image_process::EndOfImage();
+        }
+        got += r;
+    }
+}
+
+bool process_raw::pread_is_threadsafe() const
+{
+#if defined(HAVE_PREAD)
+    return true;
+#else
+    return false;
+#endif
+}
+
 int64_t process_raw::get_filesize(int fd)
 {
     char buf[64];
@@ -454,10 +674,6 @@ int64_t process_raw::get_filesize(int fd)
     return filesize;
 }
 
-#ifndef O_BINARY
-#define O_BINARY 0
-#endif
-
 /**
  * Add the file to the list, keeping track of the total size
  * https://docs.microsoft.com/en-us/windows/win32/devio/calling-deviceiocontrol
@@ -493,22 +709,41 @@ void process_raw::add_file(std::filesystem::path path)
 #ifdef _DEBUG_
     std::cerr << path.string() << " filesize: " << path_filesize << "\n";
 #endif
+    /* The segment that was last is now followed by this one. Split images are usually cut
+     * into equal segments, in which case find_index() can compute the segment directly.
+     */
+    if (file_list.size()==1) {
+        segment_stride = file_list.back()->length;
+        uniform_segments = segment_stride > 0;
+    } else if (file_list.size()>1 && file_list.back()->length != segment_stride) {
+        uniform_segments = false;
+    }
     file_list.push_back( std::shared_ptr<process_raw::file_info>(new file_info(path, raw_filesize, path_filesize)));
     raw_filesize += path_filesize;
 }
 
 /*
- * This currently performs a linear search through the file list. It is not efficient, but it is reliable.
- * We could use a clever data structure, but then we would need to debug it.
+ * Find the segment that holds pos. Segments are sorted by offset and are contiguous, so this is
+ * a division when all of the segments (but the last) have the same length, and a binary search otherwise.
+ * Empty segments are never returned.
  */
-const std::shared_ptr<process_raw::file_info> process_raw::find_offset(uint64_t pos) const
+size_t process_raw::find_index(uint64_t pos) const
 {
-    for (const auto &it:file_list) {
-	if (it->offset<=pos && pos<it->offset + it->length) {
-	    return it;
-	}
+    if (pos >= raw_filesize) return file_list.size();
+    if (uniform_segments && segment_stride>0) {
+        return std::min(static_cast<size_t>(pos / segment_stride), file_list.size()-1);
     }
-    return 0;
+    /* first segment that starts after pos; the one before it holds pos */
+    auto after = std::upper_bound(file_list.begin(), file_list.end(), pos,
+                                  [](uint64_t p, const std::shared_ptr<file_info> &fi) { return p < fi->offset; });
+    return (after - file_list.begin()) - 1;
+}
+
+const std::shared_ptr<process_raw::file_info> process_raw::find_offset(uint64_t pos) const
+{
+    size_t i = find_index(pos);
+    if (i >= file_list.size()) return 0;
+    return file_list[i];
 }
 
 /**
@@ -546,72 +781,98 @@ int64_t process_raw::image_size() const
 
 /**
  * Read randomly between a split file.
- * 1. Determine which file to read and how many bytes from that file can be read.
- * 2. Perform the read.
- * 3. If there are additional files to read in the next file, recurse.
- * NOTE: This code is single-threaded because we are seeking the fstreams.
+ * The segment holding offset is looked up once; a read that runs past the end of
+ * a segment continues at the start of the next one, until bytes are read or the image ends.
+ * Uses pread(2) on each segment's descriptor, so it is thread-safe.
  */
 
 ssize_t process_raw::pread(void *buf, size_t bytes, uint64_t offset) const
 {
-    std::shared_ptr<file_info> fi = find_offset(offset);
-    if (fi==0) return 0;			// nothing to read.
-
-    // make sure that the offset falls within the selection.
-    assert(offset >= fi->offset);
-    assert(offset <  fi->offset + fi->length);
-
-    // Determine the offset and available bytes in the segment
-    uint64_t file_offset     = offset - fi->offset;
-    uint64_t available_bytes = fi->length - file_offset;
-
-    size_t bytes_to_read = bytes;
-    if (bytes_to_read > available_bytes) {
-        bytes_to_read = available_bytes;
-    }
+    size_t total = 0;
+    for (size_t i = find_index(offset); total < bytes && i < file_list.size(); i++) {
+        const file_info &fi = *file_list[i];
+        uint64_t pos = offset + total;
+
+        // make sure that the offset falls within the selection.
+        assert(pos >= fi.offset);
+
+        // Determine the offset and available bytes in the segment
+        uint64_t file_offset     = pos - fi.offset;
+        uint64_t available_bytes = fi.length - file_offset;
+        size_t   bytes_to_read   = std::min(static_cast<uint64_t>(bytes - total), available_bytes);
 #ifdef _DEBUG_
-    std::cerr << fi->path
-              << " pread bytes=" << bytes
-              << " offset=" << offset
-              << " file_offset=" << file_offset
-              << " available_bytes=" << available_bytes
-              << " bytes_to_read=" << bytes_to_read << std::endl;
+        std::cerr << fi.path
+                  << " pread bytes=" << bytes
+                  << " offset=" << pos
+                  << " file_offset=" << file_offset
+                  << " available_bytes=" << available_bytes
+                  << " bytes_to_read=" << bytes_to_read << std::endl;
 #endif
 
-
-    fi->stream.seekg( file_offset );
-    if (fi->stream.rdstate() & (std::ios::failbit|std::ios::badbit)){
-        throw SeekError();
+        /* Positional reads do not move a shared file pointer, so several threads may read at once */
+        if (use_direct_io) {
+            direct_pread(fi, static_cast<uint8_t *>(buf) + total, bytes_to_read, file_offset);
+        } else {
+            raw_pread_fully(fi.fd, static_cast<char *>(buf) + total, bytes_to_read, file_offset);
+        }
+        total += bytes_to_read;
     }
+    return total;
+}
 
-    aftimer t;
-    t.start();
-    fi->stream.read(reinterpret_cast<char *>(buf), bytes_to_read);
-    t.stop();
 
-    if (fi->stream.rdstate() & std::ios::failbit){
-        std::cerr << "read error  failbit bytes=" << bytes << std::endl;
-        throw ReadError();
-    }
-    if (fi->stream.rdstate() & std::ios::badbit){
-        std::cerr << "read error  badbit bytes=" << bytes << std::endl;
-        throw ReadError();
-    }
-    if (fi->stream.rdstate() & (std::ios::eofbit)){
-        std::cerr << "read error  eof bytes=" << bytes << std::endl;
-        throw EndOfImage();
+/**
+ * Map a byte range of the image onto the segment files, for readers that issue their own I/O.
+ * Extents are clipped at the end of the image.
+ */
+bool process_raw::get_extents(uint64_t offset, size_t bytes, std::vector<extent_t> &extents) const
+{
+    extents.clear();
+    if (use_mmap) return false;         // pages are mapped, not read
+    if (use_direct_io) return false;    // reads must go through direct_pread() to be aligned
+    for (size_t i = find_index(offset); bytes > 0 && i < file_list.size(); i++) {
+        const file_info &fi = *file_list[i];
+        if (fi.length == 0) continue;
+        extent_t ext;
+        ext.fd     = fi.fd;
+        ext.offset = offset - fi.offset;
+        ext.len    = std::min(static_cast<uint64_t>(bytes), fi.length - ext.offset);
+        extents.push_back(ext);
+        offset += ext.len;
+        bytes  -= ext.len;
     }
-
-    size_t bytes_read = bytes_to_read;  // guess we got the right amount
-
-    /* Need to recurse, which will cause the next segment to be loaded */
-    if (bytes_read==bytes) return bytes_read; // read precisely the correct amount!
-    if (bytes_read==0) return 0;              // This might happen at the end of the image; it prevents infinite recursion
-    ssize_t bytes_read2 = this->pread(static_cast<char *>(buf)+bytes_read, bytes-bytes_read, offset+bytes_read);
-    if (bytes_read2<0) return -1;	// error on second read
-    return bytes_read + bytes_read2;
+    return true;
 }
 
+/**
+ * Sparse files: ask each segment with SEEK_DATA where its next data is. If that is past the range
+ * (or there is no more data, ENXIO) the range is a hole. Filesystems without hole support report
+ * everything as data, and devices may refuse SEEK_DATA; both are simply read.
+ * Only the descriptor's file position moves, which pread() does not use.
+ */
+bool process_raw::is_hole(uint64_t offset, size_t bytes) const
+{
+#if defined(SEEK_DATA)
+    if (bytes==0) return false;
+    for (size_t i = find_index(offset); bytes > 0 && i < file_list.size(); i++) {
+        const file_info &fi = *file_list[i];
+        if (fi.length == 0) continue;
+        uint64_t file_offset = offset - fi.offset;
+        uint64_t len         = std::min(static_cast<uint64_t>(bytes), fi.length - file_offset);
+        off_t data = ::lseek(fi.fd, file_offset, SEEK_DATA);
+        if (data < 0) {
+            if (errno != ENXIO) return false;
+        } else if (static_cast<uint64_t>(data) < file_offset + len) {
+            return false;
+        }
+        offset += len;
+        bytes  -= len;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
 
 image_process::iterator process_raw::begin() const
 {
@@ -657,8 +918,217 @@ pos0_t process_raw::get_pos0(const image_process::iterator &it) const
     return pos0_t("",it.raw_offset);
 }
 
+void process_raw::set_mmap(bool val)
+{
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H)
+    use_mmap = val;
+#endif
+}
+
+/**
+ * Open a second descriptor on each segment that bypasses the page cache: O_DIRECT where it exists,
+ * F_NOCACHE on macOS. If a segment cannot be opened that way (e.g. tmpfs does not support O_DIRECT)
+ * the image is read through the page cache as before.
+ */
+void process_raw::set_direct_io(bool val)
+{
+    for (auto &fi : file_list) {
+        if (fi->direct_fd>=0) {
+            ::close(fi->direct_fd);
+            fi->direct_fd = -1;
+        }
+    }
+    use_direct_io = false;
+    if (!val) return;
+#if defined(O_DIRECT) || defined(F_NOCACHE)
+    for (auto &fi : file_list) {
+#if defined(O_DIRECT)
+        fi->direct_fd = ::open(fi->path.string().c_str(), O_RDONLY|O_BINARY|O_DIRECT);
+#else
+        fi->direct_fd = ::open(fi->path.string().c_str(), O_RDONLY|O_BINARY);
+        if (fi->direct_fd>=0 && fcntl(fi->direct_fd, F_NOCACHE, 1)<0) {
+            ::close(fi->direct_fd);
+            fi->direct_fd = -1;
+        }
+#endif
+        if (fi->direct_fd<0) {
+            std::cerr << "direct I/O not available for " << fi->path.string() << ": " << strerror(errno)
+                      << "; reading through the page cache" << std::endl;
+            set_direct_io(false);
+            return;
+        }
+    }
+    if (buffer_pool==nullptr) {
+        /* room for a page and its margin, widened to whole blocks at both ends */
+        buffer_pool = new aligned_buffer_pool(DIRECT_IO_ALIGN, pagesize + margin + 2 * DIRECT_IO_ALIGN);
+    }
+    use_direct_io = true;
+#else
+    std::cerr << "direct I/O is not supported on this platform; reading through the page cache" << std::endl;
+#endif
+}
+
+/* The direct I/O buffers hold a page and its margin, so they are replaced when the page size changes,
+ * and the chunks mapped from then on hold MMAP_CHUNK_PAGES pages of the new size.
+ */
+void process_raw::set_pagesize(size_t val)
+{
+    image_process::set_pagesize(val);
+    {
+        const std::lock_guard<std::mutex> lock(Mmapped);
+        chunk_bytes = MMAP_CHUNK_PAGES * pagesize;
+    }
+    if (buffer_pool) {
+        delete buffer_pool;
+        buffer_pool = new aligned_buffer_pool(DIRECT_IO_ALIGN, pagesize + margin + 2 * DIRECT_IO_ALIGN);
+    }
+}
+
+std::string process_raw::io_mode() const
+{
+    if (use_mmap) return "mmap";
+    if (use_direct_io) return "direct";
+    return "buffered";
+}
+
+/**
+ * Read count bytes at file_offset of a segment with direct I/O.
+ * O_DIRECT needs the file offset, the length and the buffer to be aligned, so each read is widened
+ * to whole blocks, made into a buffer from buffer_pool, and the requested bytes are copied out.
+ * The part of the segment past its last whole block, and anything the kernel refuses to read
+ * directly, is read through the page cache.
+ */
+void process_raw::direct_pread(const file_info &fi, uint8_t *buf, size_t count, uint64_t file_offset) const
+{
+    const uint64_t align = DIRECT_IO_ALIGN;
+    const uint64_t direct_end = fi.length / align * align; // end of the last whole block
+    uint8_t *abuf = buffer_pool->get();
+    while (count > 0 && file_offset < direct_end) {
+        uint64_t start = file_offset / align * align;
+        uint64_t end   = std::min(file_offset + count, direct_end);
+        end = std::min((end + align - 1) / align * align, start + buffer_pool->bufsize);
+        ssize_t r = raw_pread(fi.direct_fd, abuf, end - start, start);
+        if (r <= static_cast<ssize_t>(file_offset - start)) {
+            break;                      // EINVAL, EOF or an error; let the buffered read sort it out
+        }
+        size_t n = std::min(static_cast<uint64_t>(count), start + r - file_offset);
+        memcpy(buf, abuf + (file_offset - start), n);
+        buf         += n;
+        count       -= n;
+        file_offset += n;
+    }
+    buffer_pool->put(abuf);
+    if (count > 0) {
+        raw_pread_fully(fi.fd, buf, count, file_offset);
+    }
+}
+
+/**
+ * Free the windows whose page sbufs have been deleted, dropping their pages from our mapping,
+ * and unmap chunks that no longer have windows. The most recent chunk stays mapped
+ * because the next page probably falls in it. The page cache is left alone: the margin of
+ * a page is the start of the next, and other readers of the image may want it.
+ */
+void process_raw::reclaim_windows() const
+{
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H)
+    for (auto w = windows.begin(); w != windows.end(); ) {
+        if (w->sbuf->children > 0) {
+            ++w;
+            continue;
+        }
+        delete w->sbuf;
+        auto &chunk = chunks.at(chunk_key_t(w->fi.get(), w->chunk));
+        uint64_t start = w->file_offset - chunk.file_offset;
+#ifdef MADV_DONTNEED
+        /* only the page itself; its margin is the start of the next page */
+        size_t align = sysconf(_SC_PAGESIZE);
+        uint64_t astart = start - (start % align);
+        madvise(chunk.base + astart, std::min(chunk.len - astart, w->pagesize + start - astart), MADV_DONTNEED);
+#endif
+        chunk.live -= 1;
+        w = windows.erase(w);
+    }
+    for (auto c = chunks.begin(); c != chunks.end(); ) {
+        if (c->second.live == 0 && c->first != last_chunk) {
+            munmap(c->second.base, c->second.len);
+            c = chunks.erase(c);
+        } else {
+            ++c;
+        }
+    }
+#endif
+}
+
+/**
+ * Make a page sbuf that points into a mapping of the segment rather than a copy of it.
+ * Returns nullptr if the page cannot be mapped (it spans two segments, or mmap failed),
+ * in which case the caller reads it.
+ */
+void process_raw::reclaim() const
+{
+    const std::lock_guard<std::mutex> lock(Mmapped);
+    reclaim_windows();
+}
+
+sbuf_t *process_raw::sbuf_alloc_mapped(const image_process::iterator &it, size_t count, size_t this_pagesize) const
+{
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H)
+    std::shared_ptr<file_info> fi = find_offset(it.raw_offset);
+    if (fi==0) return nullptr;
+    uint64_t file_offset = it.raw_offset - fi->offset;
+    if (file_offset + count > fi->length) return nullptr; // spans segments
+
+    const std::lock_guard<std::mutex> lock(Mmapped);
+    reclaim_windows();
+
+    /* Each chunk maps MMAP_CHUNK_PAGES pages, plus room for the last page and its margin.
+     * A chunk mapped before the page size grew may be too short; remap it if no page uses it.
+     */
+    const uint64_t chunk_start = file_offset - file_offset % chunk_bytes;
+    chunk_key_t key(fi.get(), chunk_start);
+    auto c = chunks.find(key);
+    if (c != chunks.end() && c->second.live == 0 && file_offset + count > c->second.file_offset + c->second.len) {
+        munmap(c->second.base, c->second.len);
+        chunks.erase(c);
+        c = chunks.end();
+    }
+    if (c == chunks.end()) {
+        mapped_chunk_t chunk;
+        size_t align = sysconf(_SC_PAGESIZE);
+        chunk.file_offset = chunk_start;
+        chunk.file_offset -= chunk.file_offset % align;
+        chunk.len = std::min(fi->length, chunk_start + chunk_bytes + pagesize + margin) - chunk.file_offset;
+        void *base = mmap(nullptr, chunk.len, PROT_READ, MAP_SHARED, fi->fd, chunk.file_offset);
+        if (base == MAP_FAILED) return nullptr;
+#ifdef MADV_SEQUENTIAL
+        madvise(base, chunk.len, MADV_SEQUENTIAL);
+#endif
+        chunk.base = static_cast<uint8_t *>(base);
+        c = chunks.insert(std::make_pair(key, chunk)).first;
+    }
+    if (file_offset + count > c->second.file_offset + c->second.len) {
+        return nullptr;                 // the chunk was mapped for a smaller page size, and is in use
+    }
+    last_chunk = key;
+
+    window_t w;
+    w.fi = fi;
+    w.chunk = chunk_start;
+    w.file_offset = file_offset;
+    w.pagesize = this_pagesize;
+    w.sbuf = sbuf_t::sbuf_new(get_pos0(it), c->second.base + (file_offset - c->second.file_offset), count, this_pagesize);
+    sbuf_t *page = new sbuf_t(*w.sbuf, 0, count); // a child, so deleting it is visible in w.sbuf->children
+    c->second.live += 1;
+    windows.push_back(w);
+    return page;
+#else
+    return nullptr;
+#endif
+}
+
 /** Read from the iterator into a newly allocated sbuf.
- * uses pagesize. We don't memory map the file. Perhaps we should. But then we could only do 4K pages.
+ * uses pagesize. With set_mmap(true) the page is mapped rather than read, if it lies within one segment.
  */
 sbuf_t *process_raw::sbuf_alloc(image_process::iterator &it) const
 {
@@ -672,9 +1142,14 @@ sbuf_t *process_raw::sbuf_alloc(image_process::iterator &it) const
         this_pagesize = count;
     }
 
+    if (use_mmap && count > 0) {
+        sbuf_t *sbuf = sbuf_alloc_mapped(it, count, this_pagesize);
+        if (sbuf) return sbuf;
+    }
+
     sbuf_t *sbuf = sbuf_t::sbuf_malloc( get_pos0(it), count, this_pagesize);
     unsigned char *buf = reinterpret_cast<unsigned char *>(sbuf->malloc_buf());
-    int count_read = this->pread(buf, count, it.raw_offset);       // do the read
+    ssize_t count_read = this->pread_page(it, buf, count);       // do the read, reusing the cached margin
     if (count_read==0){
         delete sbuf;
 	it.eof = true;
@@ -703,6 +1178,199 @@ uint64_t process_raw::seek_block(image_process::iterator &it,uint64_t block) con
 }
 
 
+/****************************************************************
+ ** process_stream
+ **/
+
+process_stream::process_stream(std::filesystem::path fname, size_t pagesize_, size_t margin_)
+    :image_process(fname, pagesize_, margin_)
+{
+}
+
+process_stream::~process_stream()
+{
+    if (fd > 0) ::close(fd);            // not stdin
+}
+
+int process_stream::open()
+{
+    if (image_fname() == "-") {
+        fd = 0;
+#ifdef _WIN32
+        setmode(fd, O_BINARY);
+#endif
+        return 0;
+    }
+    fd = ::open(image_fname().string().c_str(), O_RDONLY|O_BINARY);
+    return fd < 0 ? -1 : 0;
+}
+
+/* Read until count bytes or the end of the stream; a pipe returns what it has */
+size_t process_stream::read_fully(uint8_t *buf, size_t count) const
+{
+    size_t got = 0;
+    while (got < count) {
+        ssize_t r = ::read(fd, buf + got, count - got);
+        if (r < 0 && errno == EINTR) continue;
+        if (r < 0) {
+            std::cerr << "read error " << strerror(errno) << " bytes=" << count << std::endl;
+            throw image_process::ReadError();
+        }
+        if (r == 0) {
+            at_eof = true;
+            break;
+        }
+        got += r;
+    }
+    next_offset += got;
+    return got;
+}
+
+void process_stream::drop(uint64_t from) const
+{
+    if (from < carry_offset) {
+        throw SeekError();              // those bytes are gone
+    }
+    if (from <= next_offset) {
+        carry.erase(carry.begin(), carry.begin() + (from - carry_offset));
+        carry_offset = from;
+        return;
+    }
+    carry.clear();
+    std::vector<uint8_t> discard(std::min(from - next_offset, static_cast<uint64_t>(1024 * 1024)));
+    while (next_offset < from && !at_eof) {
+        read_fully(discard.data(), std::min(from - next_offset, static_cast<uint64_t>(discard.size())));
+    }
+    carry_offset = next_offset;
+}
+
+void process_stream::fill(uint64_t from, uint64_t upto) const
+{
+    drop(from);
+    if (next_offset < upto && !at_eof) {
+        size_t old = carry.size();
+        carry.resize(old + (upto - next_offset));
+        carry.resize(old + read_fully(carry.data() + old, carry.size() - old));
+    }
+}
+
+ssize_t process_stream::pread(void *buf, size_t bytes, uint64_t offset) const
+{
+    const std::lock_guard<std::mutex> lock(M);
+    if (offset < carry_offset || offset + bytes > next_offset) {
+        throw SeekError();
+    }
+    memcpy(buf, carry.data() + (offset - carry_offset), bytes);
+    return bytes;
+}
+
+image_process::iterator process_stream::begin() const
+{
+    image_process::iterator it(this);
+    const std::lock_guard<std::mutex> lock(M);
+    fill(0, 1);
+    if (at_eof && next_offset == 0) {
+        it.eof = true;                  // an empty stream
+    }
+    return it;
+}
+
+image_process::iterator process_stream::end() const
+{
+    image_process::iterator it(this);
+    it.raw_offset = UINT64_MAX;         // only eof matters
+    it.eof = true;
+    return it;
+}
+
+/* Look at the next byte, so the loop ends at the end of the stream rather than failing to read a page */
+void process_stream::increment_iterator(image_process::iterator &it) const
+{
+    it.raw_offset += pagesize;
+    it.page_number += 1;
+    const std::lock_guard<std::mutex> lock(M);
+    fill(it.raw_offset, it.raw_offset + 1);
+    if (at_eof && it.raw_offset >= next_offset) {
+        it.eof = true;
+    }
+}
+
+pos0_t process_stream::get_pos0(const image_process::iterator &it) const
+{
+    return pos0_t("",it.raw_offset);
+}
+
+/* The kept bytes are copied to the start of the sbuf and the rest of the page is read into it */
+sbuf_t *process_stream::sbuf_alloc(image_process::iterator &it) const
+{
+    const std::lock_guard<std::mutex> lock(M);
+    drop(it.raw_offset);
+    const size_t want = pagesize + margin;
+    sbuf_t *sbuf = sbuf_t::sbuf_malloc(get_pos0(it), want, pagesize);
+    uint8_t *buf = reinterpret_cast<uint8_t *>(sbuf->malloc_buf());
+    size_t count = std::min(carry.size(), want);
+    memcpy(buf, carry.data(), count);
+    std::vector<uint8_t> after(carry.begin() + count, carry.end()); // read past this page's margin; normally empty
+    try {
+        if (count < want && !at_eof) {
+            count += read_fully(buf + count, want - count);
+        }
+    }
+    catch (...) {
+        delete sbuf;
+        throw;
+    }
+    if (count == 0) {
+        delete sbuf;
+        it.eof = true;
+        throw EndOfImage();
+    }
+    const size_t this_pagesize = std::min(pagesize, count);
+    carry.assign(buf + this_pagesize, buf + count);
+    carry.insert(carry.end(), after.begin(), after.end());
+    carry_offset = it.raw_offset + this_pagesize;
+    if (count < want) {
+        /* the end of the stream */
+        sbuf_t *last = sbuf_t::sbuf_malloc(get_pos0(it), count, this_pagesize);
+        memcpy(last->malloc_buf(), buf, count);
+        delete sbuf;
+        sbuf = last;
+    }
+    return sbuf;
+}
+
+double process_stream::fraction_done(const image_process::iterator &it) const
+{
+    return it.eof ? 1.0 : 0.0;          // the size is not known
+}
+
+std::string process_stream::str(const image_process::iterator &it) const
+{
+    char buf[64];
+    snprintf(buf,sizeof(buf),"Offset %" PRId64 "MB",it.raw_offset/1000000);
+    return std::string(buf);
+}
+
+int64_t process_stream::image_size() const
+{
+    const std::lock_guard<std::mutex> lock(M);
+    return next_offset;
+}
+
+uint64_t process_stream::max_blocks(const image_process::iterator &it) const
+{
+    return (image_size() + pagesize - 1) / pagesize;
+}
+
+/* Only forward; the pages before are read and thrown away when the next page is read */
+uint64_t process_stream::seek_block(image_process::iterator &it,uint64_t block) const
+{
+    it.raw_offset = block * pagesize;
+    it.page_number = block;
+    return block;
+}
+
+
 /****************************************************************
  ** process_dir
  **/
@@ -817,11 +1485,14 @@ image_process *image_process::open(std::filesystem::path fn, bool opt_recurse, s
     image_process *ip = 0;
     std::string fname_string = fn.string();
 
-    if ( std::filesystem::exists(fn) == false ){
+    /* stdin and pipes can only be read in order */
+    if (fname_string == "-" || std::filesystem::is_fifo(fn)) {
+        ip = new process_stream(fn, pagesize_, margin_);
+    }
+    else if ( std::filesystem::exists(fn) == false ){
 	throw NoSuchFile(fname_string);
     }
-
-    if (std::filesystem::is_directory(fn)){
+    else if (std::filesystem::is_directory(fn)){
 	/* If this is a directory, process specially */
 	if (opt_recurse==0){
 	    errno = 0;
@@ -13,6 +13,7 @@
  * process_ewf - process an EWF file
  * process_raw - process a RAW or splitraw file.
  * process_dir - recursively process a directory of files (but not E01  files)
+ * process_stream - read a pipe or stdin once, in order
  *
  * Conditional compilation assures that this compiles no matter which class libraries are installed.
  *
@@ -44,8 +45,14 @@
 #include "be20_api/sbuf.h"
 #include "be20_api/abstract_image_reader.h"
 
+#include <atomic>
 #include <filesystem>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
 
 #if defined(_WIN32)
 #  include <winsock2.h>
@@ -53,6 +60,23 @@
 #  include <windowsx.h>
 #endif
 
+/* A pool of aligned buffers of one size, for direct I/O. Buffers are reused rather than freed
+ * so that reading a large image does not churn the allocator. Thread-safe.
+ */
+class aligned_buffer_pool {
+    aligned_buffer_pool(const aligned_buffer_pool &)=delete;
+    aligned_buffer_pool &operator=(const aligned_buffer_pool &)=delete;
+    std::mutex M {};
+    std::vector<uint8_t *> free_bufs {};
+public:
+    aligned_buffer_pool(size_t align_, size_t bufsize_);
+    ~aligned_buffer_pool();
+    const size_t align;
+    const size_t bufsize;               // a multiple of align
+    uint8_t *get();                     // take a buffer, allocating one if none are free
+    void     put(uint8_t *buf);         // return a buffer taken with get()
+};
+
 class image_process : public abstract_image_reader {
     /******************************************************
      *** neither copying nor assignment is implemented. ***
@@ -109,9 +133,10 @@ public:
      * returns an object.
      */
     static image_process *open(std::filesystem::path fn, bool recurse, size_t opt_pagesize, size_t opt_margin);
-    const size_t pagesize;                    // page size we are using
+    size_t pagesize;                          // page size we are using; see set_pagesize()
     const size_t margin;                      // margin size we are using
     bool  report_read_errors;
+    bool  sequential_read {true};             // reuse the previous page's margin rather than re-reading it
 
     class read_error: public std::exception {
 	virtual const char *what() const throw() {
@@ -131,6 +156,11 @@ public:
 	uint64_t page_number {};
 	size_t   file_number {};
 	bool     eof {};
+        /* Sequential-read mode: the bytes past the end of the last page read, which are the first
+         * bytes of the next page. They are only used if the iterator is still at margin_offset.
+         */
+        uint64_t margin_offset {};
+        std::vector<uint8_t> margin_buf {};
 	iterator(const class image_process *myimage_):myimage(*myimage_) { }
 	bool operator !=(const iterator &it) const {
 	    if (this->eof && it.eof) return false; /* both in EOF states, so they are equal */
@@ -149,6 +179,20 @@ public:
 	uint64_t max_blocks() const { return myimage.max_blocks(*this);}
 	uint64_t seek_block(uint64_t block) { return myimage.seek_block(*this,block);} // returns block number
         void set_raw_offset(uint64_t anOffset){ raw_offset=anOffset;}
+        /* move to the position of another iterator on the same image, keeping our margin cache */
+        void set_position(const iterator &it) {
+            raw_offset  = it.raw_offset;
+            page_number = it.page_number;
+            file_number = it.file_number;
+            eof         = it.eof;
+        }
+    };
+
+    /* Where a byte range of the image lives on disk, for readers that bypass pread() (e.g. io_uring). */
+    struct extent_t {
+        int      fd {-1};
+        uint64_t offset {};             // offset within fd
+        size_t   len {};
     };
 
     image_process(std::filesystem::path fn, size_t pagesize_, size_t margin_);
@@ -174,6 +218,36 @@ public:
     // seek_block modifies the iterator, but not the image!
     virtual uint64_t seek_block(class image_process::iterator &it,uint64_t block) const = 0; // returns -1 if failure
     virtual void set_report_read_errors(bool val){report_read_errors=val;}
+    /* Returns true if pread() may be called from several threads at once */
+    virtual bool pread_is_threadsafe() const { return false; }
+    /* Returns true if [offset,offset+bytes) is known to be a hole (reads as zeros without being stored) */
+    virtual bool is_hole(uint64_t offset, size_t bytes) const { return false; }
+    /* Map [offset,offset+bytes) to file extents. Returns false if the image is not a set of plain files. */
+    virtual bool get_extents(uint64_t offset, size_t bytes, std::vector<extent_t> &extents) const { return false; }
+    virtual void set_sequential_read(bool val){sequential_read=val;}
+    virtual void set_mmap(bool val){}       // map pages rather than reading them, if the image supports it
+    virtual void set_direct_io(bool val){}  // read around the page cache, if the image supports it
+    virtual std::string io_mode() const { return "buffered"; } // how the image is read, for the report
+    /* Change the page size for the pages still to be read. Only call it when no reads are in flight,
+     * and the next page starts at a multiple of the new size.
+     */
+    virtual void set_pagesize(size_t val){pagesize=val;}
+    /* Returns true if every page starts at a multiple of its size, which is pagesize unless set_pagesize()
+     * changed it, and is as long (but for the last); so a page is known by its offset.
+     */
+    virtual bool fixed_pages() const { return true; }
+    /* Returns false if the image can only be read once, in order, and its size is not known until the end */
+    virtual bool seekable() const { return true; }
+    typedef std::vector<std::pair<std::string, std::string>> io_stats_t;
+    virtual io_stats_t io_stats() const { return {}; } // name/value pairs for the report, once reading is done
+    virtual void reclaim() const {}      // free what the deleted page sbufs held; called while waiting for the workers
+
+protected:
+    aligned_buffer_pool *buffer_pool {nullptr}; // for direct I/O; created by subclasses that use it
+    /* Read count bytes of the page at the iterator into buf, using (and then refilling)
+     * the iterator's margin cache when sequential_read is set.
+     */
+    ssize_t pread_page(class image_process::iterator &it, uint8_t *buf, size_t count) const;
 };
 
 inline image_process::iterator & operator++(image_process::iterator &it){
@@ -207,12 +281,30 @@ class process_ewf : public image_process {
     std::vector<std::string> details {};
     mutable libewf_handle_t *handle { nullptr };
 
+    /* A libewf handle caches the chunk it last inflated, so it cannot be shared between threads.
+     * With the handle API each concurrent pread() takes a handle of its own from spare_handles,
+     * opening another when none is free, so read-ahead threads inflate chunks in parallel.
+     */
+    mutable std::mutex Mhandles {};
+    mutable std::vector<libewf_handle_t *> spare_handles {};
+    mutable std::atomic<u_int> handles_open {0};
+    libewf_handle_t *open_handle(bool verbose) const;
+    libewf_handle_t *get_handle() const;
+    void            put_handle(libewf_handle_t *h) const;
+    void            close_handle(libewf_handle_t *h) const;
+
+    /* time spent in libewf reads, split into thread CPU time (mostly inflating chunks) and the rest (waiting for I/O) */
+    mutable std::atomic<uint64_t> read_ns {0};
+    mutable std::atomic<uint64_t> inflate_ns {0};
+
  public:
     process_ewf(std::filesystem::path fname, size_t pagesize_, size_t margin_) : image_process(fname, pagesize_, margin_) {}
     virtual ~process_ewf();
     std::vector<std::string> getewfdetails() const;
     int open() override;
     virtual ssize_t pread(void *,size_t bytes,uint64_t offset) const override;	    /* read */
+    virtual bool pread_is_threadsafe() const override;
+    virtual io_stats_t io_stats() const override;
 
     /* iterator support */
     virtual image_process::iterator begin() const override;
@@ -236,32 +328,70 @@ class process_ewf : public image_process {
 class process_raw : public image_process {
     class file_info {
     public:;
-        file_info(const std::filesystem::path path_,uint64_t offset_,uint64_t length_):
-            path(path_),offset(offset_),length(length_){
-            stream.open(path, std::ios::binary);
-            if (stream.is_open()==false){
-                throw image_process::NoSuchFile( path_.string() );
-            }
-        };
-        ~file_info() {
-            stream.close();
-        }
+        file_info(const std::filesystem::path path_,uint64_t offset_,uint64_t length_);
+        ~file_info();
         std::filesystem::path path {};  // the file name
 	uint64_t offset   {};           // where each file starts
 	uint64_t length   {};           // how long it is
-        std::ifstream     stream {};       // where we are reading
+        int               fd {-1};         // read with pread(), so it may be shared between threads
+        int               direct_fd {-1};  // opened for direct I/O, if enabled
     };
     typedef std::vector<std::shared_ptr<file_info>> file_list_t;
     file_list_t file_list {};
     int64_t     get_filesize(int fd);
     void        add_file(std::filesystem::path fname);
     const class std::shared_ptr<process_raw::file_info> find_offset(uint64_t offset) const; /* finds which file this offset would map to */
+    size_t      find_index(uint64_t offset) const;   /* index in file_list of that file, or file_list.size() */
     uint64_t    raw_filesize {};			/* sume of all the lengths */
+    uint64_t    segment_stride {};              /* length of every segment but the last, if they are all the same */
+    bool        uniform_segments {true};
+
+    /* mmap mode: each page sbuf is a slice of a 'window' sbuf on a mapped chunk of a segment.
+     * The window's child count drops to 0 when the page sbuf (and everything sliced from it) is deleted;
+     * the window is then freed, when the next page is mapped or reclaim() is called, and the chunk is
+     * unmapped once none of its windows are left.
+     */
+    static const size_t MMAP_CHUNK_PAGES = 16; // pages per mapping
+    struct mapped_chunk_t {
+        uint8_t  *base {nullptr};       // start of the mapping
+        uint64_t file_offset {};        // offset of base in the segment
+        size_t   len {};
+        u_int    live {};               // windows still in use
+    };
+    struct window_t {
+        sbuf_t   *sbuf {nullptr};       // the parent of the page sbuf handed out
+        std::shared_ptr<file_info> fi {};
+        uint64_t chunk {};              // the start of its chunk in the segment
+        uint64_t file_offset {};        // where the page starts in the segment
+        size_t   pagesize {};
+    };
+    typedef std::pair<const file_info *, uint64_t> chunk_key_t; // a segment, and where the chunk starts in it
+    bool        use_mmap {false};
+    mutable std::mutex Mmapped {};
+    mutable std::map<chunk_key_t, mapped_chunk_t> chunks {};
+    mutable std::vector<window_t> windows {};
+    mutable chunk_key_t last_chunk {nullptr, 0};
+    uint64_t    chunk_bytes {};             // bytes per chunk: MMAP_CHUNK_PAGES pages of the size when mapped
+    sbuf_t      *sbuf_alloc_mapped(const image_process::iterator &it, size_t count, size_t this_pagesize) const;
+    void        reclaim_windows() const;      // call with Mmapped locked
+
+    /* direct I/O: segments are read with O_DIRECT through buffers from buffer_pool */
+    static const size_t DIRECT_IO_ALIGN = 4096; // covers 512-byte and 4K logical sectors
+    bool        use_direct_io {false};
+    void        direct_pread(const file_info &fi, uint8_t *buf, size_t count, uint64_t file_offset) const;
 public:
     process_raw(std::filesystem::path image_fname,size_t pagesize,size_t margin);
     virtual ~process_raw();
     virtual int open() override;
     virtual ssize_t pread(void *,size_t bytes,uint64_t offset) const override;	    /* read */
+    virtual bool get_extents(uint64_t offset, size_t bytes, std::vector<extent_t> &extents) const override;
+    virtual bool is_hole(uint64_t offset, size_t bytes) const override;
+    virtual bool pread_is_threadsafe() const override;
+    virtual void set_mmap(bool val) override;
+    virtual void set_direct_io(bool val) override;
+    virtual void set_pagesize(size_t val) override;
+    virtual std::string io_mode() const override;
+    virtual void reclaim() const override;
 
     /* iterator support */
     virtual image_process::iterator begin() const override;
@@ -277,6 +407,48 @@ public:
     virtual uint64_t seek_block(class image_process::iterator &it,uint64_t block) const override; // returns -1 if failue
 };
 
+/****************************************************************
+ *** STREAM
+ *** Read a pipe or stdin ("-") once, from start to end.
+ ****************************************************************/
+
+/* Pages are read from the stream in order into their sbufs. The bytes past the end of a page,
+ * which are its margin and the start of the next page, are kept in 'carry' until the next page is read.
+ * Pages after the iterator may be skipped (a restart, or -Y); they are read and thrown away.
+ * Reading a page before the last one read throws SeekError, so sampling, path printing and
+ * read-ahead are not available. The image size is the bytes read so far.
+ */
+class process_stream : public image_process {
+    int         fd {-1};
+    mutable std::mutex M {};
+    mutable std::vector<uint8_t> carry {};  // bytes [carry_offset, next_offset) of the stream
+    mutable uint64_t carry_offset {};
+    mutable uint64_t next_offset {};        // bytes read from fd
+    mutable bool     at_eof {false};
+    size_t      read_fully(uint8_t *buf, size_t count) const; // short only at the end of the stream
+    void        drop(uint64_t from) const;                       // forget the bytes before from
+    void        fill(uint64_t from, uint64_t upto) const;        // read until next_offset is upto
+public:
+    process_stream(std::filesystem::path fname, size_t pagesize_, size_t margin_);
+    virtual ~process_stream();
+    virtual int open() override;
+    virtual ssize_t pread(void *,size_t bytes,uint64_t offset) const override; // only the bytes kept in carry
+    virtual bool seekable() const override { return false; }
+
+    /* iterator support */
+    virtual image_process::iterator begin() const override;
+    virtual image_process::iterator end() const override;
+    virtual void     increment_iterator(class image_process::iterator &it) const override;
+
+    virtual pos0_t   get_pos0(const class image_process::iterator &it) const override;
+    virtual sbuf_t  *sbuf_alloc(class image_process::iterator &it) const override;
+    virtual double   fraction_done(const class image_process::iterator &it) const override;
+    virtual std::string str(const class image_process::iterator &it) const override;
+    virtual int64_t  image_size() const override;
+    virtual uint64_t max_blocks(const class image_process::iterator &it) const override;
+    virtual uint64_t seek_block(class image_process::iterator &it,uint64_t block) const override;
+};
+
 /****************************************************************
  *** Directory Recursion
  ****************************************************************/
@@ -305,6 +477,7 @@ class process_dir : public image_process {
     virtual int64_t  image_size() const override;				    /* total bytes */
     virtual uint64_t max_blocks(const class image_process::iterator &it) const override;
     virtual uint64_t seek_block(class image_process::iterator &it,uint64_t block) const override; // returns -1 if failu};
+    virtual bool     fixed_pages() const override { return false; } // a page is a file
 };
 
 /****************************************************************
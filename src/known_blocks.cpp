@@ -0,0 +1,168 @@
+/*
+ * known_blocks.cpp:
+ *
+ * Database of known-good 4 KiB blocks. See known_blocks.h
+ */
+
+#include "config.h"
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+
+#include "be20_api/dfxml_cpp/src/hash_t.h"
+
+#include "known_blocks.h"
+
+static int hexval(char ch)
+{
+    if (ch>='0' && ch<='9') return ch - '0';
+    if (ch>='a' && ch<='f') return ch - 'a' + 10;
+    if (ch>='A' && ch<='F') return ch - 'A' + 10;
+    return -1;
+}
+
+known_blocks::known_blocks(const std::filesystem::path &fname)
+{
+    char magic[HEADER_SIZE] {};
+    {
+        std::ifstream in(fname, std::ios::binary);
+        if (!in.is_open()) {
+            throw std::runtime_error("cannot open known blocks database " + fname.string());
+        }
+        in.read(magic, sizeof(magic));
+    }
+    if (memcmp(magic, MAGIC, 8) != 0) {
+        load_text(fname);
+        return;
+    }
+    memcpy(&count, magic + 8, sizeof(count));
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H)
+    fd = ::open(fname.string().c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        if (fd >= 0) ::close(fd);
+        throw std::runtime_error("cannot open known blocks database " + fname.string() + ": " + strerror(errno));
+    }
+    map_len = st.st_size;
+    if (!size_matches(map_len)) {
+        ::close(fd);
+        throw std::runtime_error(fname.string() + ": known blocks database is truncated");
+    }
+    map = mmap(nullptr, map_len, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        ::close(fd);
+        throw std::runtime_error("cannot map known blocks database " + fname.string() + ": " + strerror(errno));
+    }
+    digests = reinterpret_cast<const digest_t *>(static_cast<const uint8_t *>(map) + HEADER_SIZE);
+#else
+    if (!size_matches(std::filesystem::file_size(fname))) {
+        throw std::runtime_error(fname.string() + ": known blocks database is truncated");
+    }
+    std::ifstream in(fname, std::ios::binary);
+    in.seekg(HEADER_SIZE);
+    loaded.resize(count);
+    in.read(reinterpret_cast<char *>(loaded.data()), count * sizeof(digest_t));
+    if (!in.good()) {
+        throw std::runtime_error(fname.string() + ": known blocks database is truncated");
+    }
+    digests = loaded.data();
+#endif
+    if (!std::is_sorted(digests, digests + count)) {
+        throw std::runtime_error(fname.string() + ": known blocks database is not sorted");
+    }
+}
+
+/* The file has the header and count digests; a count too large to multiply is not */
+bool known_blocks::size_matches(uint64_t file_size) const
+{
+    return file_size >= HEADER_SIZE && (file_size - HEADER_SIZE) % sizeof(digest_t) == 0
+        && (file_size - HEADER_SIZE) / sizeof(digest_t) == count;
+}
+
+known_blocks::~known_blocks()
+{
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H)
+    if (map) munmap(map, map_len);
+    if (fd >= 0) ::close(fd);
+#endif
+}
+
+/* One hex digest per line; lines that do not start with one (headers, comments) are skipped */
+void known_blocks::load_text(const std::filesystem::path &fname)
+{
+    std::ifstream in(fname);
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.size() < 32) continue;
+        digest_t d;
+        bool ok = line.size()==32 || !isxdigit(static_cast<unsigned char>(line[32]));
+        for (size_t i = 0; ok && i < d.size(); i++) {
+            int hi = hexval(line[i*2]);
+            int lo = hexval(line[i*2+1]);
+            ok = hi >= 0 && lo >= 0;
+            d[i] = hi << 4 | lo;
+        }
+        if (ok) loaded.push_back(d);
+    }
+    std::sort(loaded.begin(), loaded.end());
+    loaded.erase(std::unique(loaded.begin(), loaded.end()), loaded.end());
+    digests = loaded.data();
+    count = loaded.size();
+}
+
+bool known_blocks::contains_digest(const digest_t &d) const
+{
+    return std::binary_search(digests, digests + count, d);
+}
+
+bool known_blocks::contains(const uint8_t *block)
+{
+    digest_t d;
+    memcpy(d.data(), dfxml::md5_generator::hash_buf(block, BLOCK_SIZE).digest, d.size());
+    blocks_checked += 1;
+    if (contains_digest(d)) {
+        blocks_found += 1;
+        return true;
+    }
+    return false;
+}
+
+std::future<std::vector<bool>> known_blocks::lookup(const uint8_t *buf, size_t nblocks)
+{
+    return std::async(std::launch::async, [this, buf, nblocks] {
+        std::vector<bool> is_known(nblocks);
+        for (size_t i = 0; i < nblocks; i++) {
+            is_known[i] = contains(buf + i * BLOCK_SIZE);
+        }
+        return is_known;
+    });
+}
+
+void known_blocks::write(const std::filesystem::path &fname, std::vector<digest_t> digests_)
+{
+    std::sort(digests_.begin(), digests_.end());
+    digests_.erase(std::unique(digests_.begin(), digests_.end()), digests_.end());
+    uint64_t n = digests_.size();
+    std::ofstream out(fname, std::ios::binary | std::ios::trunc);
+    out.write(MAGIC, 8);
+    out.write(reinterpret_cast<const char *>(&n), sizeof(n));
+    out.write(reinterpret_cast<const char *>(digests_.data()), n * sizeof(digest_t));
+    if (!out.good()) {
+        throw std::runtime_error("cannot write known blocks database " + fname.string());
+    }
+}
@@ -0,0 +1,71 @@
+/*
+ * known_blocks.h:
+ *
+ * A database of known-good 4 KiB blocks (e.g. the blocks of operating system and application
+ * files from NSRL or a hashdb export), so that Phase 1 can leave them out of the scan.
+ *
+ * Blocks are identified by the MD5 of their 4096 bytes, the block hash used by hashdb and
+ * published sector hash sets. The database is read in one of two formats:
+ *
+ *  - binary - the magic "BEKNOWN1", a 64-bit count, then count 16-byte digests in sorted order.
+ *             The file is mapped into memory (or read, where there is no mmap). A file whose size
+ *             does not match the count, or whose digests are not sorted, is rejected, since a binary
+ *             search of it would miss blocks.
+ *  - text   - one hex MD5 per line (the first word of the line); other lines are ignored.
+ *             The digests are read into memory and sorted. write() converts a list to binary.
+ *
+ * lookup() hashes the blocks of a page on a thread of its own, so that the thread reading the image
+ * does not compute an MD5 for every 4 KiB it reads. The database is not changed once open, and the
+ * statistics are atomic, so it is not locked.
+ */
+
+#ifndef KNOWN_BLOCKS_H
+#define KNOWN_BLOCKS_H
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <future>
+#include <vector>
+
+class known_blocks {
+    known_blocks(const known_blocks &that) = delete;
+    known_blocks &operator=(const known_blocks &that) = delete;
+
+public:
+    static constexpr size_t BLOCK_SIZE = 4096;
+    typedef std::array<uint8_t, 16> digest_t;
+
+    known_blocks(const std::filesystem::path &fname); // throws std::runtime_error
+    ~known_blocks();
+
+    bool     contains(const uint8_t *block);          // BLOCK_SIZE bytes
+    bool     contains_digest(const digest_t &d) const;
+    uint64_t size() const { return count; }
+
+    /* Whether each of the nblocks blocks at buf is known, computed on another thread. buf must outlive the future. */
+    std::future<std::vector<bool>> lookup(const uint8_t *buf, size_t nblocks);
+
+    /* statistics for this run */
+    std::atomic<uint64_t> blocks_checked {0};
+    std::atomic<uint64_t> blocks_found {0};
+
+    /* Write digests to fname in the binary format */
+    static void write(const std::filesystem::path &fname, std::vector<digest_t> digests);
+
+private:
+    static constexpr char MAGIC[9] = "BEKNOWN1";
+    static constexpr size_t HEADER_SIZE = 16;   // magic and count
+
+    int       fd {-1};
+    size_t    map_len {0};
+    void      *map {nullptr};
+    const digest_t *digests {nullptr};  // sorted; either in the mapped file or in loaded
+    uint64_t  count {0};
+    std::vector<digest_t> loaded {};    // from a text file
+    void      load_text(const std::filesystem::path &fname);
+    bool      size_matches(uint64_t file_size) const;
+};
+
+#endif
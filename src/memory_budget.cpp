@@ -0,0 +1,80 @@
+/*
+ * memory_budget.cpp:
+ *
+ * Process-wide memory budget for sbufs. See memory_budget.h
+ */
+
+#include "config.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+#include "memory_budget.h"
+
+namespace {
+std::mutex              M;
+std::condition_variable cv;             // a reservation was released
+thread_local unsigned   held_here {0};  // reservations of this thread
+}
+
+void memory_budget::set_limit(uint64_t bytes)
+{
+    the_limit = bytes;
+}
+
+void memory_budget::update_peak()
+{
+    const uint64_t bytes = in_use();
+    uint64_t prev = the_peak;
+    while (bytes > prev && !the_peak.compare_exchange_weak(prev, bytes)) {
+    }
+}
+
+void memory_budget::set_pages(uint64_t bytes)
+{
+    the_pages = bytes;
+    update_peak();
+}
+
+void memory_budget::hold(uint64_t bytes)
+{
+    the_held += bytes;
+    update_peak();
+}
+
+void memory_budget::release(uint64_t bytes)
+{
+    the_held -= bytes;
+    cv.notify_all();
+}
+
+bool memory_budget::available(uint64_t bytes)
+{
+    return the_limit == 0 || in_use() + bytes <= the_limit;
+}
+
+memory_budget::reservation::reservation(uint64_t bytes_): bytes(bytes_)
+{
+    std::unique_lock<std::mutex> lock(M);
+    if (held_here == 0 && !available(bytes)) {
+        const auto start = std::chrono::steady_clock::now();
+        deferred += 1;
+        /* the pages shrink without a notify, so look again every so often */
+        while (!available(bytes) && holders > 0) {
+            cv.wait_for(lock, std::chrono::milliseconds(100));
+        }
+        deferred_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    }
+    holders += 1;
+    held_here += 1;
+    hold(bytes);
+}
+
+memory_budget::reservation::~reservation()
+{
+    const std::lock_guard<std::mutex> lock(M);
+    holders -= 1;
+    held_here -= 1;
+    release(bytes);
+}
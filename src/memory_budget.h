@@ -0,0 +1,65 @@
+/*
+ * memory_budget.h:
+ *
+ * A process-wide limit on the memory used by sbufs, so that bulk_extractor slows down
+ * instead of being killed when a compressed or encoded region expands into many large sbufs.
+ *
+ * The sbufs themselves are allocated and freed in be20_api, which has no hook for counting them,
+ * so the bytes in flight are counted by those who make them:
+ *
+ *  - Phase 1 sets the bytes of the pages being read or waiting for or being scanned by the workers,
+ *    and stops reading pages while the budget is used up;
+ *  - the decoders (zip, gzip, pdf, hiberfile, xor) take a reservation for the sbuf they decode,
+ *    and hold it while it is scanned: before decoding when its size is known (a ZIP entry's
+ *    uncompressed size, an XOR'd copy), or else for the bytes decoded, once they are. A decoder
+ *    waits for room in the budget rather than decoding less, so the budget defers work but does
+ *    not change what is found; and
+ *  - the be2 scheduler holds the bytes of the recursive sbufs queued for a worker.
+ *
+ * A thread that holds a reservation does not wait for another (its recursive decodes would wait
+ * for it), and neither does one when no other thread holds any, since nothing but the pages would free
+ * memory; so the budget may be overrun by one decode at a time.
+ *
+ * The limit is 0 (none) unless -S memory_budget is given.
+ */
+
+#ifndef MEMORY_BUDGET_H
+#define MEMORY_BUDGET_H
+
+#include <atomic>
+#include <cstdint>
+
+class memory_budget {
+public:
+    static void     set_limit(uint64_t bytes);  // 0 for no limit
+    static uint64_t limit() { return the_limit; }
+    static void     set_pages(uint64_t bytes);  // the pages Phase 1 has read and not seen scanned
+    static void     hold(uint64_t bytes);       // counted without waiting
+    static void     release(uint64_t bytes);
+    static uint64_t in_use() { return the_pages + the_held; }
+    static uint64_t peak() { return the_peak; }
+    static bool     available(uint64_t bytes);  // bytes more fit in the budget
+
+    /* For a decoder: waits until bytes fit in the budget (see above) and holds them until destroyed */
+    class reservation {
+        reservation(const reservation &) = delete;
+        reservation &operator=(const reservation &) = delete;
+        const uint64_t bytes;
+    public:
+        explicit reservation(uint64_t bytes_);
+        ~reservation();
+    };
+
+    static inline std::atomic<uint64_t> deferred {0};      // decodes that waited for room
+    static inline std::atomic<uint64_t> deferred_ns {0};   // and how long
+
+private:
+    static void     update_peak();
+    static inline std::atomic<uint64_t> the_limit {0};
+    static inline std::atomic<uint64_t> the_pages {0};
+    static inline std::atomic<uint64_t> the_held {0};
+    static inline std::atomic<uint64_t> the_peak {0};
+    static inline std::atomic<unsigned> holders {0};       // threads holding reservations
+};
+
+#endif
@@ -77,6 +77,9 @@ void *notify_thread::run()
         std::map<std::string,std::string> stats = ss.get_realtime_stats();
 
         stats["elapsed_time"] = master_timer.elapsed_text();
+        stats[MEMORY_IN_USE] = std::to_string( memory_budget::in_use() / ( 1024*1024)) + " MiB"
+            + ( memory_budget::limit() ? " of " + std::to_string( memory_budget::limit() / ( 1024*1024)) + " MiB" : "" );
+        stats[MEMORY_PEAK] = std::to_string( memory_budget::peak() / ( 1024*1024)) + " MiB";
         if ( fraction_done ) {
             double done = *(fraction_done);
             stats[FRACTION_READ] = std::to_string( done * 100) + std::string( " %" );
@@ -33,6 +33,8 @@ public:
     static inline const std::string FRACTION_READ {"fraction_read"};
     static inline const std::string ESTIMATED_TIME_REMAINING {"estimated_time_remaining"};
     static inline const std::string ESTIMATED_DATE_COMPLETION {"estimated_date_completion"};
+    static inline const std::string MEMORY_IN_USE {"memory_in_use"};
+    static inline const std::string MEMORY_PEAK {"memory_peak"};
 
     void start_notify_thread( );
     void join();
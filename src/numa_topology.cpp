@@ -0,0 +1,178 @@
+/*
+ * numa_topology.cpp:
+ *
+ * NUMA nodes and thread placement for --numa. See numa_topology.h
+ */
+
+#include "config.h"
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#ifdef HAVE_SCHED_H
+#include <sched.h>
+#endif
+
+#ifdef HAVE_SYS_SYSCALL_H
+#include <sys/syscall.h>
+#endif
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+#include "numa_topology.h"
+
+numa_topology::numa_topology(const std::filesystem::path &sysfs)
+{
+    std::error_code ec;
+    for (const auto &entry : std::filesystem::directory_iterator(sysfs, ec)) {
+        const std::string name = entry.path().filename().string();
+        if (name.size() <= 4 || name.compare(0, 4, "node") != 0
+            || name.find_first_not_of("0123456789", 4) != std::string::npos) {
+            continue;
+        }
+        std::ifstream in(entry.path() / "cpulist");
+        std::string cpulist;
+        std::getline(in, cpulist);
+        node_t node;
+        node.id = std::stoi(name.substr(4));
+        node.cpus = parse_cpulist(cpulist);
+        if (!node.cpus.empty()) {       // nodes with only memory run no threads
+            nodes.push_back(node);
+        }
+    }
+    std::sort(nodes.begin(), nodes.end(), [](const node_t &a, const node_t &b) { return a.id < b.id; });
+}
+
+std::vector<int> numa_topology::parse_cpulist(const std::string &str)
+{
+    std::vector<int> cpus;
+    std::stringstream ss(str);
+    std::string range;
+    while (std::getline(ss, range, ',')) {
+        if (range.empty() || range.find_first_not_of("0123456789-\n ") != std::string::npos) continue;
+        size_t dash = range.find('-');
+        int first = std::stoi(range);
+        int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+        for (int cpu = first; cpu <= last; cpu++) {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+/* Each goes to the node with the fewest per CPU so far */
+std::vector<size_t> numa_topology::spread(size_t count) const
+{
+    std::vector<size_t> ret;
+    std::vector<size_t> assigned(nodes.size());
+    for (size_t i = 0; i < count && !nodes.empty(); i++) {
+        size_t best = 0;
+        for (size_t n = 1; n < nodes.size(); n++) {
+            if (assigned[n] * nodes[best].cpus.size() < assigned[best] * nodes[n].cpus.size()) {
+                best = n;
+            }
+        }
+        assigned[best] += 1;
+        ret.push_back(best);
+    }
+    return ret;
+}
+
+std::set<pid_t> numa_topology::threads()
+{
+    std::set<pid_t> tids;
+    std::error_code ec;
+    for (const auto &entry : std::filesystem::directory_iterator("/proc/self/task", ec)) {
+        tids.insert(std::stoi(entry.path().filename().string()));
+    }
+    return tids;
+}
+
+void numa_topology::place_workers(const std::set<pid_t> &before)
+{
+    std::vector<pid_t> started;
+    for (auto tid : threads()) {
+        if (before.find(tid) == before.end()) started.push_back(tid);
+    }
+    auto where = spread(started.size());
+    for (size_t i = 0; i < started.size(); i++) {
+        if (pin(started[i], where[i])) {
+            nodes[where[i]].workers.push_back(started[i]);
+        }
+    }
+}
+
+bool numa_topology::pin_current_thread(size_t node) const
+{
+    return pin(0, node);
+}
+
+pid_t numa_topology::current_tid()
+{
+#if defined(HAVE_SYS_SYSCALL_H) && defined(SYS_gettid)
+    return static_cast<pid_t>(syscall(SYS_gettid));
+#else
+    return 0;
+#endif
+}
+
+/* move_pages(2) with no nodes to move to reports the node of each page; the page must be present */
+int numa_topology::node_of(const void *addr) const
+{
+#if defined(HAVE_SYS_SYSCALL_H) && defined(SYS_move_pages)
+    const uintptr_t mask = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE)) - 1;
+    void *pages[1] = {reinterpret_cast<void *>(reinterpret_cast<uintptr_t>(addr) & ~mask)};
+    int status[1] = {-1};
+    if (addr != nullptr && syscall(SYS_move_pages, 0, 1, pages, nullptr, status, 0) == 0) {
+        for (size_t i = 0; i < nodes.size(); i++) {
+            if (nodes[i].id == status[0]) return static_cast<int>(i);
+        }
+    }
+#endif
+    return -1;
+}
+
+bool numa_topology::pin(pid_t tid, size_t node) const
+{
+#if defined(HAVE_SCHED_H) && defined(HAVE_SCHED_SETAFFINITY)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (auto cpu : nodes.at(node).cpus) {
+        CPU_SET(cpu, &set);
+    }
+    return sched_setaffinity(tid, sizeof(set), &set) == 0;
+#else
+    return false;
+#endif
+}
+
+/* utime and stime are the 14th and 15th fields of stat, in clock ticks. The name in (2) may contain spaces. */
+double numa_topology::cpu_seconds(pid_t tid)
+{
+    std::ifstream in("/proc/self/task/" + std::to_string(tid) + "/stat");
+    std::string line;
+    std::getline(in, line);
+    size_t paren = line.rfind(')');
+    if (paren == std::string::npos) return 0;
+    std::stringstream ss(line.substr(paren + 1));
+    std::string field;
+    uint64_t utime = 0, stime = 0;
+    for (int i = 3; i <= 13 && ss >> field; i++) {
+    }
+    if (!(ss >> utime >> stime)) return 0;
+    return static_cast<double>(utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+/* Call before the workers exit; the time of a thread that has gone cannot be read */
+void numa_topology::update_cpu_seconds()
+{
+    for (auto &node : nodes) {
+        node.worker_cpu_seconds = 0;
+        for (auto tid : node.workers) {
+            node.worker_cpu_seconds += cpu_seconds(tid);
+        }
+    }
+}
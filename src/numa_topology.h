@@ -0,0 +1,73 @@
+/*
+ * numa_topology.h:
+ *
+ * The NUMA nodes of the machine and the threads bulk_extractor places on them (--numa).
+ *
+ * The nodes and their CPUs come from /sys/devices/system/node. With --numa:
+ *  - the scanner workers are pinned to the nodes, in proportion to the CPUs of each node.
+ *    be20_api starts the workers and does not say which threads they are, so they are found
+ *    as the threads of the process that were not there before scanner_set::launch_workers().
+ *  - the async_reader keeps a queue of pages per node, served by reader threads pinned to the node.
+ *    A page is read into memory by a thread on its node, so the kernel allocates its sbuf there.
+ *
+ * With be1, be20_api has a single work queue, so the pages are interleaved across the nodes but a
+ * page is not sent to a worker on the node that read it; report.xml says so in <numa_page_placement>.
+ * What --numa prevents then is every page being allocated on the node of the producer thread,
+ * which sends half of the scanners' memory traffic across the interconnect to one memory controller.
+ *
+ * With -S scheduler=be2 the sbuf_scheduler starts its workers pinned to the nodes, asks node_of()
+ * where the memory of each page is, and deals the page's tasks to the workers of that node. A worker
+ * with nothing to do steals from the workers of its own node before the others, so some tasks still
+ * run on other nodes; report.xml gives the tasks run node-local and remote for each node.
+ *
+ * On a machine with one node, or without /sys or sched_setaffinity(), there is nothing to do.
+ */
+
+#ifndef NUMA_TOPOLOGY_H
+#define NUMA_TOPOLOGY_H
+
+#include <sys/types.h>
+
+#include <cstdint>
+#include <filesystem>
+#include <set>
+#include <string>
+#include <vector>
+
+class numa_topology {
+public:
+    struct node_t {
+        int              id {};
+        std::vector<int> cpus {};
+        std::vector<pid_t> workers {};      // scanner threads pinned to the node
+        unsigned         reader_threads {};
+        uint64_t         pages_read {};     // by the node's reader threads; updated under the async_reader's lock
+        uint64_t         bytes_read {};
+        double           worker_cpu_seconds {}; // set by update_cpu_seconds(), before the workers are joined
+        uint64_t         pages_placed {};   // be2: pages in the node's memory, dealt to its workers
+        uint64_t         tasks_local {};    // be2: tasks the node's workers ran on pages in its memory
+        uint64_t         tasks_remote {};   // be2: and on pages in another node's, or none known
+    };
+
+    explicit numa_topology(const std::filesystem::path &sysfs = "/sys/devices/system/node");
+    std::vector<node_t> nodes {};
+    size_t size() const { return nodes.size(); }
+
+    /* The node for each of count threads (or runs of pages), in proportion to the CPUs of each node */
+    std::vector<size_t> spread(size_t count) const;
+    void place_workers(const std::set<pid_t> &before);  // pin the threads started since before
+    bool pin_current_thread(size_t node) const;
+    void update_cpu_seconds();
+    int node_of(const void *addr) const;   // the index in nodes of the node that holds addr's memory, or -1
+
+    static pid_t current_tid();
+
+    static std::vector<int> parse_cpulist(const std::string &str); // "0-3,8,10-11"
+    static std::set<pid_t> threads();                              // of this process
+    static double cpu_seconds(pid_t tid);                          // user+system time of a thread
+
+private:
+    bool pin(pid_t tid, size_t node) const;
+};
+
+#endif
@@ -0,0 +1,127 @@
+/*
+ * page_checkpoint.cpp:
+ *
+ * Restart checkpoint for Phase 1. See page_checkpoint.h
+ */
+
+#include "config.h"
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#include <fcntl.h>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#include "page_checkpoint.h"
+
+page_checkpoint::page_checkpoint(const std::filesystem::path &fname_, uint64_t image_size_, uint64_t pagesize_):
+    fname(fname_), image_size(image_size_), pagesize(pagesize_),
+    npages(pagesize_ > 0 ? (image_size_ + pagesize_ - 1) / pagesize_ : 0),
+    marked((npages + 7) / 8)
+{
+}
+
+bool page_checkpoint::valid(const std::filesystem::path &fname, uint64_t pagesize)
+{
+    header_t h {};
+    std::ifstream in(fname, std::ios::binary);
+    in.read(reinterpret_cast<char *>(&h), sizeof(h));
+    return in.good() && memcmp(h.magic, MAGIC, sizeof(h.magic)) == 0 && h.pagesize == pagesize;
+}
+
+void page_checkpoint::load()
+{
+    header_t h {};
+    std::ifstream in(fname, std::ios::binary);
+    in.read(reinterpret_cast<char *>(&h), sizeof(h));
+    if (!in.good() || memcmp(h.magic, MAGIC, sizeof(h.magic)) != 0) {
+        throw std::runtime_error(fname.string() + " is not a checkpoint");
+    }
+    if (h.image_size != image_size || h.pagesize != pagesize || h.npages != npages) {
+        throw std::runtime_error(fname.string() + " is a checkpoint of another image or page size");
+    }
+    const std::lock_guard<std::mutex> lock(M);
+    in.read(reinterpret_cast<char *>(marked.data()), marked.size());
+    if (!in.good()) {
+        throw std::runtime_error(fname.string() + " is truncated");
+    }
+}
+
+void page_checkpoint::mark_locked(uint64_t page)
+{
+    if (page < npages) marked[page / 8] |= 1 << (page % 8);
+}
+
+void page_checkpoint::mark(uint64_t page)
+{
+    const std::lock_guard<std::mutex> lock(M);
+    mark_locked(page);
+}
+
+bool page_checkpoint::done(uint64_t page) const
+{
+    const std::lock_guard<std::mutex> lock(M);
+    return done_locked(page);
+}
+
+void page_checkpoint::mark_range(uint64_t offset, uint64_t len)
+{
+    const uint64_t end = std::min(offset + len, image_size);
+    const uint64_t first = (offset + pagesize - 1) / pagesize;
+    const uint64_t last = (end == image_size) ? npages : end / pagesize; // the last unit may be short
+    const std::lock_guard<std::mutex> lock(M);
+    for (uint64_t page = first; page < last; page++) {
+        mark_locked(page);
+    }
+}
+
+bool page_checkpoint::done_range(uint64_t offset, uint64_t len) const
+{
+    const uint64_t end = std::min(offset + len, image_size);
+    const std::lock_guard<std::mutex> lock(M);
+    for (uint64_t page = offset / pagesize; page * pagesize < end; page++) {
+        if (!done_locked(page)) return false;
+    }
+    return end > offset;
+}
+
+uint64_t page_checkpoint::count() const
+{
+    const std::lock_guard<std::mutex> lock(M);
+    uint64_t n = 0;
+    for (auto byte : marked) n += __builtin_popcount(byte);
+    return n;
+}
+
+void page_checkpoint::save()
+{
+    std::vector<uint8_t> bits;
+    {
+        const std::lock_guard<std::mutex> lock(M);
+        bits = marked;
+    }
+    header_t h {};
+    memcpy(h.magic, MAGIC, sizeof(h.magic));
+    h.image_size = image_size;
+    h.pagesize   = pagesize;
+    h.npages     = npages;
+
+    const std::string tmp = fname.string() + ".tmp";
+    int fd = ::open(tmp.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0666);
+    if (fd < 0) {
+        throw std::runtime_error("cannot create " + tmp + ": " + strerror(errno));
+    }
+    bool ok = ::write(fd, &h, sizeof(h)) == static_cast<ssize_t>(sizeof(h))
+        && ::write(fd, bits.data(), bits.size()) == static_cast<ssize_t>(bits.size())
+        && ::fsync(fd) == 0;
+    ::close(fd);
+    if (!ok) {
+        throw std::runtime_error("cannot write " + tmp + ": " + strerror(errno));
+    }
+    std::filesystem::rename(tmp, fname);
+}
@@ -0,0 +1,69 @@
+/*
+ * page_checkpoint.h:
+ *
+ * A bitmap of the pages that Phase 1 has finished with, kept in a file next to report.xml
+ * so that a restart does not have to parse report.xml and keep a string for every page.
+ * Restarting a 16 TB image with 16 MiB pages needs 128 KiB instead of a set of a million strings.
+ *
+ * The bitmap has a bit for each pagesize bytes of the image; when the page size changes during
+ * the run (--auto_pagesize), pagesize is the smallest page size and a page covers several bits.
+ *
+ * A page is marked when the scanners have finished with it, or when it is skipped, so a page that
+ * was waiting for a worker or being scanned when the program died is scanned again after a restart.
+ * The workers mark pages while the producer saves and looks them up, so every method locks.
+ *
+ * The file is written to a temporary name, fsync'd and renamed, so a crash while saving
+ * leaves the previous checkpoint in place.
+ */
+
+#ifndef PAGE_CHECKPOINT_H
+#define PAGE_CHECKPOINT_H
+
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <vector>
+
+class page_checkpoint {
+    page_checkpoint(const page_checkpoint &that) = delete;
+    page_checkpoint &operator=(const page_checkpoint &that) = delete;
+
+public:
+    page_checkpoint(const std::filesystem::path &fname_, uint64_t image_size_, uint64_t pagesize_);
+
+    /* Load the pages done by an earlier run. Throws std::runtime_error if the file is for another image or page size. */
+    void     load();
+    void     mark(uint64_t page);
+    bool     done(uint64_t page) const;
+
+    /* For pages of other sizes (--auto_pagesize), in units of pagesize. A range marks only the units
+     * it covers completely, and is done only if every unit it touches is, so an unaligned page is rescanned.
+     */
+    void     mark_range(uint64_t offset, uint64_t len);
+    bool     done_range(uint64_t offset, uint64_t len) const;
+    uint64_t count() const;                     // pages marked
+    void     save();                            // throws std::runtime_error
+
+    /* Returns true if fname is a checkpoint made with pagesize */
+    static bool valid(const std::filesystem::path &fname, uint64_t pagesize);
+
+    const std::filesystem::path fname;
+    const uint64_t image_size;
+    const uint64_t pagesize;
+    const uint64_t npages;
+
+private:
+    struct header_t {
+        char     magic[8];
+        uint64_t image_size;
+        uint64_t pagesize;
+        uint64_t npages;
+    };
+    static constexpr char MAGIC[9] = "BECKPT01";
+    mutable std::mutex   M {};
+    std::vector<uint8_t> marked;        // every page marked so far
+    void     mark_locked(uint64_t page);
+    bool     done_locked(uint64_t page) const { return page < npages && (marked[page / 8] >> (page % 8) & 1); }
+};
+
+#endif
@@ -0,0 +1,161 @@
+/*
+ * page_classifier.cpp:
+ *
+ * The class of each 4KiB block of an sbuf. See page_classifier.h
+ */
+
+#include "config.h"
+
+#include <algorithm>
+#include <map>
+
+#include "page_classifier.h"
+
+namespace {
+/* 1 for the bytes for which isprint() or isspace() in the C locale */
+struct text_table_t {
+    uint8_t is_text[256] {};
+    text_table_t() {
+        for (int c = 0x20; c < 0x7f; c++) is_text[c] = 1;
+        for (int c : {'\t', '\n', '\v', '\f', '\r'}) is_text[c] = 1;
+    }
+};
+const text_table_t text_table {};
+
+const std::map<std::string, uint8_t> interests {
+    {"accts",    page_classifier::TEXT | page_classifier::UTF16 | page_classifier::MIXED},
+    {"aes",      page_classifier::ENTROPY | page_classifier::MIXED},
+    {"base16",   page_classifier::TEXT | page_classifier::UTF16 | page_classifier::MIXED},
+    {"base64",   page_classifier::TEXT | page_classifier::UTF16 | page_classifier::MIXED},
+    {"email",    page_classifier::TEXT | page_classifier::UTF16 | page_classifier::MIXED},
+    {"facebook", page_classifier::TEXT | page_classifier::UTF16 | page_classifier::MIXED},
+    {"gps",      page_classifier::TEXT | page_classifier::UTF16 | page_classifier::MIXED},
+    {"httplogs", page_classifier::TEXT | page_classifier::UTF16 | page_classifier::MIXED},
+    {"json",     page_classifier::TEXT | page_classifier::UTF16 | page_classifier::MIXED},
+    {"kml",      page_classifier::TEXT | page_classifier::UTF16 | page_classifier::MIXED},
+    {"vcard",    page_classifier::TEXT | page_classifier::UTF16 | page_classifier::MIXED},
+    {"wordlist", page_classifier::TEXT | page_classifier::UTF16 | page_classifier::MIXED},
+};
+}
+
+uint8_t page_classifier::classify_block(const uint8_t *buf, size_t len)
+{
+    if (len == 0) return ZERO;
+    len = std::min(len, BLOCK_SIZE);
+
+    /* counts of the bytes at offsets 0, 1, 2 and 3 mod 4 */
+    uint32_t h[4][256] {};
+    size_t i = 0;
+    for (; i + 4 <= len; i += 4) {
+        h[0][buf[i]]++;
+        h[1][buf[i + 1]]++;
+        h[2][buf[i + 2]]++;
+        h[3][buf[i + 3]]++;
+    }
+    for (; i < len; i++) {
+        h[i % 4][buf[i]]++;
+    }
+
+    uint32_t even[256], odd[256], all[256];
+    for (int c = 0; c < 256; c++) {
+        even[c] = h[0][c] + h[2][c];
+        odd[c]  = h[1][c] + h[3][c];
+        all[c]  = even[c] + odd[c];
+    }
+    if (all[0] == len) return ZERO;
+
+    size_t text = 0, text_even = 0, text_odd = 0;
+    for (int c = 0; c < 256; c++) {
+        text      += all[c] * text_table.is_text[c];
+        text_even += even[c] * text_table.is_text[c];
+        text_odd  += odd[c] * text_table.is_text[c];
+    }
+    const size_t slack = len / 128;
+    if (len - text <= slack) return TEXT;
+    if (all[0] >= len / 4 && std::max(text_even + odd[0], text_odd + even[0]) + slack >= len) return UTF16;
+
+    /* close to an even spread of bytes: a sum of squared counts that a chi-square test would pass */
+    uint64_t squares = 0;
+    for (int c = 0; c < 256; c++) {
+        squares += uint64_t(all[c]) * all[c];
+    }
+    const double even_spread = double(len) * len / 256 + len;
+    if (squares > MAX_SQUARES * even_spread) return MIXED;
+
+    /* A run of MIN_TEXT_RUN text bytes covers three whole 4-byte words. Looking for three text words
+     * in a row has no branches and no chain from one byte to the next, as a count of the run would.
+     */
+    uint8_t words[BLOCK_SIZE / 4 + 1];
+    const size_t nwords = (len + 3) / 4;
+    for (size_t w = 0; w < len / 4; w++) {
+        const uint8_t *p = buf + w * 4;
+        words[w] = text_table.is_text[p[0]] & text_table.is_text[p[1]] & text_table.is_text[p[2]] & text_table.is_text[p[3]];
+    }
+    if (nwords > len / 4) {
+        words[len / 4] = 1;             // the bytes after the end would not end the run
+        for (size_t j = len / 4 * 4; j < len; j++) words[len / 4] &= text_table.is_text[buf[j]];
+    }
+    uint8_t found = 0;
+    for (size_t w = 0; w + 2 < nwords; w++) {
+        found |= words[w] & words[w + 1] & words[w + 2];
+    }
+    return found ? MIXED : ENTROPY;
+}
+
+page_classifier::map_t page_classifier::classify(const uint8_t *buf, size_t len)
+{
+    map_t map((len + BLOCK_SIZE - 1) / BLOCK_SIZE);
+    for (size_t b = 0; b < map.size(); b++) {
+        const size_t start = b * BLOCK_SIZE;
+        map[b] = classify_block(buf + start, std::min(BLOCK_SIZE, len - start));
+    }
+    return map;
+}
+
+uint8_t page_classifier::interest(const std::string &scanner)
+{
+    const auto it = interests.find(scanner);
+    return it == interests.end() ? ALL : it->second;
+}
+
+bool page_classifier::may_start_in(const map_t &map, size_t block, uint8_t interest)
+{
+    if (block >= map.size()) return false;
+    if (map[block] & interest) return true;
+    return block + 1 < map.size() && (map[block + 1] & interest);
+}
+
+bool page_classifier::may_start_before(const map_t &map, size_t len, uint8_t interest)
+{
+    const size_t blocks = std::min(map.size(), (len + BLOCK_SIZE - 1) / BLOCK_SIZE);
+    for (size_t b = 0; b < blocks; b++) {
+        if (may_start_in(map, b, interest)) return true;
+    }
+    return false;
+}
+
+size_t page_classifier::text_bytes(const uint8_t *buf, size_t len)
+{
+    size_t count = 0;
+    for (size_t i = 0; i < len; i++) {
+        count += text_table.is_text[buf[i]];
+    }
+    return count;
+}
+
+const char *page_classifier::class_name(uint8_t cls)
+{
+    switch (cls) {
+    case ZERO:    return "zero";
+    case TEXT:    return "text";
+    case UTF16:   return "utf16";
+    case ENTROPY: return "entropy";
+    case MIXED:   return "mixed";
+    }
+    return "unknown";
+}
+
+size_t page_classifier::class_index(uint8_t cls)
+{
+    return cls ? __builtin_ctz(cls) : 0;
+}
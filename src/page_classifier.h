@@ -0,0 +1,68 @@
+/*
+ * page_classifier.h:
+ *
+ * A class for each 4KiB block of an sbuf (all zeros, ASCII text, UTF-16 text, high-entropy, or mixed),
+ * from a byte histogram of the block, and the classes of block in which the features of a scanner can
+ * start. Scanners that look for text find little worth reporting in a compressed or encrypted volume,
+ * and an AES key schedule can't be in text or zeros; so
+ *
+ *  - with -S scheduler=be2 -S classify_pages=1, Phase 1 classifies each page once and does not run a
+ *    scanner on a page in which none of its features can start; and
+ *  - scan_aes classifies the sbuf it is given and skips the blocks in which no key schedule can start.
+ *
+ * A text block has fewer than 1 byte in 128 that is not printable ASCII or whitespace, and an AES key
+ * schedule has about 110 in its 176 bytes, so scan_aes loses nothing by skipping text and zero blocks.
+ * The text scanners do lose features by skipping high-entropy blocks: such a block has no run of
+ * MIN_TEXT_RUN text bytes, but it may have shorter ones, such as a six-byte email address, which
+ * they would have reported. (Random bytes have a run of six text bytes about nine times in a block,
+ * so a shorter MIN_TEXT_RUN would leave no block high-entropy.) -S classify_pages therefore changes
+ * what is found, and is off by default. A feature may run from its block into the next, so a scanner
+ * may skip a block only if it may skip the next one too.
+ *
+ * The histogram keeps four tables of counts, one for each byte of a 32-bit word, so that updates of
+ * one count do not wait for the last update of the same count; the loops over the tables are left
+ * to the compiler to vectorize.
+ */
+
+#ifndef PAGE_CLASSIFIER_H
+#define PAGE_CLASSIFIER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "be20_api/sbuf.h"
+
+class page_classifier {
+public:
+    enum : uint8_t {
+        ZERO    = 0x01,
+        TEXT    = 0x02,                 // printable ASCII and whitespace
+        UTF16   = 0x04,                 // the same as UTF-16, either byte order
+        ENTROPY = 0x08,                 // compressed, encrypted or random, with no runs of text
+        MIXED   = 0x10,                 // anything else
+        ALL     = 0x1f
+    };
+    static const size_t BLOCK_SIZE = 4096;
+    static const size_t CLASSES = 5;
+    static const size_t MIN_TEXT_RUN = 15;      // a run of text this long makes a block MIXED, not ENTROPY; shorter runs are lost
+    static constexpr double MAX_SQUARES = 1.5;  // ENTROPY: the sum of the squared byte counts, over that of random bytes
+    typedef std::vector<uint8_t> map_t;         // the class of each block
+
+    static uint8_t classify_block(const uint8_t *buf, size_t len);
+    static map_t   classify(const uint8_t *buf, size_t len);
+    static map_t   classify(const sbuf_t &sbuf) { return classify(sbuf.get_buf(), sbuf.bufsize); }
+
+    /* The classes in which the features of a scanner can start; ALL for the scanners that are not listed */
+    static uint8_t interest(const std::string &scanner);
+    /* Whether a feature of a scanner with that interest can start in a block, or in the first len bytes */
+    static bool may_start_in(const map_t &map, size_t block, uint8_t interest);
+    static bool may_start_before(const map_t &map, size_t len, uint8_t interest);
+
+    static size_t text_bytes(const uint8_t *buf, size_t len);  // the bytes for which isprint() or isspace()
+    static const char *class_name(uint8_t cls);
+    static size_t class_index(uint8_t cls);                   // 0..CLASSES-1
+};
+
+#endif
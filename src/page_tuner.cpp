@@ -0,0 +1,61 @@
+/*
+ * page_tuner.cpp:
+ *
+ * Page size choice for --auto_pagesize. See page_tuner.h
+ */
+
+#include "config.h"
+
+#include <algorithm>
+#include <sstream>
+
+#include "page_tuner.h"
+
+/* The largest MIN_PAGESIZE * 2^n that is <= bytes, but at least MIN_PAGESIZE */
+static uint64_t round_pagesize(double bytes)
+{
+    uint64_t ps = page_tuner::MIN_PAGESIZE;
+    while (ps * 2 <= bytes && ps * 2 <= page_tuner::MAX_PAGESIZE) ps *= 2;
+    return ps;
+}
+
+page_tuner::choice_t page_tuner::choose(const inputs_t &in)
+{
+    std::stringstream reason;
+    const unsigned workers = std::max(in.workers, 1U);
+    double want = in.pagesize;
+
+    if (in.page_seconds > 0 && (in.page_seconds < MIN_SECONDS || in.page_seconds > MAX_SECONDS)) {
+        want = in.pagesize * TARGET_SECONDS / in.page_seconds;
+        reason << "a page took " << in.page_seconds << " s, aiming for " << TARGET_SECONDS << " s";
+    } else if (in.page_seconds > 0) {
+        reason << "a page took " << in.page_seconds << " s";
+    } else {
+        reason << "page time not measured";
+    }
+
+    const double floor = std::max(MIN_PAGESIZE, in.margin);
+    if (want < floor) {
+        want = floor;
+        reason << "; no smaller than the margin";
+    }
+    if (in.memory_left > 0 && in.memory_per_page > 0) {
+        /* memory_per_page grows with the page and its margin */
+        const double expansion = std::max(1.0, in.memory_per_page / (in.pagesize + in.margin));
+        const double memory_cap = in.memory_left / (2.0 * workers) / expansion - in.margin;
+        if (want > memory_cap) {
+            want = std::max(memory_cap, static_cast<double>(MIN_PAGESIZE));
+            reason << "; limited by memory (" << expansion << "x expansion)";
+        }
+    }
+    const double balance_cap = static_cast<double>(in.bytes_left) / (4.0 * workers);
+    if (want > balance_cap && balance_cap >= MIN_PAGESIZE) {
+        want = balance_cap;
+        reason << "; limited to 4 pages per worker left";
+    }
+    if (want > MAX_PAGESIZE) {
+        want = MAX_PAGESIZE;
+        reason << "; limited to the largest page size";
+    }
+    return choice_t{round_pagesize(want), reason.str()};
+}
@@ -0,0 +1,55 @@
+/*
+ * page_tuner.h:
+ *
+ * Chooses the page size for --auto_pagesize from what Phase 1 has seen so far.
+ *
+ * Phase 1 measures, over the pages read since the last choice:
+ *  - page_seconds    - how long a worker spends on a page. There is no hook for a page finishing,
+ *                      so this comes from Little's law: pages in flight / pages finished per second.
+ *  - memory_per_page - the memory used by the run, over the pages in flight. This includes what
+ *                      the decoders expand each page into, which is what limits the page size.
+ *
+ * The page size is kept between the margin (a smaller page would scan more margin than page)
+ * and MAX_PAGESIZE, and is a power of 2 times MIN_PAGESIZE so that page offsets stay aligned
+ * for the checkpoint. Within those:
+ *  - it is grown or shrunk so that a page takes a worker TARGET_SECONDS, if it is outside
+ *    [MIN_SECONDS, MAX_SECONDS]; short pages spend their time in per-page overhead, long pages
+ *    leave workers idle at the end of the image and lose more work in a crash.
+ *  - it is no larger than lets two pages per worker fit in the memory budget.
+ *  - it is no larger than leaves four pages per worker to read, so the workers finish together.
+ *
+ * The margin is not tuned: it bounds the largest feature that can cross a page boundary,
+ * so changing it would change what is found.
+ */
+
+#ifndef PAGE_TUNER_H
+#define PAGE_TUNER_H
+
+#include <cstdint>
+#include <string>
+
+class page_tuner {
+public:
+    static constexpr uint64_t MIN_PAGESIZE = 1024 * 1024;
+    static constexpr uint64_t MAX_PAGESIZE = 256 * 1024 * 1024;
+    static constexpr double   MIN_SECONDS = 1.0;
+    static constexpr double   TARGET_SECONDS = 3.0;
+    static constexpr double   MAX_SECONDS = 10.0;
+
+    struct inputs_t {
+        uint64_t pagesize {};           // now
+        uint64_t margin {};
+        unsigned workers {1};
+        uint64_t bytes_left {};         // of the image, still to read
+        double   page_seconds {};       // 0 if not measured
+        double   memory_per_page {};    // bytes; 0 if not measured
+        uint64_t memory_left {};        // of the budget, for pages in flight; 0 for no budget
+    };
+    struct choice_t {
+        uint64_t    pagesize {};
+        std::string reason {};
+    };
+    static choice_t choose(const inputs_t &in);
+};
+
+#endif
@@ -1,4 +1,3 @@
-#include <random>
 #include <chrono>
 #include <thread>
 #include <chrono>
@@ -73,69 +72,609 @@ void Phase1::Config::set_sampling_parameters(std::string param)
  * attempt to get an sbuf. If we can't get it, we may be in a
  * low-memory situation.  wait for 30 seconds.
  *
+ * In a reader thread (with failures), each bad_alloc is added to failures instead of being
+ * reported, and the producer reports them when it takes the page from the reader.
+ *
  * TODO: do not get an sbuf if more than N tasks in workqueue.
  */
 
 sbuf_t *Phase1::get_sbuf(image_process::iterator &it)
+{
+    return get_sbuf(it.get_pos0(), [this, &it]{ return p.sbuf_alloc(it); });
+}
+
+sbuf_t *Phase1::get_sbuf(const pos0_t &pos0, const std::function<sbuf_t *()> &make, std::vector<std::string> *failures)
 {
     assert(config.max_bad_alloc_errors>0);
     for(u_int retry_count=0;retry_count<config.max_bad_alloc_errors;retry_count++){
         try {
-            return p.sbuf_alloc(it); // may throw exception
+            return make(); // may throw exception
         }
         catch (const std::bad_alloc &e) {
             // Low memory could come from a bad sbuf alloc or another low memory condition.
             // wait for a while and then try again...
-            std::cerr << "Low Memory (bad_alloc) exception: " << e.what()
-                      << " reading " << it.get_pos0()
-                      << " (retry_count=" << retry_count
-                      << " of " << config.max_bad_alloc_errors << ")\n";
-
-            std::stringstream str;
-            str << "name='bad_alloc' " << "pos0='" << dfxml_writer::xmlescape(it.get_pos0().str()) << "' " << "retry_count='"     << retry_count << "' ";
-            xreport.xmlout("debug:exception", e.what(), str.str(), true);
+            if (failures) {
+                failures->push_back(e.what());
+            } else {
+                report_bad_alloc(pos0, e.what(), retry_count);
+            }
         }
         if (retry_count < config.max_bad_alloc_errors+1){
-            std::cerr << "will wait for " << config.retry_seconds << " seconds and try again...\n";
-            std::this_thread::sleep_for(config.retry_seconds * 1000ms);
+            /* Wait for the workers to free memory; without a budget there is no telling, so wait it out */
+            auto deadline = std::chrono::steady_clock::now() + config.retry_seconds * 1000ms;
+            do {
+                std::this_thread::sleep_for(100ms);
+            } while (std::chrono::steady_clock::now() < deadline
+                     && !(memory_budget::limit() > 0 && memory_budget::available(p.pagesize + p.margin)));
         }
     }
-    std::cerr << "Too many errors encountered in a row. Diagnose and restart.\n";
+    if (!failures) {
+        std::cerr << "Too many errors encountered in a row. Diagnose and restart.\n";
+    }
     throw std::runtime_error("too many sbuf allocation errors");
 }
 
+void Phase1::report_bad_alloc(const pos0_t &pos0, const std::string &what, u_int retry_count)
+{
+    std::cerr << "Low Memory (bad_alloc) exception: " << what
+              << " reading " << pos0
+              << " (retry_count=" << retry_count
+              << " of " << config.max_bad_alloc_errors << ")\n";
+    std::cerr << "will wait up to " << config.retry_seconds << " seconds for memory and try again...\n";
+
+    std::stringstream str;
+    str << "name='bad_alloc' " << "pos0='" << dfxml_writer::xmlescape(pos0.str()) << "' " << "retry_count='"     << retry_count << "' ";
+    xreport.xmlout("debug:exception", what, str.str(), true);
+}
+
+/**
+ * Report an exception reading a page to both the user and the XML file.
+ */
+void Phase1::report_exception(const std::exception &e, const pos0_t &pos0)
+{
+    std::stringstream sstr;
+    sstr << "phase=1 name='" << e.what() << "' " << "pos0='" << pos0 << "' ";
+
+    if (config.opt_report_read_errors) {
+        std::cerr << "Phase 1 Exception " << e.what() << " skipping " << pos0 << "\n";
+    }
+    xreport.xmlout("debug:exception", e.what(), sstr.str(), true);
+}
+
+/**
+ * Hash a page that was just read and hand it to the scanner set, which deletes it.
+ */
+void Phase1::hash_and_schedule(sbuf_t *sbufp)
+{
+    const uint64_t offset = sbufp->pos0.offset;
+    page_started(offset, sbufp->pagesize);
+    /* The hashes of the media must be computed in order. The hasher copies the page and hashes it on its own thread. */
+    if (hasher){
+        hasher->update(*sbufp);
+    }
+    /* A page that is a single repeated byte, margin included, has nothing for the scanners */
+    if (config.opt_skip_constant_pages && constant_buf(sbufp->get_buf(), sbufp->bufsize)){
+        record_skip(sbufp->pos0.offset, sbufp->pagesize, "constant");
+        skipped_constant_bytes += sbufp->pagesize;
+        delete sbufp;
+        sbuf_finished(offset);
+        return;
+    }
+    /* Look the blocks up in the known-good database while the next pages are read */
+    if (known){
+        masking.push_back(masking_t{sbufp, known->lookup(sbufp->get_buf(), sbufp->pagesize / known_blocks::BLOCK_SIZE)});
+        schedule_masked(worker_count());
+        return;
+    }
+    dedup_and_schedule(sbufp);
+    sbuf_finished(offset);
+}
+
+/**
+ * Schedule the pages whose blocks have been looked up, in order, and wait for the oldest
+ * until no more than keep are waiting. The known-good blocks are left out; the rest of the page
+ * is scheduled in pieces.
+ */
+void Phase1::schedule_masked(size_t keep)
+{
+    while (!masking.empty()
+           && (masking.size() > keep || masking.front().is_known.wait_for(std::chrono::seconds(0)) == std::future_status::ready)) {
+        sbuf_t *sbufp = masking.front().sbuf;
+        const std::vector<bool> is_known = masking.front().is_known.get();
+        masking.pop_front();
+        const uint64_t offset = sbufp->pos0.offset;
+        if (!mask_known(sbufp, is_known)){
+            dedup_and_schedule(sbufp);
+        }
+        sbuf_finished(offset);
+    }
+}
+
+/**
+ * Give a page, or the part of one that is not known-good, to the scanner set
+ * unless every block of it was scanned before.
+ */
+void Phase1::dedup_and_schedule(sbuf_t *sbufp)
+{
+    /* Skip the page if every block of it, margin included, was scanned before */
+    if (dedup && dedup->check_and_add(sbufp->get_buf(), sbufp->pagesize, sbufp->bufsize)){
+        record_skip(sbufp->pos0.offset, sbufp->pagesize, "duplicate");
+        skipped_duplicate_bytes += sbufp->pagesize;
+        delete sbufp;
+        return;
+    }
+    total_bytes += sbufp->pagesize;
+    /*
+     * schedule_sbuf() will eventually call thread_pool::push_task(sbuf, nullptr) which will not return until there are free threads.
+     * This prevents the reader from getting too far ahead of the workers, but it limits the ability to read ahead.
+     * (With read-ahead enabled, the async_reader keeps reading while we wait here.)
+     */
+    sbuf_started(sbufp->pos0.offset);
+    if (scheduler) {
+        /* a task for each scanner, on the node that holds the page with --numa; the last deletes it */
+        scheduler->submit(sbufp, config.numa ? config.numa->node_of(sbufp->get_buf()) : -1);
+        return;
+    }
+    if (checkpoint) {
+        be1_finished();
+        /* The page may itself be a child (mmap mode), so the workers get a child of an sbuf of our own on its buffer */
+        sbuf_t *tracker = sbuf_t::sbuf_new(sbufp->pos0, sbufp->get_buf(), sbufp->bufsize, sbufp->pagesize);
+        be1_pending.push_back(be1_page_t{sbufp->pos0.offset, sbufp, tracker});
+        sbufp = new sbuf_t(*tracker, 0, tracker->bufsize);
+    }
+    ss.schedule_sbuf(sbufp); // processes the sbuf, then deletes it
+}
+
+/**
+ * -S scheduler=be2: Phase 1 runs each enabled scanner on each page as a task of its own.
+ * A page is recorded in report.xml as done, for restarting, when its last scanner finishes
+ * and every recursive sbuf found in it has been scanned.
+ * With -S classify_pages the first task of a page classifies its 4KiB blocks, and the scanners
+ * none of whose features can start in any of them are not run on it.
+ * No be20_api workers are running, so schedule_sbuf() scans a recursive sbuf in the calling task.
+ * The scanners of a page do not go through scanner_set::process_sbuf(), so stop_scheduler() writes
+ * what it would have: the calls and time of each scanner, and a debug:exception for each exception.
+ * A page of a repeating n-gram does go through it, whole, so that its scanner flags decide as for be1.
+ */
+void Phase1::start_scheduler()
+{
+    std::vector<sbuf_scheduler::scanner_fn_t> scanners;
+    for (const auto &name : ss.get_enabled_scanners()) {
+        scanner_t *scanner = ss.get_scanner_by_name(name);
+        scanners.push_back(sbuf_scheduler::scanner_fn_t{name, [this, scanner, name](const sbuf_t &sbuf) {
+            scanner_watchdog::scope budget(name, sbuf);
+            scanner_params sp(ss.sc, &ss, nullptr, scanner_params::PHASE_SCAN, &sbuf);
+            (*scanner)(sp);
+        }});
+    }
+    sbuf_scheduler::gate_t gate {nullptr};
+    if (config.opt_classify_pages) {
+        std::vector<uint8_t> interests;
+        for (const auto &it : scanners) {
+            interests.push_back(page_classifier::interest(it.name));
+        }
+        gate = [this, interests](const sbuf_t &sbuf) {
+            const page_classifier::map_t map = page_classifier::classify(sbuf);
+            const size_t page_blocks = std::min(map.size(), (sbuf.pagesize + page_classifier::BLOCK_SIZE - 1) / page_classifier::BLOCK_SIZE);
+            for (size_t b = 0; b < page_blocks; b++) {
+                page_class_blocks[page_classifier::class_index(map[b])] += 1;
+            }
+            std::vector<bool> run(interests.size());
+            for (size_t i = 0; i < interests.size(); i++) {
+                run[i] = page_classifier::may_start_before(map, sbuf.pagesize, interests[i]);
+            }
+            return run;
+        };
+    }
+    sbuf_scheduler::whole_t whole = [this](const sbuf_t &sbuf) {
+        return sbuf.find_ngram_size(ss.sc.max_ngram) > 0;
+    };
+    scheduler = new sbuf_scheduler(scanners, config.num_threads, true,
+                                   [this](const sbuf_t &sbuf) {
+                                       ss.record_work_start_stop_pos0str(sbuf.pos0.str());
+                                       sbuf_finished(sbuf.pos0.offset);
+                                   },
+                                   [this](sbuf_t *sbuf) { ss.schedule_sbuf(sbuf); },
+                                   config.opt_recurse_depth_workers, gate, whole, config.numa);
+}
+
+void Phase1::stop_scheduler()
+{
+    /* --numa: the workers' CPU time is read from /proc, so once they have scanned every page but before they are joined */
+    if (config.numa) {
+        while (scheduler->pages_in_flight() > 0) {
+            scheduler->wait();
+        }
+        config.numa->update_cpu_seconds();
+    }
+    scheduler->join();
+    for (size_t i = 0; config.numa && i < config.numa->size(); i++) {
+        numa_topology::node_t &node = config.numa->nodes[i];
+        node.pages_placed = scheduler->numa_stats(i).pages;
+        node.tasks_local = scheduler->numa_stats(i).tasks_local;
+        node.tasks_remote = scheduler->numa_stats(i).tasks_remote;
+    }
+    xreport.push("scheduler", "type='be2'");
+    xreport.xmlout("workers", scheduler->worker_count());
+    xreport.xmlout("pages", scheduler->pages_done());
+    xreport.xmlout("tasks", scheduler->tasks_run());
+    xreport.xmlout("steals", scheduler->steals());
+    xreport.xmlout("pages_whole", scheduler->pages_whole());
+    xreport.xmlout("scanner_errors", scheduler->scanner_errors());
+    xreport.xmlout("page_seconds_p50", scheduler->page_seconds(0.5));
+    xreport.xmlout("page_seconds_p99", scheduler->page_seconds(0.99));
+    xreport.xmlout("page_seconds_max", scheduler->page_seconds(1.0));
+    for (size_t i = 0; i < scheduler->scanners.size(); i++) {
+        std::stringstream attrs;
+        attrs << "name='" << scheduler->scanners[i].name << "' calls='" << scheduler->stats(i).calls
+              << "' seconds='" << scheduler->stats(i).ns / 1.0e9 << "' skipped='" << scheduler->stats(i).skipped << "'";
+        xreport.xmlout("scanner", "", attrs.str(), false);
+    }
+    if (config.opt_classify_pages) {
+        std::stringstream attrs;
+        for (size_t i = 0; i < page_classifier::CLASSES; i++) {
+            attrs << (i ? " " : "") << page_classifier::class_name(1 << i) << "='" << page_class_blocks[i] << "'";
+        }
+        xreport.xmlout("page_classes", "", attrs.str(), false);
+    }
+    for (const auto &[depth, st] : scheduler->depth_stats()) {
+        std::stringstream attrs;
+        attrs << "depth='" << depth << "' tasks='" << st.tasks << "' inlined='" << st.inlined
+              << "' max_queued='" << st.max_queued << "' max_queued_bytes='" << st.max_queued_bytes << "' max_running='" << st.max_running
+              << "' seconds='" << st.seconds << "' max_wait_seconds='" << st.max_wait_seconds << "'";
+        xreport.xmlout("recursion", "", attrs.str(), false);
+    }
+    xreport.pop("scheduler");
+    for (const auto &err : scheduler->errors_seen()) {
+        std::stringstream attrs;
+        attrs << "phase=1 name='" << dfxml_writer::xmlescape(err.scanner) << "' pos0='" << dfxml_writer::xmlescape(err.pos0) << "' ";
+        xreport.xmlout("debug:exception", err.what, attrs.str(), true);
+    }
+    delete scheduler;
+    scheduler = nullptr;
+}
+
+/**
+ * -S scanner_time_budget: the scanners that ran past the budget on an sbuf. Scanning those regions
+ * again with a larger budget finds whatever the scanners did not get to.
+ */
+void Phase1::write_overruns(const std::vector<scanner_watchdog::overrun_t> &overruns)
+{
+    std::stringstream attrs;
+    attrs << "budget_seconds='" << config.opt_scanner_time_budget << "' count='" << scanner_watchdog::overruns << "'";
+    xreport.push("scanner_overruns", attrs.str());
+    for (const auto &it : overruns) {
+        std::stringstream oattrs;
+        oattrs << "scanner='" << it.scanner << "' pos0='" << dfxml_writer::xmlescape(it.pos0)
+               << "' seconds='" << it.seconds << "' stopped='" << (it.stopped ? 1 : 0) << "'";
+        xreport.xmlout("overrun", "", oattrs.str(), false);
+    }
+    xreport.pop("scanner_overruns");
+}
+
+uint64_t Phase1::pages_queued() const
+{
+    return scheduler ? scheduler->pages_in_flight() : ss.depth0_sbufs_in_queue.load();
+}
+
+unsigned Phase1::worker_count() const
+{
+    return scheduler ? scheduler->worker_count() : ss.get_worker_count();
+}
+
+void Phase1::wait_for_workers()
+{
+    if (scheduler) {
+        scheduler->wait();
+    } else {
+        ss.main_thread_wait();
+        be1_finished();
+    }
+    p.reclaim();                        // mmap mode: unmap the pages the workers have finished with
+    count_pages_in_flight();
+}
+
+/* The pages being read and those the workers have not finished, with their margins */
+void Phase1::count_pages_in_flight()
+{
+    memory_budget::set_pages((pages_queued() + (reader ? reader->in_flight() : 0) + masking.size()) * (p.pagesize + p.margin));
+}
 
 /**
- * Create a list sorted list of random blocks.
+ * Given which 4 KiB blocks of the page are in the known-good database, runs of at least
+ * opt_known_blocks_min_run known blocks are recorded as skipped, and each stretch between them
+ * is copied into an sbuf of its own, with whatever margin follows it, and scheduled.
+ * Shorter runs are scanned anyway, so that a fragmented page is not cut into many small sbufs.
+ * Returns false, leaving the page alone, if there is nothing to leave out.
  */
-void Phase1::make_sorted_random_blocklist(blocklist_t *blocklist,uint64_t max_blocks,float frac)
+bool Phase1::mask_known(sbuf_t *sbufp, const std::vector<bool> &is_known)
 {
-    if (frac>0.2){
-        std::cerr << "A better random sampler is needed for this many random blocks. \n"
-                  << "We should have an iterator that decides if to include or not to include based on frac.\n";
-        throw std::runtime_error("Specify frac<0.2");
+    const size_t bs = known_blocks::BLOCK_SIZE;
+    const size_t nblocks = is_known.size();
+    const size_t min_run = std::max(config.opt_known_blocks_min_run, static_cast<uint32_t>(1));
+    const size_t found = std::count(is_known.begin(), is_known.end(), true);
+    if (found < min_run) return false;
+
+    /* byte ranges of the page to leave out, in order */
+    std::vector<std::pair<size_t, size_t>> masked;
+    for (size_t i = 0; i < nblocks; ) {
+        size_t j = i;
+        while (j < nblocks && is_known[j]) j++;
+        if (j - i >= min_run) masked.push_back(std::make_pair(i * bs, j * bs));
+        i = (j > i) ? j : i + 1;
     }
+    if (masked.empty()) return false;
+
+    size_t start = 0;                   // of the stretch to scan
+    for (size_t m = 0; m <= masked.size(); m++) {
+        const size_t end = (m < masked.size()) ? masked[m].first : sbufp->pagesize;
+        if (end > start) {
+            const size_t bufsize = std::min(sbufp->bufsize, end + p.margin) - start;
+            sbuf_t *piece = sbuf_t::sbuf_malloc(sbufp->pos0 + start, bufsize, end - start);
+            memcpy(piece->malloc_buf(), sbufp->get_buf() + start, bufsize);
+            dedup_and_schedule(piece);
+        }
+        if (m < masked.size()) {
+            record_skip(sbufp->pos0.offset + masked[m].first, masked[m].second - masked[m].first, "known");
+            skipped_known_bytes += masked[m].second - masked[m].first;
+            start = masked[m].second;
+        }
+    }
+    delete sbufp;
+    return true;
+}
+
+/*
+ * buf[i]==buf[i+1] for every i. memcmp() is vectorized in the C library, so this runs at memory speed
+ * and stops at the first byte that differs.
+ */
+bool Phase1::constant_buf(const uint8_t *buf, size_t len)
+{
+    return len > 0 && memcmp(buf, buf + 1, len - 1) == 0;
+}
 
-    std::default_random_engine generator;
-    std::uniform_int_distribution<uint64_t> distribution(0,max_blocks);
-    while(blocklist->size() < max_blocks * frac){
-        blocklist->insert( distribution(generator) ); // will be added even if already present
+/**
+ * If the page at it, with its margin, is a hole in a sparse image, skip it without reading it.
+ * The zeros are still hashed, after the pages before it that are still being read; the reader
+ * goes on reading ahead meanwhile.
+ */
+bool Phase1::skip_hole(const image_process::iterator &it)
+{
+    const uint64_t image_size = p.image_size();
+    if (it.raw_offset >= image_size) return false;
+    if (!p.is_hole(it.raw_offset, std::min(static_cast<uint64_t>(p.pagesize + p.margin), image_size - it.raw_offset))) {
+        return false;
+    }
+    const uint64_t pagesize = std::min(static_cast<uint64_t>(p.pagesize), image_size - it.raw_offset);
+    holes.push_back(hole_t{pages_scheduled + (reader ? reader->in_flight() : 0), it.raw_offset, pagesize});
+    holes_ready();
+    return true;
+}
+
+void Phase1::holes_ready()
+{
+    while (!holes.empty() && holes.front().after <= pages_scheduled) {
+        const hole_t &hole = holes.front();
+        if (hasher){
+            hasher->update_zeros(hole.offset, hole.len);
+        }
+        mark_done(hole.offset, hole.len);
+        record_skip(hole.offset, hole.len, "hole");
+        skipped_hole_bytes += hole.len;
+        holes.pop_front();
+    }
+}
+
+/* A page is seen if the checkpoint or report.xml of the run being restarted says so */
+bool Phase1::already_seen(const image_process::iterator &it) const
+{
+    if (checkpoint && checkpoint->done_range(it.raw_offset, p.pagesize)) {
+        return true;
     }
+    return config.seen_page_ids.size() > 0 && config.seen_page_ids.find(it.get_pos0().str()) != config.seen_page_ids.end();
+}
+
+void Phase1::mark_done(uint64_t offset, uint64_t len)
+{
+    if (checkpoint) {
+        checkpoint->mark_range(offset, len);
+    }
+}
+
+void Phase1::page_started(uint64_t offset, uint64_t len)
+{
+    if (!checkpoint) return;
+    const std::lock_guard<std::mutex> lock(progress_M);
+    in_progress[offset] = progress_t{len, 1};
+}
+
+void Phase1::sbuf_started(uint64_t offset)
+{
+    if (!checkpoint) return;
+    const std::lock_guard<std::mutex> lock(progress_M);
+    auto it = in_progress.upper_bound(offset);
+    if (it != in_progress.begin()) (--it)->second.pending += 1;
+}
+
+void Phase1::sbuf_finished(uint64_t offset)
+{
+    if (!checkpoint) return;
+    const std::lock_guard<std::mutex> lock(progress_M);
+    auto it = in_progress.upper_bound(offset);
+    if (it == in_progress.begin()) return;
+    --it;
+    if (--it->second.pending > 0) return;
+    checkpoint->mark_range(it->first, it->second.len);
+    in_progress.erase(it);
+}
+
+/**
+ * be20_api's workers do not say which pages they finished, so each is given a child of an sbuf on
+ * the page's buffer, which is kept here with the page. The page has been scanned at depth 0 when that
+ * sbuf has no children left: the child and any slices of it that were recursed into have been deleted. Recursive sbufs with
+ * buffers of their own are not children; they are counted in be20_api's sbufs_in_queue from when they
+ * are scheduled, which is while their parent is being scanned, until they have been scanned. So the
+ * page is done once no sbufs deeper than 0 are left at some time after it was scanned.
+ */
+void Phase1::be1_finished()
+{
+    if (scheduler) return;
+    for (auto it = be1_pending.begin(); it != be1_pending.end(); ) {
+        if (it->tracker->children > 0) {
+            ++it;
+            continue;
+        }
+        be1_scanned.push_back(it->offset);
+        delete it->tracker;
+        delete it->page;
+        it = be1_pending.erase(it);
+    }
+    const int64_t sbufs = ss.sbufs_in_queue;
+    const int64_t depth0 = ss.depth0_sbufs_in_queue;
+    if (sbufs > depth0) return;         // recursive sbufs of those pages may be left
+    for (const auto offset : be1_scanned) {
+        sbuf_finished(offset);
+    }
+    be1_scanned.clear();
+}
+
+/* Save the pages the scanners have finished; under be1, those known to be, without waiting for the others */
+void Phase1::save_checkpoint()
+{
+    be1_finished();
+    checkpoint->save();
+}
+
+void Phase1::start_tuning()
+{
+    tuning.start         = std::chrono::steady_clock::now();
+    tuning.pages         = 0;
+    tuning.total_bytes   = total_bytes;
+    tuning.in_flight     = pages_queued();
+    tuning.in_flight_sum = 0;
+}
+
+/**
+ * Measure the pages read since the last choice and let page_tuner choose the size of the next ones.
+ * The choice, and why, is written to report.xml. The new size starts with the first page that starts
+ * at a multiple of it (see resize_pages()), so that every page starts at a multiple of its size.
+ */
+void Phase1::auto_pagesize(const image_process::iterator &it)
+{
+    const double   seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - tuning.start).count();
+    const double   in_flight = tuning.pages > 0 ? tuning.in_flight_sum / tuning.pages : 0;
+    const double   in_flight_now = pages_queued();
+    /* the bytes the workers finished are those scheduled, less the growth of the work queue */
+    const double   finished = static_cast<double>(total_bytes - tuning.total_bytes)
+                              + (static_cast<double>(tuning.in_flight) - in_flight_now) * p.pagesize;
+    const uint64_t memory = memory_budget::in_use();
+
+    page_tuner::inputs_t in;
+    in.pagesize   = p.pagesize;
+    in.margin     = p.margin;
+    in.workers    = std::max(worker_count(), 1U);
+    in.bytes_left = static_cast<uint64_t>(p.image_size()) > it.raw_offset ? p.image_size() - it.raw_offset : 0;
+    if (seconds > 0 && finished > 0) {
+        /* Little's law, counting only the pages that have a worker */
+        in.page_seconds = std::min(static_cast<double>(in.workers), std::max(in_flight, 1.0)) * p.pagesize / (finished / seconds);
+    }
+    if (memory > memory_base) {
+        in.memory_per_page = (memory - memory_base) / std::max(in_flight, 1.0);
+    }
+    if (memory_budget::limit() > memory_base) {
+        in.memory_left = memory_budget::limit() - memory_base;
+    }
+
+    page_tuner::choice_t choice = page_tuner::choose(in);
+    std::stringstream attrs;
+    attrs << "offset='" << it.raw_offset << "' previous='" << p.pagesize << "' pagesize='" << choice.pagesize
+          << "' page_seconds='" << in.page_seconds << "' memory_per_page='" << static_cast<uint64_t>(in.memory_per_page) << "'";
+    xreport.xmlout("auto_pagesize", choice.reason, attrs.str(), true);
+    tuning.next_pagesize = choice.pagesize != p.pagesize ? choice.pagesize : 0;
+    tuning.choices += 1;
+    start_tuning();
+}
+
+/* The pages being read ahead have the old size; schedule them before changing it */
+void Phase1::resize_pages()
+{
+    while (reader && !reader->empty()) {
+        schedule_page(reader->next());
+    }
+    p.set_pagesize(tuning.next_pagesize);
+    tuning.next_pagesize = 0;
+}
+
+/* Skipped pages are written to report.xml as runs, not one element per page */
+void Phase1::record_skip(uint64_t offset, uint64_t len, const std::string &reason)
+{
+    if (skip_len > 0 && (skip_start + skip_len != offset || skip_reason != reason)){
+        flush_skip();
+    }
+    if (skip_len == 0){
+        skip_start  = offset;
+        skip_reason = reason;
+    }
+    skip_len += len;
+}
+
+void Phase1::flush_skip()
+{
+    if (skip_len == 0) return;
+    std::stringstream attrs;
+    attrs << "offset='" << skip_start << "' length='" << skip_len << "' reason='" << skip_reason << "'";
+    xreport.xmlout("skipped", "", attrs.str(), false);
+    skip_len = 0;
+}
+
+/**
+ * Schedule a page delivered by the read-ahead stage. Pages arrive in the order they were submitted.
+ */
+void Phase1::schedule_page(async_reader::page_t page)
+{
+    /* The reader thread's bad_allocs are reported here, so only this thread writes report.xml */
+    for (size_t i = 0; i < page.alloc_failures.size(); i++) {
+        report_bad_alloc(page.pos0, page.alloc_failures[i], i);
+    }
+    if (page.error && page.alloc_failures.size() >= config.max_bad_alloc_errors) {
+        std::cerr << "Too many errors encountered in a row. Diagnose and restart.\n";
+    }
+    /* Do not get too far ahead of the workers; the reader keeps reading while we wait */
+    while (pages_queued() > worker_count()) {
+        wait_for_workers();
+        depth0_sleep += 1;
+    }
+    try {
+        if (page.error) {
+            std::rethrow_exception(page.error);
+        }
+        hash_and_schedule(page.sbuf);
+    }
+    catch (const std::exception &e) {
+        report_exception(e, page.pos0);
+    }
+    pages_scheduled += 1;
+    holes_ready();
 }
 
 void Phase1::read_process_sbufs()
 {
-    /* A single loop with two iterators.
+    /* A single loop with the regular image_iterator, which knows how to read blocks.
      *
-     * it -- the regular image_iterator; it knows how to read blocks.
-     *
-     * si -- the sampling iterator. It is a iterator for an STL set.
-     *
-     * If sampling, si is used to ask for a specific page from it.
+     * If sampling, the sampler gives runs of adjacent blocks to read. The iterator is moved
+     * to the start of each run and then steps through it like an unsampled read.
+     * A stream is read in order by this thread, so it has no read-ahead.
      */
-    blocklist_t blocks_to_sample;
-    blocklist_t::const_iterator si = blocks_to_sample.begin(); // sampling iterator
-    image_process::iterator     it = p.begin(); // sequential iterator
+    if (config.opt_read_ahead_depth > 0 && p.seekable()) {
+        reader = new async_reader(p, config.opt_read_ahead_depth, config.opt_read_ahead_threads,
+                                  [this](const pos0_t &pos0, const std::function<sbuf_t *()> &make, std::vector<std::string> &failures) {
+                                      return get_sbuf(pos0, make, &failures);
+                                  }, config.numa);
+        xreport.xmlout("read_ahead_backend", reader->backend());
+    }
+    block_sampler           *sampler = nullptr;
+    uint64_t                run_left = 0;       // pages left in the current run of sampled blocks
+    image_process::iterator it = p.begin(); // sequential iterator
 
     if (config.opt_scan_start){
         std::cout << "offset set to " << config.opt_scan_start << "\n";
@@ -143,16 +682,25 @@ void Phase1::read_process_sbufs()
     }
 
     if (sampling()){
-        /* Create a list of blocks to sample */
         std::cerr << "sampling\n";
-        make_sorted_random_blocklist(&blocks_to_sample,it.max_blocks(),config.sampling_fraction);
-        si = blocks_to_sample.begin();    // get the new beginning
+        sampler = new block_sampler(it.max_blocks(), config.sampling_fraction, config.sampling_passes,
+                                    config.sampling_seed, block_sampler::mode_for(config.sampling_mode));
     } else {
         /* Not sampling */
-        sha1g = new dfxml::sha1_generator();
+        hasher = new image_hasher(config.opt_image_hashes);
     }
-    /* Loop over the blocks to sample */
-    while(it != p.end()) {
+    /* The sampler counts in pages, and a directory's pages are files, so neither can change the page size.
+     * The bytes left in a stream are not known.
+     */
+    const bool auto_tune = config.opt_auto_pagesize && !sampler && p.fixed_pages() && p.seekable();
+    if (config.opt_auto_pagesize && !auto_tune) {
+        std::cerr << "auto_pagesize: ignored when sampling or reading a directory or stream\n";
+    }
+    if (auto_tune) {
+        start_tuning();
+    }
+    /* Loop over the blocks to sample. When sampling, a pass may end at the last block, so only the sampler ends the loop. */
+    while(sampler || it != p.end()) {
         /* If there is a disk write error, shut down */
         if (ss.disk_write_errors > 0 ){
             for(int i=0;i<5;i++){
@@ -164,71 +712,104 @@ void Phase1::read_process_sbufs()
             exit(1);
         }
 
-        if (sampling()){                // if sampling, seek the iterator
-            if (si==blocks_to_sample.end()) break;
-            it.seek_block(*si);
+        if (sampler && run_left==0){    // if sampling, seek the iterator to the next run
+            uint64_t start = 0;
+            if (!sampler->next(start, run_left)) break;
+            it.seek_block(start);
         }
-        /* If we have gone to far, break */
+        /* If we have gone to far, break; a sampling pass starts over at the next pass, which may sample blocks before it */
         if (config.opt_scan_end!=0 && config.opt_scan_end <= it.raw_offset ){
-            break;                      // passed the offset
+            if (!sampler) break;        // passed the offset
+            sampler->next_pass();
+            run_left = 0;
+            continue;
         }
 
-        /* If there are too many in the queue, wait... */
-        if (ss.depth0_sbufs_in_queue > ss.get_worker_count()) {
-            ss.main_thread_wait();
-            depth0_sleep += 1;
+        /* Over the memory budget: let the workers finish the pages they have before reading another */
+        count_pages_in_flight();
+        if ((pages_queued() > 0 || (reader && !reader->empty()))
+            && !memory_budget::available(p.pagesize + p.margin)) {
+            if (reader && !reader->empty()) {
+                schedule_page(reader->next());
+            } else {
+                wait_for_workers();
+            }
+            memory_budget_waits += 1;
             continue;
         }
 
+        if (reader) {
+            /* Reading ahead: when the maximum number of pages is in flight, schedule the oldest */
+            if (reader->full()) {
+                schedule_page(reader->next());
+                continue;
+            }
+        } else {
+            /* If there are too many in the queue, wait... */
+            if (pages_queued() > worker_count()) {
+                wait_for_workers();
+                depth0_sleep += 1;
+                continue;
+            }
+        }
 
         if (config.opt_page_start<=it.page_number && config.opt_scan_start<=it.raw_offset){
             // Only process pages we haven't seen before
-            if (config.seen_page_ids.find(it.get_pos0().str()) == config.seen_page_ids.end()){
-                try {
-                    sbuf_t *sbufp = get_sbuf(it);
-
-                    /* compute the sha1 hash of the media. Sadly, this needs to be serliazed, it is the nature of SHA1. */
-                    if (sha1g){
-                        if (sbufp->pos0.offset==hash_next){
-                            // next byte follows logically, so continue to compute hash
-                            sha1g->update(sbufp->get_buf(), sbufp->pagesize);
-                            hash_next += sbufp->pagesize;
-
-                        } else {
-                            delete sha1g; // we had a logical gap; stop hashing
-                            sha1g = 0;
-                        }
+            if (!already_seen(it)){
+                if (config.opt_skip_holes && skip_hole(it)) {
+                    /* nothing to read */
+                } else if (reader) {
+                    reader->submit(it);
+                } else {
+                    try {
+                        hash_and_schedule(get_sbuf(it));
                     }
-                    total_bytes += sbufp->pagesize;
-                    /*
-                     * schedule_sbuf() will eventually call thread_pool::push_task(sbuf, nullptr) which will not return until there are free threads.
-                     * This prevents the reader from getting too far ahead of the workers, but it limits the ability to read ahead.
-                     */
-                    ss.schedule_sbuf(sbufp); // processes the sbuf, then deletes it
-                }
-                catch (const std::exception &e) {
-                    // report uncaught exceptions to both user and XML file
-                    std::stringstream sstr;
-                    sstr << "phase=1 name='" << e.what() << "' " << "pos0='" << it.get_pos0() << "' ";
-
-                    if (config.opt_report_read_errors) {
-                        std::cerr << "Phase 1 Exception " << e.what() << " skipping " << it.get_pos0() << "\n";
+                    catch (const std::exception &e) {
+                        report_exception(e, it.get_pos0());
                     }
-                    xreport.xmlout("debug:exception", e.what(), sstr.str(), true);
                 }
+                tuning.pages += 1;
+                tuning.in_flight_sum += pages_queued();
             }
         }
 
 
-        /* If we are random sampling, move to the next random sample. */
-        if (sampling()){
-            ++si;
+        /* If we are random sampling, the next block of the run follows this one. */
+        if (sampler){
+            run_left--;
+        }
+
+        /* Save the pages done every so often, for restarting */
+        bool saved_checkpoint = false;
+        if (checkpoint && config.opt_checkpoint_interval > 0 && std::chrono::steady_clock::now() - last_checkpoint >= std::chrono::seconds(config.opt_checkpoint_interval)){
+            save_checkpoint();
+            last_checkpoint = std::chrono::steady_clock::now();
+            saved_checkpoint = true;
         }
 
         /* Report back the fraction done if requested */
         if (config.fraction_done) *config.fraction_done = p.fraction_done(it);
         ++it;
+
+        /* Choose the page size once the first pages have been measured, and again at each checkpoint */
+        if (auto_tune && it != p.end()
+            && (tuning.choices == 0 ? tuning.pages >= config.opt_auto_pagesize_pages : saved_checkpoint)) {
+            auto_pagesize(it);
+        }
+        if (tuning.next_pagesize && it != p.end() && it.raw_offset % tuning.next_pagesize == 0) {
+            resize_pages();
+        }
+    }
+
+    /* Schedule the pages that are still being read, and looked up */
+    while (reader && !reader->empty()) {
+        schedule_page(reader->next());
     }
+    schedule_masked(0);
+    delete reader;
+    reader = nullptr;
+    delete sampler;
+    flush_skip();
 
     if (config.fraction_done) *config.fraction_done = 1.0;
 }
@@ -249,6 +830,8 @@ void Phase1::dfxml_write_create(int argc, char * const *argv)
     xreport.xmlout("threads",config.num_threads);
     xreport.xmlout("pagesize",config.opt_pagesize);
     xreport.xmlout("marginsize",config.opt_marginsize);
+    xreport.xmlout("read_ahead_depth",config.opt_read_ahead_depth);
+    xreport.xmlout("io_mode",p.io_mode());
     ss.dump_enabled_scanner_config();
     xreport.pop("configuration");	// configuration
     xreport.flush();                    // get it to the disk
@@ -260,10 +843,13 @@ void Phase1::dfxml_write_source()
     xreport.push("source");
     xreport.xmlout("image_filename",p.image_fname());
     xreport.xmlout("image_size",p.image_size());
-    if (sha1g){
-        dfxml::sha1_t sha1 = sha1g->digest();
-        xreport.xmlout("hashdigest",sha1.hexdigest(),"type='SHA1'",false);
-        delete sha1g;
+    if (hasher){
+        for (const auto &[type, hexdigest] : hasher->digests()) {
+            xreport.xmlout("hashdigest",hexdigest,"type='"+type+"'",false);
+            if (type=="SHA1") image_hash = hexdigest;
+        }
+        delete hasher;
+        hasher = nullptr;
     }
     xreport.pop("source");			// source
     xreport.flush();
@@ -282,20 +868,93 @@ void Phase1::dfxml_write_source()
 void Phase1::phase1_run()
 {
     assert(ss.get_current_phase() == scanner_params::PHASE_SCAN);
+    memory_base = memory_budget::in_use();
+
+    /* A stream's size is not known, so it is restarted from report.xml */
+    if ((config.opt_checkpoint_interval > 0 || config.restart_from_checkpoint) && !config.checkpoint_fname.empty()
+        && p.fixed_pages() && p.seekable()) {
+        checkpoint = new page_checkpoint(config.checkpoint_fname, p.image_size(), config.checkpoint_unit());
+        if (config.restart_from_checkpoint) {
+            checkpoint->load();
+        }
+        last_checkpoint = std::chrono::steady_clock::now();
+    }
 
-    // save all of the pages we had previously seen (through restarting) in the DFXML file
+    // save all of the pages we had previously seen (through restarting) in the DFXML file, and in the checkpoint
     for (const auto &it : config.seen_page_ids) {
         ss.record_work_start_stop_pos0str( it );
+        if (checkpoint && it.size() > 0 && it.find_first_not_of("0123456789") == std::string::npos) {
+            mark_done(std::stoull(it), config.opt_pagesize);
+        }
     }
 
     // now start the new run
     xreport.push("runtime","xmlns:debug=\"http://www.github.com/simsong/bulk_extractor/issues\"");
 
+    if (config.restart_from_checkpoint && checkpoint) {
+        xreport.xmlout("checkpoint_pages_done", checkpoint->count());
+    }
+    if (config.opt_known_blocks.size() > 0) {
+        known = new known_blocks(config.opt_known_blocks);
+        xreport.xmlout("known_blocks_database_size", known->size());
+    }
+    if (config.opt_dedup_db.size() > 0) {
+        dedup = new block_hash_store(config.opt_dedup_db, config.opt_dedup_db_slots, config.dedup_fingerprint);
+    }
+
     // process all of the sbufs
+    scanner_watchdog::start(config.opt_scanner_time_budget);
+    if (config.opt_scheduler == "be2" && config.num_threads > 0) {
+        start_scheduler();
+    }
     read_process_sbufs();
+    if (scheduler) {
+        stop_scheduler();
+    }
+    for (const auto &[name, value] : p.io_stats()) {
+        xreport.xmlout(name, value);
+    }
 
     if (!config.opt_quiet) cout << "All data read; waiting for threads to finish..." << std::endl;
+    /* --numa: the workers' CPU time is read from /proc, so once they have scanned every page but before they are joined */
+    if (config.numa && config.opt_scheduler == "be1") {  // be2: in stop_scheduler()
+        while (pages_queued() > 0) {
+            ss.main_thread_wait();
+        }
+        config.numa->update_cpu_seconds();
+    }
     ss.join();
+    if (config.opt_scanner_time_budget > 0) {
+        write_overruns(scanner_watchdog::stop());
+    }
+    if (checkpoint) {
+        be1_finished();
+        checkpoint->save();             // every page is done
+        delete checkpoint;
+        checkpoint = nullptr;
+    }
+    xreport.xmlout("memory_budget", memory_budget::limit());
+    xreport.xmlout("memory_peak", memory_budget::peak());
+    xreport.xmlout("memory_budget_waits", memory_budget_waits);
+    xreport.xmlout("memory_decodes_deferred", memory_budget::deferred.load());
+    xreport.xmlout("memory_decodes_deferred_seconds", memory_budget::deferred_ns.load() / 1.0e9);
+    if (known) {
+        xreport.xmlout("known_blocks_checked", known->blocks_checked.load());
+        xreport.xmlout("known_blocks_found", known->blocks_found.load());
+        delete known;
+        known = nullptr;
+    }
+    if (dedup) {
+        dedup->commit();                // the scanners are done with this run's blocks
+        xreport.xmlout("dedup_blocks_checked", dedup->blocks_checked);
+        xreport.xmlout("dedup_blocks_found", dedup->blocks_found);
+        xreport.xmlout("dedup_blocks_added", dedup->blocks_added);
+        xreport.xmlout("dedup_blocks_not_added", dedup->blocks_not_added);
+        xreport.xmlout("dedup_hit_rate", dedup->blocks_checked ? double(dedup->blocks_found) / dedup->blocks_checked : 0.0);
+        xreport.xmlout("dedup_store_blocks", dedup->size());
+        delete dedup;
+        dedup = nullptr;
+    }
     xreport.pop("runtime");
     dfxml_write_source();               // written here so it may also include hash
 }
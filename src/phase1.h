@@ -3,6 +3,11 @@
 
 #include <thread>
 #include <atomic>
+#include <chrono>
+#include <deque>
+#include <future>
+#include <map>
+#include <mutex>
 #include <ostream>
 
 #include "be20_api/scanner_set.h"
@@ -10,6 +15,17 @@
 #include "be20_api/dfxml_cpp/src/hash_t.h"
 
 #include "image_process.h"
+#include "async_reader.h"
+#include "block_hash_store.h"
+#include "block_sampler.h"
+#include "image_hasher.h"
+#include "known_blocks.h"
+#include "memory_budget.h"
+#include "page_checkpoint.h"
+#include "page_classifier.h"
+#include "page_tuner.h"
+#include "sbuf_scheduler.h"
+#include "scanner_watchdog.h"
 
 /**
  * bulk_extractor:
@@ -17,6 +33,7 @@
  * phase 1 - process every buffer with every scanner.
  *           BE1.0 - Each sbuf is loaded by the producer. Each worker runs all scanners.
  *           BE2.0 - Each sbuf is loaded by the producer. Each worker runs a single scanner.
+ *                   (-S scheduler=be2; see sbuf_scheduler.h)
  * phase 2 - histograms are made.
  *
  * This file implements Phase 1 - reads some or all of the sbufs and asks the scanner set to process them.
@@ -41,6 +58,7 @@ public:
     // because seen_page_ids are added in order, we want to use an unordered set.
     typedef std::unordered_set<std::string> seen_page_ids_t;
     static inline std::string REPORT_FILENAME {"report.xml"};
+    static inline std::string CHECKPOINT_FILENAME {"checkpoint.bin"};
     /* Configuration Control */
     struct Config {
         static const auto MiB = 1024*1024;
@@ -62,19 +80,45 @@ public:
         u_int     num_threads  { std::thread::hardware_concurrency() }; // default to # of cores; 0 for no threads
         double    sampling_fraction {1.0};       // for random sampling
         u_int     sampling_passes {1};
+        uint64_t  sampling_seed {0};             // the same seed samples the same blocks
+        std::string sampling_mode {"bernoulli"}; // or stratified; see block_sampler.h
         bool      opt_report_read_errors {true};
+        bool      opt_sequential_read {true};   // reuse the margin of the previous page instead of re-reading it
+        bool      opt_raw_mmap {false};         // map raw images into memory instead of reading them
+        bool      opt_direct_io {false};        // read raw images and devices around the page cache
+        uint32_t  opt_read_ahead_depth {0};     // pages to keep in flight; 0 reads synchronously in the main thread
+        uint32_t  opt_read_ahead_threads {4};   // reader threads if io_uring is not available and pread is threadsafe
+        std::string opt_image_hashes {"sha1"};  // digests of the image for the <source> block
+        bool      opt_skip_holes {false};       // do not read or scan holes in sparse images
+        bool      opt_skip_constant_pages {true}; // do not scan pages (and margins) that are a single repeated byte
+        std::string opt_known_blocks {};        // database of known-good blocks not to scan; empty to disable
+        uint32_t  opt_known_blocks_min_run {16}; // shortest run of known blocks left out of a page
+        std::string opt_dedup_db {};            // block hash store of blocks already scanned; empty to disable
+        uint64_t  opt_dedup_db_slots {block_hash_store::DEFAULT_SLOTS}; // size of a new store
+        std::string dedup_fingerprint {};       // the scanner configuration, so other configurations do not match
         bool      opt_recurse {false};  // -r flag
         void      set_sampling_parameters(std::string p);
         std::atomic<double>    *fraction_done {nullptr};
+        numa_topology          *numa {nullptr};         // --numa: nodes for the read-ahead queues and be2's workers
         bool      opt_legacy {false};
         bool      opt_notification {true}; // run notification thread
         bool      opt_notify_main_thread {false}; // display notificaitons in the main thread when phase1 is finished
         seen_page_ids_t seen_page_ids {};               // pages that were already seen
+        uint64_t  opt_memory_budget {0};        // MiB of memory for sbufs; 0 for no limit
+        bool      opt_auto_pagesize {false};    // tune the page size while running; see page_tuner.h
+        uint32_t  opt_auto_pagesize_pages {32}; // pages to measure before the first choice
+        uint32_t  opt_checkpoint_interval {0};  // seconds between restart checkpoints; 0 for none
+        std::string opt_scheduler {"be1"};      // be1: be20_api's workers; be2: a task per page and scanner
+        unsigned  opt_recurse_depth_workers {0}; // be2: workers for the recursive sbufs of a depth; 0 for all but one
+        uint32_t  opt_scanner_time_budget {0};  // seconds a scanner may spend on an sbuf; 0 for no limit
+        bool      opt_classify_pages {false};   // be2: do not run scanners on pages with no blocks their features can start in; lossy
+        std::filesystem::path checkpoint_fname {}; // next to report.xml
+        bool      restart_from_checkpoint {false}; // restarting, and the pages already seen are in the checkpoint
+        /* bytes per checkpoint bit: the smallest page size if it may change */
+        uint64_t  checkpoint_unit() const { return opt_auto_pagesize ? page_tuner::MIN_PAGESIZE : opt_pagesize; }
     };
 
-    typedef std::set<uint64_t> blocklist_t; // a list of blocks (for random sampling)
     static std::string minsec(time_t tsec);    // return "5 min 10 sec" string
-    static void make_sorted_random_blocklist(blocklist_t *blocklist,uint64_t max_blocks,float frac);
 
     /* These instance variables reference variables in main.cpp */
     Config        &config;              // phase1 config passed in. Writable so seen can be updated.
@@ -84,14 +128,99 @@ public:
 
     u_int         notify_ctr  {0};      // for random sampling
     uint64_t      total_bytes {0};      // processed
-    dfxml::sha1_generator *sha1g {nullptr};        // the SHA1 of the image. Set to 0 if a gap is encountered
-    uint64_t      hash_next {0};        // next byte to hash, to detect gaps
+    uint64_t      skipped_hole_bytes {0};     // holes in sparse images, never read
+    uint64_t      skipped_constant_bytes {0}; // read, but not scanned
+    uint64_t      skipped_duplicate_bytes {0}; // every block already scanned, in this image or an earlier one
+    block_hash_store *dedup {nullptr};  // if opt_dedup_db is set
+    uint64_t      skipped_known_bytes {0};    // known-good blocks, hashed but not scanned
+    known_blocks  *known {nullptr};     // if opt_known_blocks is set
+    struct masking_t {
+        sbuf_t    *sbuf;
+        std::future<std::vector<bool>> is_known; // of each block, from known_blocks::lookup()
+    };
+    std::deque<masking_t> masking {};   // pages whose blocks are being looked up, in order
+    uint64_t      skip_start {0};       // current run of skipped pages, written to report.xml when it ends
+    uint64_t      skip_len {0};
+    std::string   skip_reason {};
+    image_hasher  *hasher {nullptr};    // hashes the image on its own thread, if not sampling
     std::string   image_hash {};          // when hashed, the image hash
     dfxml_writer &xreport;              // we always write out the DFXML. Allows restart to be handled in phase1
     uint64_t      depth0_sleep {0};     // how many times did we sleep because we were too deep
+    uint64_t      memory_budget_waits {0}; // how many times did we wait because memory was over budget
+    async_reader  *reader {nullptr};    // read-ahead stage, if enabled
+    uint64_t      pages_scheduled {0};  // taken from the read-ahead stage
+    /* --skip_holes: holes waiting for the pages submitted before them to be scheduled, in order */
+    struct hole_t {
+        uint64_t  after {0};            // pages_scheduled once they have been
+        uint64_t  offset {0};
+        uint64_t  len {0};
+    };
+    std::deque<hole_t> holes {};
+    sbuf_scheduler *scheduler {nullptr}; // -S scheduler=be2 with threads
+    std::atomic<uint64_t> page_class_blocks[page_classifier::CLASSES] {}; // -S classify_pages: blocks of each class
+    page_checkpoint *checkpoint {nullptr}; // pages done, for restarting
+    std::chrono::steady_clock::time_point last_checkpoint {};
+    /* For the checkpoint: the pages the scanners have not finished, by offset. A page is done when the
+     * producer is done with it and every sbuf made of it (one, or the pieces left by mask_known) is scanned.
+     */
+    struct progress_t {
+        uint64_t  len {0};
+        uint64_t  pending {0};          // sbufs being scanned, and 1 while the producer has the page
+    };
+    std::map<uint64_t, progress_t> in_progress {};
+    std::mutex    progress_M {};        // the be2 workers finish pages
+    struct be1_page_t {
+        uint64_t  offset {0};
+        sbuf_t    *page {nullptr};      // kept until the workers are done with it
+        sbuf_t    *tracker {nullptr};   // on the page's buffer; the workers have a child of it
+    };
+    std::vector<be1_page_t> be1_pending {}; // sbufs given to be1's workers
+    std::vector<uint64_t> be1_scanned {}; // ... and scanned, but their recursive sbufs may not be
+    /* --auto_pagesize: what was seen since the page size was last chosen */
+    struct tuning_t {
+        std::chrono::steady_clock::time_point start {};
+        uint64_t  pages {0};            // read
+        uint64_t  total_bytes {0};      // total_bytes at start
+        uint64_t  in_flight {0};        // pages in the work queue at start
+        double    in_flight_sum {0};    // for the average of the pages in the work queue
+        uint64_t  choices {0};
+        uint64_t  next_pagesize {0};    // chosen, for the first page that starts at a multiple of it; 0 for none
+    } tuning {};
+    uint64_t      memory_base {0};      // memory in use before reading the image
+    void auto_pagesize(const image_process::iterator &it);       // choose the page size for the pages from it on
+    void start_tuning();
+    void resize_pages();                                          // to tuning.next_pagesize
 
     /* Get the sbuf from current image iterator location, with retries */
     sbuf_t *get_sbuf(image_process::iterator &it);
+    sbuf_t *get_sbuf(const pos0_t &pos0, const std::function<sbuf_t *()> &make,
+                     std::vector<std::string> *failures = nullptr); // in the read-ahead stage, with failures
+    void report_bad_alloc(const pos0_t &pos0, const std::string &what, u_int retry_count);
+    void hash_and_schedule(sbuf_t *sbufp);                        // hash the page and give it to the scanners
+    void schedule_masked(size_t keep);                            // ... once its blocks are looked up, keeping keep pages waiting
+    bool mask_known(sbuf_t *sbufp, const std::vector<bool> &is_known); // ... without its known-good blocks
+    void dedup_and_schedule(sbuf_t *sbufp);                       // ... unless it was all scanned before
+    void start_scheduler();                                       // -S scheduler=be2
+    void stop_scheduler();
+    void write_overruns(const std::vector<scanner_watchdog::overrun_t> &overruns); // -S scanner_time_budget
+    uint64_t pages_queued() const;                                // given to the workers and not yet scanned
+    unsigned worker_count() const;
+    void wait_for_workers();
+    void count_pages_in_flight();                                 // for the memory budget
+    void schedule_page(async_reader::page_t page);                // ... for a page from the read-ahead stage
+    void report_exception(const std::exception &e, const pos0_t &pos0);
+    bool skip_hole(const image_process::iterator &it);          // hash and skip the page if it is a hole
+    void holes_ready();                                           // ... once the pages before it are scheduled
+    bool already_seen(const image_process::iterator &it) const; // done before a restart
+    void mark_done(uint64_t offset, uint64_t len);                // for the checkpoint
+    void page_started(uint64_t offset, uint64_t len);             // ... the producer has the page
+    void sbuf_started(uint64_t offset);                           // ... an sbuf of the page at or before offset is scheduled
+    void sbuf_finished(uint64_t offset);                          // ... and scanned, or the producer is done with the page
+    void be1_finished();                                          // ... the be1 sbufs known to be scanned
+    void save_checkpoint();
+    void record_skip(uint64_t offset, uint64_t len, const std::string &reason);
+    void flush_skip();
+    static bool constant_buf(const uint8_t *buf, size_t len);     // every byte is the same
 
     Phase1(Config &config_, image_process &p_, scanner_set &ss_, std::ostream &cout_);
     void dfxml_write_create(int argc, char * const *argv); // create the DFXML header
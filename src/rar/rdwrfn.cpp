@@ -5,7 +5,7 @@ ComprDataIO::ComprDataIO() :
     UnpackToMemory(), UnpackToMemorySize(), UnpackToMemoryAddr(), UnpWrSize(),
     UnpWrAddr(), UnpPackedSize(), ShowProgress(), TestMode(), SkipUnpCRC(),
     SrcFile(), DestFile(), Command(), SubHead(), SubHeadPos(), LastPercent(),
-    CurrentCommand(), PackVolume(), UnpVolume(), NextVolumeMissing(),
+    CurrentCommand(), UnpCancel(), PackVolume(), UnpVolume(), NextVolumeMissing(),
     TotalPackRead(), UnpArcSize(), CurPackRead(), CurPackWrite(), CurUnpRead(),
     CurUnpWrite(), ProcessedArcSize(), TotalArcSize(), PackFileCRC(),
     UnpFileCRC(), PackedCRC(), Encryption(), Decryption()
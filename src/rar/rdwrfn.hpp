@@ -43,6 +43,8 @@ class ComprDataIO
 
     char CurrentCommand;
 
+    bool (*UnpCancel)();
+
   public:
     ComprDataIO();
     void Init();
@@ -58,6 +60,8 @@ class ComprDataIO
     void SetSubHeader(FileHeader *hd,int64 *Pos) {SubHead=hd;SubHeadPos=Pos;}
     void SetEncryption(int Method,const wchar *Password,const byte *Salt,bool Encrypt,bool HandsOffHash);
     void SetUnpackToMemory(byte *Addr,uint Size);
+    void SetUnpackCancel(bool (*Cancel)()) {UnpCancel=Cancel;}
+    bool UnpCancelled() {return UnpCancel!=NULL && UnpCancel();}
     //void SetUnpackFromMemory(byte *Addr, uint Size);
 	void SetCurrentCommand(char Cmd) {CurrentCommand=Cmd;}
 
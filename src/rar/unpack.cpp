@@ -751,6 +751,8 @@ void Unpack::UnpWriteData(byte *Data,size_t Size)
     WriteSize=(size_t)LeftToWrite;
   UnpIO->UnpWrite(Data,WriteSize);
   WrittenFileSize+=Size;
+  if (UnpIO->UnpCancelled())
+    Suspended=true;
 }
 
 
@@ -139,6 +139,8 @@ void Unpack::OldUnpWriteBuf()
 	//We need to study the 'WrPtr' variable to see where everything is being written
 	//We can pass it back to do some analysis
   WrPtr=UnpPtr;
+  if (UnpIO->UnpCancelled())
+    Suspended=true;
 }
 
 
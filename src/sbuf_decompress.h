@@ -12,11 +12,12 @@
 
 struct sbuf_decompress {
 
-    /* returns true if it is possible to decompress at offset.
+    /* returns true if it is possible to decompress at offset: the magic number, deflate,
+     * and none of the flags that RFC1952 reserves (zlib rejects a header with any of them).
      * inline for maximum speed
      */
     static bool is_gzip_header(const sbuf_t &sbuf, size_t offset) {
-        return sbuf[offset+0]==0x1f && sbuf[offset+1]==0x8b && sbuf[offset+2]==0x08;
+        return sbuf[offset+0]==0x1f && sbuf[offset+1]==0x8b && sbuf[offset+2]==0x08 && (sbuf[offset+3] & 0xe0)==0;
     }
 
     enum mode_t {
@@ -29,6 +30,7 @@ struct sbuf_decompress {
      * Returns nullptr if no decompression posssible.
      * @param sbuf - the data to decompress.
      * @param max_uncompr_size - a hint - how much data (max) should we decompress.
+     *        The caller holds a memory_budget::reservation for the bytes decoded while they are scanned.
      * @param name - what 'name' should go into the forensic path of the resulting sbuf.
      * @param header_size - how much header was *before* sbuf[0] (and should be subtracted from sbuf[0]'s forensic path when the sub-sbuf is created.
      *
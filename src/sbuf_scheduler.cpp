@@ -0,0 +1,380 @@
+/*
+ * sbuf_scheduler.cpp:
+ *
+ * Work-stealing scheduler of sbuf/scanner tasks. See sbuf_scheduler.h
+ */
+
+#include "config.h"
+
+#include <algorithm>
+#include <iostream>
+
+#include "memory_budget.h"
+#include "sbuf_scheduler.h"
+
+thread_local sbuf_scheduler *sbuf_scheduler::current {nullptr};
+thread_local sbuf_scheduler::page_t *sbuf_scheduler::current_page {nullptr};
+thread_local int sbuf_scheduler::current_node {-1};
+
+sbuf_scheduler::sbuf_scheduler(const std::vector<scanner_fn_t> &scanners_, unsigned workers_, bool per_scanner_,
+                               page_done_t page_done_, process_t process_, unsigned depth_workers_,
+                               gate_t gate_, whole_t whole_, numa_topology *numa_):
+    scanners(scanners_), per_scanner(per_scanner_),
+    depth_workers(depth_workers_ ? depth_workers_ : std::max(workers_, 2U) - 1),
+    scanner_stats(scanners_.size()), page_done(page_done_), process(process_), gate(gate_), whole(whole_),
+    numa(numa_), node_stats(numa_ ? numa_->size() : 0)
+{
+    for (unsigned i = 0; i < std::max(workers_, 1U); i++) {
+        workers.push_back(std::make_unique<worker_t>());
+    }
+    if (numa) {
+        const std::vector<size_t> where = numa->spread(workers.size());
+        node_workers.resize(numa->size());
+        node_next.resize(numa->size());
+        for (size_t i = 0; i < workers.size(); i++) {
+            workers[i]->node = static_cast<int>(where[i]);
+            node_workers[where[i]].push_back(i);
+        }
+    }
+    for (size_t i = 0; i < workers.size(); i++) {
+        workers[i]->thread = std::thread(&sbuf_scheduler::run_worker, this, i);
+    }
+    if (numa) {
+        /* so that the workers are in numa->nodes[].workers before anyone reads them */
+        std::unique_lock<std::mutex> lock(M);
+        cv_done.wait(lock, [this] { return started == workers.size(); });
+    }
+}
+
+sbuf_scheduler::~sbuf_scheduler()
+{
+    join();
+}
+
+/* The producer's next worker to deal a task to: in turn among the workers of the node, if it has any */
+size_t sbuf_scheduler::deal(int node)
+{
+    if (node < 0) {
+        const size_t w = next_worker;
+        next_worker = (next_worker + 1) % workers.size();
+        return w;
+    }
+    const std::vector<size_t> &on = node_workers[node];
+    const size_t w = on[node_next[node]];
+    node_next[node] = (node_next[node] + 1) % on.size();
+    return w;
+}
+
+void sbuf_scheduler::submit(sbuf_t *sbuf, int node)
+{
+    page_t *page = new page_t;
+    page->sbuf = sbuf;
+    page->submitted = std::chrono::steady_clock::now();
+    if (numa && node >= 0 && static_cast<size_t>(node) < node_workers.size() && !node_workers[node].empty()) {
+        page->node = node;
+    }
+    const size_t ntasks = per_scanner ? scanners.size() : 1;
+    if (ntasks == 0) {
+        delete sbuf;
+        delete page;
+        return;
+    }
+    page->tasks_left = ntasks;
+    pages += 1;
+    queued += ntasks;
+    if (page->node >= 0) node_stats[page->node].pages += 1;
+    for (size_t i = 0; i < ntasks; i++) {
+        worker_t &w = *workers[deal(page->node)];
+        const std::lock_guard<std::mutex> lock(w.M);
+        w.tasks.push_back(task_t{page, per_scanner ? i : ALL_SCANNERS});
+    }
+    const std::lock_guard<std::mutex> lock(M);
+    cv_work.notify_all();
+}
+
+void sbuf_scheduler::recurse(const scanner_params &sp, sbuf_t *sbuf)
+{
+    if (!offer(sbuf)) {
+        sp.recurse(sbuf);
+    }
+}
+
+bool sbuf_scheduler::offer(sbuf_t *sbuf)
+{
+    if (current == nullptr || current_page == nullptr || !current->process) return false;
+    current->submit_child(sbuf);
+    return true;
+}
+
+/* Called by a task of current_page, which therefore can't finish meanwhile */
+void sbuf_scheduler::submit_child(sbuf_t *sbuf)
+{
+    task_t task {current_page, ALL_SCANNERS, sbuf, static_cast<unsigned>(sbuf->depth()), std::chrono::steady_clock::now()};
+    {
+        const std::lock_guard<std::mutex> lock(M);
+        depth_t &d = depths[task.depth];
+        d.stats.tasks += 1;
+        if (d.tasks.size() < QUEUE_PER_DEPTH_WORKER * depth_workers && memory_budget::available(sbuf->bufsize)) {
+            task.page->tasks_left += 1;
+            d.tasks.push_back(task);
+            d.bytes += sbuf->bufsize;
+            memory_budget::hold(sbuf->bufsize);
+            d.stats.max_queued = std::max(d.stats.max_queued, d.tasks.size());
+            d.stats.max_queued_bytes = std::max(d.stats.max_queued_bytes, d.bytes);
+            children_queued += 1;
+            cv_work.notify_one();
+            return;
+        }
+        d.stats.inlined += 1;
+    }
+    /* too many waiting, or no room for it: scan it now, as be1 does */
+    const auto start = std::chrono::steady_clock::now();
+    process(sbuf);
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    const std::lock_guard<std::mutex> lock(M);
+    depths[task.depth].stats.seconds += seconds;
+}
+
+bool sbuf_scheduler::child_runnable() const
+{
+    for (const auto &it : depths) {
+        if (!it.second.tasks.empty() && it.second.running < depth_workers) return true;
+    }
+    return false;
+}
+
+/* The oldest recursive task of the deepest depth that may have another worker */
+bool sbuf_scheduler::get_child(task_t &task)
+{
+    if (children_queued == 0) return false;
+    const std::lock_guard<std::mutex> lock(M);
+    for (auto it = depths.rbegin(); it != depths.rend(); ++it) {
+        depth_t &d = it->second;
+        if (d.tasks.empty() || d.running >= depth_workers) continue;
+        task = d.tasks.front();
+        d.tasks.pop_front();
+        d.bytes -= task.child->bufsize;
+        children_queued -= 1;
+        d.running += 1;
+        d.stats.max_running = std::max(d.stats.max_running, d.running);
+        const double waited = std::chrono::duration<double>(std::chrono::steady_clock::now() - task.queued).count();
+        d.stats.max_wait_seconds = std::max(d.stats.max_wait_seconds, waited);
+        return true;
+    }
+    return false;
+}
+
+/* Our newest task, or else the oldest task of another worker, of our node first */
+bool sbuf_scheduler::get_task(size_t self, task_t &task)
+{
+    {
+        worker_t &w = *workers[self];
+        const std::lock_guard<std::mutex> lock(w.M);
+        if (!w.tasks.empty()) {
+            task = w.tasks.back();
+            w.tasks.pop_back();
+            queued -= 1;
+            return true;
+        }
+    }
+    const int passes = numa ? 2 : 1;
+    for (int pass = 0; pass < passes; pass++) {
+        for (size_t i = 1; i < workers.size(); i++) {
+            worker_t &victim = *workers[(self + i) % workers.size()];
+            if (numa && (victim.node == workers[self]->node) != (pass == 0)) continue;
+            const std::lock_guard<std::mutex> lock(victim.M);
+            if (!victim.tasks.empty()) {
+                task = victim.tasks.front();
+                victim.tasks.pop_front();
+                queued -= 1;
+                stolen += 1;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void sbuf_scheduler::run_scanner(size_t scanner, const sbuf_t &sbuf)
+{
+    const auto start = std::chrono::steady_clock::now();
+    try {
+        scanners[scanner].scan(sbuf);
+    }
+    catch (const std::exception &e) {
+        scanner_error(scanners[scanner].name, sbuf.pos0.str(), e.what());
+    }
+    catch (...) {
+        scanner_error(scanners[scanner].name, sbuf.pos0.str(), "unknown exception");
+    }
+    scanner_stats[scanner].calls += 1;
+    scanner_stats[scanner].ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+void sbuf_scheduler::scanner_error(const std::string &scanner, const std::string &pos0, const std::string &what)
+{
+    std::cerr << (scanner.empty() ? "recursive sbuf" : "scanner " + scanner) << " at " << pos0 << ": " << what << std::endl;
+    errors += 1;
+    const std::lock_guard<std::mutex> lock(M);
+    error_list.push_back(error_t{scanner, pos0, what});
+}
+
+/* Run by the first task of the page, which is current_page, so that the page outlives what process recurses into */
+void sbuf_scheduler::gate_page(page_t *page)
+{
+    if (whole && process && whole(*page->sbuf)) {
+        page->run.assign(scanners.size(), false);
+        wholes += 1;
+        const std::string pos0 = page->sbuf->pos0.str();
+        try {
+            process(new sbuf_t(*page->sbuf, 0, page->sbuf->bufsize)); // a child, which process deletes
+        }
+        catch (const std::exception &e) {
+            scanner_error("", pos0, e.what());
+        }
+        catch (...) {
+            scanner_error("", pos0, "unknown exception");
+        }
+        return;
+    }
+    if (gate) page->run = gate(*page->sbuf);
+}
+
+/* Whether the gate leaves the scanner out of the page; the first task of the page asks it */
+bool sbuf_scheduler::gated_out(page_t *page, size_t scanner)
+{
+    if (!gate && !whole) return false;
+    std::call_once(page->gated, [this, page] { gate_page(page); });
+    if (scanner >= page->run.size() || page->run[scanner]) return false;
+    scanner_stats[scanner].skipped += 1;
+    return true;
+}
+
+void sbuf_scheduler::run_child(const task_t &task)
+{
+    const auto start = std::chrono::steady_clock::now();
+    const uint64_t bytes = task.child->bufsize;  // held from submit_child() until it is scanned and deleted
+    const std::string pos0 = task.child->pos0.str(); // process deletes the sbuf, even if it throws
+    try {
+        process(task.child);
+    }
+    catch (const std::exception &e) {
+        scanner_error("", pos0, e.what());
+    }
+    catch (...) {
+        scanner_error("", pos0, "unknown exception");
+    }
+    memory_budget::release(bytes);
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    const std::lock_guard<std::mutex> lock(M);
+    depth_t &d = depths[task.depth];
+    d.running -= 1;
+    d.stats.seconds += seconds;
+    if (!d.tasks.empty()) cv_work.notify_one();
+}
+
+void sbuf_scheduler::run_task(const task_t &task)
+{
+    page_t *page = task.page;
+    current_page = page;
+    if (current_node >= 0 && !task.child) {
+        node_stats_t &st = node_stats[current_node];
+        (page->node == current_node ? st.tasks_local : st.tasks_remote) += 1;
+    }
+    if (task.child) {
+        run_child(task);
+    } else if (task.scanner == ALL_SCANNERS) {
+        for (size_t i = 0; i < scanners.size(); i++) {
+            if (!gated_out(page, i)) run_scanner(i, *page->sbuf);
+        }
+    } else if (!gated_out(page, task.scanner)) {
+        run_scanner(task.scanner, *page->sbuf);
+    }
+    current_page = nullptr;
+    tasks += 1;
+    page_task_done(page);
+}
+
+void sbuf_scheduler::page_task_done(page_t *page)
+{
+    if (--page->tasks_left > 0) return;
+
+    /* the last task of the page */
+    if (page_done) page_done(*page->sbuf);
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - page->submitted).count();
+    delete page->sbuf;
+    delete page;
+    const std::lock_guard<std::mutex> lock(M);
+    latencies.push_back(seconds);
+    pages -= 1;
+    cv_done.notify_all();
+}
+
+void sbuf_scheduler::run_worker(size_t self)
+{
+    current = this;
+    if (numa) {
+        current_node = workers[self]->node;
+        const pid_t tid = numa_topology::current_tid();
+        const bool pinned = numa->pin_current_thread(current_node);
+        const std::lock_guard<std::mutex> lock(M);
+        if (pinned) numa->nodes[current_node].workers.push_back(tid);
+        started += 1;
+        cv_done.notify_all();
+    }
+    while (true) {
+        task_t task;
+        if (get_child(task) || get_task(self, task)) {
+            run_task(task);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(M);
+        if (stopping && queued == 0) return;
+        cv_work.wait(lock, [this] { return queued > 0 || child_runnable() || stopping; });
+    }
+}
+
+void sbuf_scheduler::wait()
+{
+    std::unique_lock<std::mutex> lock(M);
+    cv_done.wait_for(lock, std::chrono::milliseconds(100));
+}
+
+void sbuf_scheduler::join()
+{
+    {
+        std::unique_lock<std::mutex> lock(M);
+        cv_done.wait(lock, [this] { return pages == 0; });
+        stopping = true;
+        cv_work.notify_all();
+    }
+    for (auto &w : workers) {
+        if (w->thread.joinable()) w->thread.join();
+    }
+}
+
+double sbuf_scheduler::page_seconds(double quantile) const
+{
+    const std::lock_guard<std::mutex> lock(M);
+    if (latencies.empty()) return 0;
+    std::vector<double> sorted(latencies);
+    const size_t n = std::min(sorted.size() - 1, static_cast<size_t>(quantile * sorted.size()));
+    std::nth_element(sorted.begin(), sorted.begin() + n, sorted.end());
+    return sorted[n];
+}
+
+std::vector<sbuf_scheduler::error_t> sbuf_scheduler::errors_seen() const
+{
+    const std::lock_guard<std::mutex> lock(M);
+    return error_list;
+}
+
+std::map<unsigned, sbuf_scheduler::depth_stats_t> sbuf_scheduler::depth_stats() const
+{
+    const std::lock_guard<std::mutex> lock(M);
+    std::map<unsigned, depth_stats_t> ret;
+    for (const auto &it : depths) {
+        ret[it.first] = it.second.stats;
+    }
+    return ret;
+}
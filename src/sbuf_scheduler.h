@@ -0,0 +1,215 @@
+/*
+ * sbuf_scheduler.h:
+ *
+ * The BE2.0 mechanism for Phase 1 (-S scheduler=be2): a work unit for each sbuf/scanner combination.
+ *
+ * With be1, a be20_api worker takes a page and runs every scanner over it in turn, so one slow
+ * scanner holds the page, and the worker, for as long as all of the scanners together take.
+ * Here each page becomes a task for each enabled scanner. The tasks hold a reference to the page's
+ * sbuf, and the last of them to finish deletes it.
+ *
+ * Each worker has a deque of tasks. The tasks of a page are dealt to the workers in turn. A worker
+ * takes tasks from the back of its own deque, and a worker with none steals from the front of the
+ * others', where the oldest pages are, so pages finish in about the order they were read.
+ *
+ * Recursive sbufs (decompressed data and the like) that a scanner gives to sbuf_scheduler::recurse()
+ * become tasks of their own, tagged with their depth, rather than being scanned then and there by the
+ * worker that found them; so one page of nested archives is spread over the workers. A recursive task
+ * runs scanner_set::schedule_sbuf(), which scans the sbuf with every scanner and deletes it; the
+ * checks of max_depth and of sbufs seen before are be20_api's. Recursive tasks are run before pages,
+ * the deepest first, and no more than depth_workers workers run the tasks of any one depth at a time.
+ * Once a depth has 4 tasks waiting for each of those workers, or the memory budget has no room for
+ * another sbuf (see memory_budget.h), more sbufs of that depth are scanned then and there, as before,
+ * to bound the memory they hold. The bytes of the queued sbufs count against the budget until scanned. The page a recursive sbuf came from is
+ * not done until the sbuf is. Scanners that call scanner_params::recurse() instead, or anything when
+ * run outside of the scheduler, recurse in the same thread as before.
+ *
+ * A scanner that throws is reported and counted, as scanner_set::process_sbuf() does for be1; the
+ * page's other scanners still run. Phase 1 writes the exceptions and the time of each scanner to
+ * report.xml.
+ *
+ * With per_scanner false each page is a single task that runs every scanner, as be1 does; the
+ * benchmark in test_be3.cpp compares the two.
+ *
+ * With a gate_t, the first task of a page to run asks it which scanners to run on the page (Phase 1
+ * classifies the page's blocks with -S classify_pages; see page_classifier.h), and the tasks of the
+ * scanners it leaves out do nothing. Recursive sbufs are not gated.
+ *
+ * With a whole_t, that first task asks it first whether the page should instead go whole to the
+ * process_t, and if so gives it a view of the page and the page's other tasks do nothing. Phase 1 sends
+ * pages of a repeating n-gram this way, so that scanner_set::process_sbuf() runs on them only the
+ * scanners that it runs on such pages for be1.
+ *
+ * With a numa_topology (--numa), the workers are pinned to the nodes in proportion to their CPUs, and
+ * the tasks of a page submitted with the node that holds its memory are dealt to that node's workers
+ * only. Workers steal from the workers of their own node first. numa_stats() counts the tasks each
+ * node's workers ran on pages of their node and of others.
+ */
+
+#ifndef SBUF_SCHEDULER_H
+#define SBUF_SCHEDULER_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "be20_api/sbuf.h"
+#include "be20_api/scanner_params.h"
+
+#include "numa_topology.h"
+
+class sbuf_scheduler {
+    sbuf_scheduler(const sbuf_scheduler &that) = delete;
+    sbuf_scheduler &operator=(const sbuf_scheduler &that) = delete;
+
+public:
+    struct scanner_fn_t {
+        std::string name {};
+        std::function<void(const sbuf_t &)> scan {};
+    };
+    typedef std::function<void(const sbuf_t &)> page_done_t; // called by the last task of a page
+    typedef std::function<void(sbuf_t *)> process_t;           // scans a recursive sbuf and deletes it
+    typedef std::function<std::vector<bool>(const sbuf_t &)> gate_t; // the scanners to run on a page
+    typedef std::function<bool(const sbuf_t &)> whole_t;   // whether to give the page to process_t instead
+
+    /* depth_workers 0 is one fewer than the workers, so that one is always free for pages */
+    sbuf_scheduler(const std::vector<scanner_fn_t> &scanners_, unsigned workers_, bool per_scanner_ = true,
+                   page_done_t page_done_ = nullptr, process_t process_ = nullptr, unsigned depth_workers_ = 0,
+                   gate_t gate_ = nullptr, whole_t whole_ = nullptr, numa_topology *numa_ = nullptr);
+    ~sbuf_scheduler();
+
+    void     submit(sbuf_t *sbuf, int node = -1); // takes ownership of the sbuf; node: index of its memory's node, or -1
+    /* From a scanner: a task for the recursive sbuf if running in a scheduler with a process_t, or else sp.recurse() */
+    static void recurse(const scanner_params &sp, sbuf_t *sbuf);
+    /* The same, without the fallback: returns false, keeping the sbuf, if not running in such a scheduler */
+    static bool offer(sbuf_t *sbuf);
+    size_t   pages_in_flight() const { return pages; }
+    unsigned worker_count() const { return workers.size(); }
+    void     wait();                    // until a page finishes, or a while
+    void     join();                    // until every page is done; stops the workers
+
+    /* statistics, once joined */
+    uint64_t tasks_run() const { return tasks; }
+    uint64_t steals() const { return stolen; }
+    uint64_t pages_whole() const { return wholes; }  // given to process_t by the whole_t
+    uint64_t scanner_errors() const { return errors; }
+    struct error_t {
+        std::string scanner {};         // empty for a recursive sbuf
+        std::string pos0 {};
+        std::string what {};
+    };
+    std::vector<error_t> errors_seen() const;   // the exceptions that the scanners threw, for report.xml
+    double   page_seconds(double quantile) const; // time from submit() until the page was done
+    uint64_t pages_done() const { return latencies.size(); }
+    struct scanner_stats_t {
+        std::atomic<uint64_t> calls {0};
+        std::atomic<uint64_t> ns {0};
+        std::atomic<uint64_t> skipped {0};      // pages the gate left out, or sent whole to process_t
+    };
+    struct depth_stats_t {
+        uint64_t tasks {0};             // recursive sbufs of the depth
+        uint64_t inlined {0};           // of those, scanned by the worker that found them
+        size_t   max_queued {0};
+        uint64_t max_queued_bytes {0};
+        unsigned max_running {0};
+        double   seconds {0};           // scanning them
+        double   max_wait_seconds {0};  // in the queue
+    };
+    std::map<unsigned, depth_stats_t> depth_stats() const;
+    struct node_stats_t {
+        std::atomic<uint64_t> pages {0};        // submitted with the node, and dealt to its workers
+        std::atomic<uint64_t> tasks_local {0};  // run by the node's workers on pages of the node
+        std::atomic<uint64_t> tasks_remote {0}; // on pages of another node, or of none known
+    };
+    const node_stats_t &numa_stats(size_t node) const { return node_stats[node]; }
+    const std::vector<scanner_fn_t> scanners;
+    const bool per_scanner;
+    const unsigned depth_workers;       // at most this many run the tasks of a depth at a time
+    static const unsigned QUEUE_PER_DEPTH_WORKER = 4;
+
+    const scanner_stats_t &stats(size_t scanner) const { return scanner_stats[scanner]; }
+
+private:
+    static const size_t ALL_SCANNERS = SIZE_MAX;
+    struct page_t {
+        sbuf_t              *sbuf {nullptr};
+        std::atomic<size_t> tasks_left {0};
+        std::chrono::steady_clock::time_point submitted {};
+        std::once_flag      gated {};
+        std::vector<bool>   run {};             // from the gate; empty for every scanner
+        int                 node {-1};          // whose workers it was dealt to
+    };
+    struct task_t {
+        page_t *page {nullptr};
+        size_t scanner {ALL_SCANNERS};
+        sbuf_t *child {nullptr};        // a recursive sbuf of the page, scanned with process
+        unsigned depth {0};
+        std::chrono::steady_clock::time_point queued {};
+    };
+    struct depth_t {
+        std::deque<task_t> tasks {};
+        uint64_t bytes {0};             // of the queued sbufs
+        unsigned running {0};
+        depth_stats_t stats {};
+    };
+    struct worker_t {
+        std::mutex          M {};
+        std::deque<task_t>  tasks {};
+        std::thread         thread {};
+        int                 node {-1};          // pinned to, with a numa_topology
+    };
+    std::vector<std::unique_ptr<worker_t>> workers {};
+    std::vector<scanner_stats_t> scanner_stats;
+    page_done_t             page_done;
+    process_t               process;
+    gate_t                  gate;
+    whole_t                 whole;
+    size_t                  next_worker {0};        // the producer's next worker to deal to
+    numa_topology           *numa;
+    std::vector<std::vector<size_t>> node_workers {};  // the workers of each node
+    std::vector<size_t>     node_next {};           // the producer's next worker of each node
+    std::vector<node_stats_t> node_stats;
+    size_t                  started {0};            // workers that have pinned themselves, under M
+
+    mutable std::mutex      M {};
+    std::condition_variable cv_work {};
+    std::condition_variable cv_done {};
+    std::atomic<size_t>     queued {0};             // tasks in the deques
+    std::atomic<size_t>     pages {0};              // submitted and not done
+    bool                    stopping {false};
+    std::atomic<uint64_t>   tasks {0};
+    std::atomic<uint64_t>   stolen {0};
+    std::atomic<uint64_t>   wholes {0};
+    std::atomic<uint64_t>   errors {0};
+    std::vector<double>     latencies {};           // seconds for each page, under M
+    std::vector<error_t>    error_list {};          // under M
+    std::map<unsigned, depth_t> depths {};          // recursive tasks by depth, under M
+    std::atomic<size_t>     children_queued {0};
+
+    static thread_local sbuf_scheduler *current;    // the scheduler of this worker thread
+    static thread_local page_t *current_page;       // the page of the task it is running
+    static thread_local int current_node;           // the node it is pinned to, or -1
+    size_t deal(int node);
+    bool child_runnable() const;                    // under M
+    bool get_child(task_t &task);
+    bool get_task(size_t self, task_t &task);
+    void submit_child(sbuf_t *sbuf);
+    void run_child(const task_t &task);
+    void run_task(const task_t &task);
+    void page_task_done(page_t *page);
+    void run_scanner(size_t scanner, const sbuf_t &sbuf);
+    void scanner_error(const std::string &scanner, const std::string &pos0, const std::string &what);
+    void gate_page(page_t *page);
+    bool gated_out(page_t *page, size_t scanner);
+    void run_worker(size_t self);
+};
+
+#endif
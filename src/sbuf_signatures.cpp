@@ -0,0 +1,152 @@
+/*
+ * sbuf_signatures.cpp:
+ *
+ * One pass over an sbuf for the magic numbers of the carvers. See sbuf_signatures.h
+ */
+
+#include "config.h"
+
+#include <algorithm>
+#include <string>
+
+#include "sbuf_signatures.h"
+
+namespace {
+struct signature_def_t {
+    const char *name;
+    std::vector<uint8_t> bytes;
+    std::vector<uint8_t> mask;          // of the bytes that must match; 0xff if empty
+};
+
+const signature_def_t defs[sbuf_signatures::SIGNATURES] = {
+    {"zip",       {0x50, 0x4b, 0x03, 0x04}, {}},
+    {"gzip",      {0x1f, 0x8b, 0x08}, {}},
+    {"elf",       {0x7f, 'E', 'L', 'F'}, {}},
+    {"jpeg",      {0xff, 0xd8, 0xff, 0xe0}, {0xff, 0xff, 0xff, 0xf0}},
+    {"psd",       {'8', 'B', 'P', 'S', 0x00, 0x01}, {}},
+    {"tiff_ii",   {'I', 'I', 42, 0}, {}},
+    {"tiff_mm",   {'M', 'M', 0, 42}, {}},
+    {"winlnk",    {0x4c, 0x00, 0x00, 0x00, 0x01, 0x14, 0x02, 0x00, 0x00, 0x00,
+                   0x00, 0x00, 0xc0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x46}, {}},
+    {"sqlite",    {'S', 'Q', 'L', 'i', 't', 'e', ' ', 'f', 'o', 'r', 'm', 'a', 't', ' ', '3'}, {}},
+    {"hiberfile", {0x81, 0x81, 0x78, 0x70, 0x72, 0x65, 0x73, 0x73}, {}},
+};
+const size_t PREFIX = 3;                // bytes of each signature in the tables; no signature is shorter
+
+uint8_t mask_at(const signature_def_t &def, size_t i)
+{
+    return def.mask.empty() ? 0xff : def.mask[i];
+}
+
+/* For each of the first PREFIX bytes, the signatures that may have each byte value there */
+struct filter_t {
+    uint16_t table[PREFIX][256] {};
+    filter_t() {
+        static_assert(sbuf_signatures::SIGNATURES <= 16, "a signature mask is 16 bits");
+        for (size_t s = 0; s < sbuf_signatures::SIGNATURES; s++) {
+            for (size_t k = 0; k < PREFIX; k++) {
+                for (unsigned c = 0; c < 256; c++) {
+                    if ((c & mask_at(defs[s], k)) == defs[s].bytes[k]) table[k][c] |= 1U << s;
+                }
+            }
+        }
+    }
+};
+const filter_t filter {};
+
+bool matches(const signature_def_t &def, const uint8_t *buf, size_t pos, size_t len)
+{
+    if (def.bytes.size() > len - pos) return false;
+    for (size_t i = 0; i < def.bytes.size(); i++) {
+        if ((buf[pos + i] & mask_at(def, i)) != def.bytes[i]) return false;
+    }
+    return true;
+}
+
+const size_t STRIDE = 32;
+
+void check(const uint8_t *buf, size_t len, size_t start, size_t end, sbuf_signatures::hits_t &hits)
+{
+    for (size_t pos = start; pos < end; pos++) {
+        uint32_t m = filter.table[0][buf[pos]] & filter.table[1][buf[pos + 1]] & filter.table[2][buf[pos + 2]];
+        while (m) {
+            const size_t s = __builtin_ctz(m);
+            m &= m - 1;
+            if (matches(defs[s], buf, pos, len)) hits.offsets[s].push_back(pos);
+        }
+    }
+}
+
+/* The sbufs of the last few find()s in this thread, so that a page's scanners still share a pass
+ * when one of them recurses in between. pos0 tells apart sbufs at the same address.
+ */
+struct last_t {
+    const sbuf_t   *sbuf {nullptr};
+    const uint8_t  *buf {nullptr};
+    size_t         bufsize {0};
+    std::string    pos0 {};
+    std::shared_ptr<const sbuf_signatures::hits_t> hits {};
+};
+const size_t CACHED = 4;
+thread_local last_t last[CACHED] {};
+thread_local size_t last_next {0};      // the entry to replace
+}
+
+sbuf_signatures::hits_t sbuf_signatures::scan(const uint8_t *buf, size_t len)
+{
+    hits_t hits;
+    if (len < PREFIX) return hits;
+    const uint16_t *t0 = filter.table[0], *t1 = filter.table[1], *t2 = filter.table[2];
+    const size_t end = len - PREFIX + 1;        // of the offsets to look at
+    /* STRIDE offsets at a time with no branch, then each of them if any may match */
+    size_t start = 0;
+    for (; start + STRIDE <= end; start += STRIDE) {
+        uint32_t any = 0;
+        for (size_t pos = start; pos < start + STRIDE; pos++) {
+            any |= t0[buf[pos]] & t1[buf[pos + 1]] & t2[buf[pos + 2]];
+        }
+        if (any) check(buf, len, start, start + STRIDE, hits);
+    }
+    check(buf, len, start, end, hits);
+    return hits;
+}
+
+std::shared_ptr<const sbuf_signatures::hits_t> sbuf_signatures::find(const sbuf_t &sbuf)
+{
+    const uint8_t *buf = sbuf.get_buf();
+    const std::string pos0 = sbuf.pos0.str();
+    for (const auto &it : last) {
+        if (it.hits && it.sbuf == &sbuf && it.buf == buf && it.bufsize == sbuf.bufsize && it.pos0 == pos0) {
+            return it.hits;
+        }
+    }
+    passes += 1;
+    last_t &it = last[last_next];
+    last_next = (last_next + 1) % CACHED;
+    it.hits = std::make_shared<const hits_t>(scan(buf, sbuf.bufsize));
+    it.sbuf = &sbuf;
+    it.buf = buf;
+    it.bufsize = sbuf.bufsize;
+    it.pos0 = pos0;
+    return it.hits;
+}
+
+size_t sbuf_signatures::hits_t::next(signature_t sig, size_t pos) const
+{
+    const auto it = std::lower_bound(offsets[sig].begin(), offsets[sig].end(), pos);
+    return it == offsets[sig].end() ? NONE : *it;
+}
+
+size_t sbuf_signatures::hits_t::next(std::initializer_list<signature_t> sigs, size_t pos) const
+{
+    size_t ret = NONE;
+    for (const auto sig : sigs) {
+        ret = std::min(ret, next(sig, pos));
+    }
+    return ret;
+}
+
+const char *sbuf_signatures::name(signature_t sig)
+{
+    return sig < SIGNATURES ? defs[sig].name : "unknown";
+}
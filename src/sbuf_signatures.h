@@ -0,0 +1,63 @@
+/*
+ * sbuf_signatures.h:
+ *
+ * The offsets of the magic numbers of the carvers in an sbuf, found in one pass over it.
+ *
+ * scan_zip, scan_gzip, scan_elf, scan_exif, scan_winlnk, scan_sqlite and scan_hiberfile each used
+ * to walk every byte of every sbuf looking for their own magic numbers. Now the first of them to
+ * scan an sbuf in a thread finds all of the magic numbers at once, and the others, scanning the same
+ * sbuf in the same thread (as be1 does), get the same offsets. Each then goes from one offset of its
+ * magic number to the next. With -S scheduler=be2 the scanners of a page may run in different
+ * threads, and each of those threads makes a pass of its own.
+ *
+ * The pass is a filter in the style of Teddy: a table for each of the first three bytes of a signature
+ * says which signatures may have that byte there, and the three looked-up masks are ANDed. The rare
+ * offsets where the AND is not zero are checked against the whole signature. It is portable code,
+ * with no branch taken on most bytes; see the benchmark in test_be3.cpp.
+ */
+
+#ifndef SBUF_SIGNATURES_H
+#define SBUF_SIGNATURES_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <memory>
+#include <vector>
+
+#include "be20_api/sbuf.h"
+
+class sbuf_signatures {
+public:
+    enum signature_t {
+        ZIP,                            // PK\3\4, a ZIP local file header
+        GZIP,                           // 1f 8b 08
+        ELF,                            // \x7fELF
+        JPEG,                           // ff d8 ff e0..ef
+        PSD,                            // 8BPS\0\1
+        TIFF_II,                        // II*\0
+        TIFF_MM,                        // MM\0*
+        WINLNK,                         // the header size and LinkCLSID of a Shell Link
+        SQLITE,                         // SQLite format 3
+        HIBERFILE,                      // \x81\x81xpress
+        SIGNATURES
+    };
+    static const size_t NONE = SIZE_MAX;
+
+    struct hits_t {
+        std::vector<size_t> offsets[SIGNATURES]; // of each signature, in order, each wholly in the sbuf
+        /* The first offset at or after pos of the signature, or of any of them; NONE if there is none */
+        size_t next(signature_t sig, size_t pos) const;
+        size_t next(std::initializer_list<signature_t> sigs, size_t pos) const;
+    };
+
+    /* The signatures in the sbuf. Those of the last few sbufs are kept for each thread, for the next scanner. */
+    static std::shared_ptr<const hits_t> find(const sbuf_t &sbuf);
+    static hits_t scan(const uint8_t *buf, size_t len);       // uncached
+    static const char *name(signature_t sig);
+
+    static inline std::atomic<uint64_t> passes {0};           // over sbufs, for the tests
+};
+
+#endif
@@ -28,6 +28,7 @@
 
 
 #include "config.h"
+#include <algorithm>
 #include <string>
 #include <string.h>
 #include <inttypes.h>
@@ -35,6 +36,8 @@
 #include "be20_api/scanner_params.h"
 #include "be20_api/scanner_set.h"
 
+#include "page_classifier.h"
+
 /* old aes.h file */
 
 const size_t AES128_KEY_SIZE  =               16; //  Size of a 128-bit AES key, in bytes
@@ -435,41 +438,20 @@ void scan_aes(struct scanner_params &sp)
         const size_t end   = sp.sbuf->pagesize - AES128_KEY_SCHEDULE_SIZE;
         const uint8_t *buf = sp.sbuf->get_buf();
 
-#define USE_ROLLING_WINDOW
-#ifdef USE_ROLLING_WINDOW
-        /* Simple mod: Keep a rolling window of the entropy and don't
-         * we see fewer than 10 distinct characters in window. This will
-         * eliminate checks on many kinds of bulk data that simply can't have a key
-         * in the block. This could be moved to a C++ class...
+        /* Skip the blocks in which no key schedule can start: zeros and text.
+         * See page_classifier.h. Of the margin, only the first block matters.
          */
-        uint32_t counts[256];
-        memset(counts,0,sizeof(counts));
-        int32_t distinct_counts = 0;    // how many distinct counts do we have?
-
-        /* Initialize the sliding window */
-        for (size_t pos = 0; pos < AES128_KEY_SCHEDULE_SIZE ; pos++) {
-            const unsigned char val = buf[pos];
-            counts[val]++;
-            if (counts[val] == 1) {
-                distinct_counts++;
-            }
-        }
-#endif
+        const page_classifier::map_t map =
+            page_classifier::classify(buf, std::min(sp.sbuf->bufsize, sp.sbuf->pagesize + page_classifier::BLOCK_SIZE));
+        const uint8_t interest = page_classifier::interest("aes");
 
 	for (size_t pos = 0 ; pos < end; pos++){
-            const uint8_t *p2 = buf + pos;
-
-#ifdef USE_ROLLING_WINDOW
-            /* add value at end of 128 bits to sliding window */
-            {
-                const unsigned char val = buf[pos+AES128_KEY_SCHEDULE_SIZE];
-                counts[val]++;
-                if(counts[val]==1) {            // we have one more distinct count
-                    distinct_counts++;
-                }
-                if (distinct_counts < 11) continue;
+            if (pos % page_classifier::BLOCK_SIZE == 0
+                && !page_classifier::may_start_in(map, pos / page_classifier::BLOCK_SIZE, interest)) {
+                pos += page_classifier::BLOCK_SIZE - 1;
+                continue;
             }
-#endif
+            const uint8_t *p2 = buf + pos;
 
 	    if (scan_aes_128
                 && (sp.sbuf->bufsize - pos >= AES128_KEY_SCHEDULE_SIZE)
@@ -11,6 +11,7 @@
 
 #include "base64_forensic.h"
 #include "scan_base64.h"
+#include "scanner_watchdog.h"
 
 /* These create bitfields so we can quickly assess the character classes in a potential base64 block */
 static const uint32_t B64_LOWERCASE=1;
@@ -147,6 +148,9 @@ void scan_base64(scanner_params &sp)
 	 */
         assert(base64array_initialized==true);
 
+        static const std::string name("base64");
+        scanner_watchdog::scope budget(name, sbuf); // -S scanner_time_budget
+
         bool   inblock    = false;      // are we in a base64 block?
         size_t blockstart = 0;          // where the base64 started
         size_t prevlen    = 0;          // length of previous line
@@ -155,7 +159,7 @@ void scan_base64(scanner_params &sp)
         size_t line_start = 0;          // start of the line that was found
         size_t line_len   = 0;          // length of the line
         bool   found_equal = false;
-        while (sbuf.getline(pos, line_start, line_len)){
+        while (!budget.expired() && sbuf.getline(pos, line_start, line_len)){
             if (debug) fprintf(stderr,"BASE64 pos=%zd line_start=%zd line_len=%zd\n",pos,line_start,line_len);
             if (sbuf_line_is_base64(sbuf,line_start,line_len,found_equal)){
                 if (inblock==false){
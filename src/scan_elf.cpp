@@ -8,6 +8,7 @@
 #include "config.h"
 
 #include "be20_api/scanner_params.h"
+#include "sbuf_signatures.h"
 
 /* tunable constants */
 size_t sht_null_counter_max = 10;
@@ -790,6 +791,7 @@ std::string scan_elf_verify (const sbuf_t & data)
     return xml.str();
 }
 
+static feature_recorder *elf_recorderp = nullptr;
 extern "C"
 void scan_elf (scanner_params &sp)
 {
@@ -802,25 +804,22 @@ void scan_elf (scanner_params &sp)
         sp.info->feature_defs.push_back( feature_recorder_def("elf") );
         return;
     }
+    if ( sp.phase == scanner_params::PHASE_INIT2){
+	elf_recorderp = &sp.named_feature_recorder("elf");
+    }
     if ( sp.phase == scanner_params::PHASE_SCAN){
 
-	auto &f = sp.named_feature_recorder("elf");
+	auto &f = *elf_recorderp;
         auto &sbuf = *(sp.sbuf);
 
-	for (size_t pos = 0; pos < sbuf.bufsize; pos++) {
-	    // Look for the magic number
-	    // If we find it, make an sbuf and analyze...
-	    if ( (sbuf[pos+0] == 0x7f)
-		 && (sbuf[pos+1] == 'E')
-		 && (sbuf[pos+2] == 'L')
-		 && (sbuf[pos+3] == 'F')) {
-
-		const sbuf_t data = sbuf.slice(pos);
-                std::string xml = scan_elf_verify(data);
-		if (xml != "") {
-                    sbuf_t hdata(data,0,4096);
-		    f.write(data.pos0, hdata.hash(), xml);
-		}
+        // At each magic number, make an sbuf and analyze...
+        const auto hits = sbuf_signatures::find(sbuf);
+	for (size_t pos = hits->next(sbuf_signatures::ELF, 0); pos < sbuf.bufsize; pos = hits->next(sbuf_signatures::ELF, pos+1)) {
+	    const sbuf_t data = sbuf.slice(pos);
+	    std::string xml = scan_elf_verify(data);
+	    if (xml != "") {
+		sbuf_t hdata(data,0,4096);
+		f.write(data.pos0, hdata.hash(), xml);
 	    }
 	}
     }
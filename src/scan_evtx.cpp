@@ -246,6 +246,7 @@ void scan_evtx(const sbuf_t &sbuf, feature_recorder &evtx_recorder)
 }
 
 
+static feature_recorder *evtx_recorderp = nullptr;
 extern "C"
 
 void scan_evtx(scanner_params &sp)
@@ -262,11 +263,14 @@ void scan_evtx(scanner_params &sp)
         sp.info->feature_defs.push_back( feature_recorder_def(FEATURE_FILE_NAME, carve_flag));
         return;
     }
+    if(sp.phase==scanner_params::PHASE_INIT2){
+        evtx_recorderp = &sp.named_feature_recorder(FEATURE_FILE_NAME);
+    }
     if(sp.phase==scanner_params::PHASE_SCAN){
         /* Note: the original programmer's scanner runs off the end of the sbuf, so we have to catch the exception */
 
         try {
-            scan_evtx( *(sp.sbuf), sp.named_feature_recorder(FEATURE_FILE_NAME));
+            scan_evtx( *(sp.sbuf), *evtx_recorderp);
         } catch (const sbuf_t::range_exception_t &e) {
         }
     } // end PHASE_SCAN
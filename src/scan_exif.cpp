@@ -26,6 +26,7 @@
 #include "dfxml_cpp/src/dfxml_writer.h"
 
 #include "exif_reader.h"
+#include "sbuf_signatures.h"
 #include "unicode_escape.h"
 
 // these are tunable
@@ -397,7 +398,10 @@ void exif_scanner::scan( const sbuf_t &sbuf )
         limit = sbuf.bufsize - jpeg_validator::MIN_JPEG_SIZE;
     }
 
-    for ( size_t start=0; start < limit; start++ ) {
+    // go from one JPEG, PSD or TIFF signature to the next
+    const auto hits = sbuf_signatures::find( sbuf );
+    const auto sigs = { sbuf_signatures::JPEG, sbuf_signatures::PSD, sbuf_signatures::TIFF_II, sbuf_signatures::TIFF_MM };
+    for ( size_t start = hits->next( sigs, 0 ); start < limit; start = hits->next( sigs, start + 1 ) ) {
         // check for start of a JPEG.
         if ( sbuf[start + 0] == 0xff && sbuf[start + 1] == 0xd8 &&
             sbuf[start + 2] == 0xff && ( sbuf[start + 3] & 0xf0 ) == 0xe0 ) {
@@ -47,6 +47,7 @@ static const char *facebook_searches[] = {"hovercard/page",
                                           "timelineUnitContainer",
                                           0};
 
+static feature_recorder *facebook_recorderp = nullptr;
 extern "C"
 void scan_facebook(scanner_params &sp)
 {
@@ -59,8 +60,11 @@ void scan_facebook(scanner_params &sp)
         sp.info->feature_defs.push_back( feature_recorder_def("facebook"));
         return;
     }
+    if (sp.phase==scanner_params::PHASE_INIT2) {
+        facebook_recorderp = &sp.named_feature_recorder("facebook");
+    }
     if (sp.phase==scanner_params::PHASE_SCAN) {
-        feature_recorder &facebook_recorder = sp.named_feature_recorder("facebook");
+        feature_recorder &facebook_recorder = *facebook_recorderp;
         used_offsets_t used_offsets;
 
         for (int j = 0; facebook_searches[j]; j++) {
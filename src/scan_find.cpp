@@ -17,11 +17,12 @@
 // TODO: make this not a global variable
 namespace {
     regex_vector find_list;
+    std::vector<std::string> find_list_patterns; // what find_list was compiled from
     void add_find_pattern(const std::string &pat) {
         find_list.push_back("(" + pat + ")"); // make a group
     }
 
-    void process_find_file(scanner_params &sp, std::filesystem::path findfile) {
+    void process_find_file(scanner_params &sp, std::filesystem::path findfile, std::vector<std::string> &patterns) {
         std::ifstream in;
 
         in.open(findfile, std::ifstream::in);
@@ -38,7 +39,7 @@ namespace {
             truncate_at(line,'\r');         // remove a '\r' if present
             if(line.size()>0) {
                 if(line[0]=='#') continue;  // ignore lines that begin with a comment character
-                add_find_pattern(line);
+                patterns.push_back(line);
                 if (sp.ss->writer) { sp.ss->writer->xmlout("find_pattern", line); }
             }
         }
@@ -46,9 +47,10 @@ namespace {
     }
 }
 
+static feature_recorder *find_recorderp = nullptr;
 void scan_find_sbuf(scanner_params &sp, sbuf_t &sbuf)
 {
-    feature_recorder &f = sp.named_feature_recorder("find");
+    feature_recorder &f = *find_recorderp;
 
     auto *tbuf = sbuf_t::sbuf_malloc(sp.sbuf->pos0, sp.sbuf->bufsize+1, sp.sbuf->bufsize+1);
     memcpy(tbuf->malloc_buf(), sp.sbuf->get_buf(), sp.sbuf->bufsize);
@@ -98,12 +100,22 @@ void scan_find(scanner_params &sp)
         return;
     }
     if (sp.phase == scanner_params::PHASE_INIT2 ) {
+        find_recorderp = &sp.named_feature_recorder("find");
+        std::vector<std::string> patterns;
         for (const auto &it : sp.ss->find_patterns()) {
-            add_find_pattern(it);
+            patterns.push_back(it);
             if (sp.ss->writer) { sp.ss->writer->xmlout("find_pattern", it); }
         }
         for (const auto &it : sp.ss->find_files()) {
-            process_find_file(sp, it);
+            process_find_file(sp, it, patterns);
+        }
+        /* With --batch this runs for every image; the regexes are only compiled again if they changed */
+        if (patterns != find_list_patterns) {
+            find_list.clear();
+            for (const auto &it : patterns) {
+                add_find_pattern(it);
+            }
+            find_list_patterns = patterns;
         }
     }
 
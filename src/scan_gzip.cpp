@@ -6,8 +6,11 @@
 
 #include "config.h"
 
+#include "memory_budget.h"
 #include "sbuf_decompress.h"
 #include "be20_api/scanner_params.h"
+#include "sbuf_scheduler.h"
+#include "sbuf_signatures.h"
 
 uint32_t   gzip_max_uncompr_size = 256*1024*1024; // don't decompress objects larger than this
 
@@ -27,9 +30,12 @@ void scan_gzip(scanner_params &sp)
     if (sp.phase==scanner_params::PHASE_SCAN){
 	const sbuf_t &sbuf = (*sp.sbuf);
 
-        for (unsigned int i=0; i < sbuf.pagesize && i < sbuf.bufsize-4; i++) {
+        const auto hits = sbuf_signatures::find(sbuf);
+        for (size_t i = hits->next(sbuf_signatures::GZIP, 0);
+             i < sbuf.pagesize && i < sbuf.bufsize-4;
+             i = hits->next(sbuf_signatures::GZIP, i+1)) {
 
-	    /** Look for the signature for beginning of a GZIP file.
+	    /** At the signature for beginning of a GZIP file.
 	     * See zlib.h and RFC1952
 	     * http://www.15seconds.com/Issue/020314.htm
 	     *
@@ -39,7 +45,8 @@ void scan_gzip(scanner_params &sp)
                                                                      gzip_max_uncompr_size, "GZIP" ,sbuf_decompress::mode_t::GZIP, 0);
                 if (decomp!=nullptr) {
                     assert(sbuf.depth()+1 == decomp->depth()); // make sure it is 1 deeper!
-                    sp.recurse(decomp);                        // recurse will free the sbuf
+                    memory_budget::reservation room(decomp->bufsize); // what was decoded, held until it is scanned
+                    sbuf_scheduler::recurse(sp, decomp);                     // recurse will free the sbuf
                 }
             }
 	}
@@ -6,7 +6,10 @@
 #include "be20_api/scanner_params.h"
 
 #include "image_process.h"
+#include "memory_budget.h"
 #include "pyxpress.h"
+#include "sbuf_scheduler.h"
+#include "sbuf_signatures.h"
 
 #define SCANNER_NAME "HIBERFILE"
 
@@ -43,6 +46,7 @@ void scan_hiberfile_scan(scanner_params &sp)
     assert (PYEXPRESS_HEADER[7]==0x73);
 
     const sbuf_t &sbuf = *(sp.sbuf);
+    const auto hits = sbuf_signatures::find(sbuf);
     size_t pos = 0;
     while (pos + MIN_COMPRESSED_SIZE < sbuf.bufsize) {
 
@@ -50,8 +54,8 @@ void scan_hiberfile_scan(scanner_params &sp)
          * http://www.pyflag.net/pyflag/src/lib/pyxpress.c
          * Decompress each block separetly
          */
-        ssize_t npos = sbuf.findbin(PYEXPRESS_HEADER, sizeof(PYEXPRESS_HEADER), pos);
-        if (npos==-1) break;             // header not found
+        size_t npos = hits->next(sbuf_signatures::HIBERFILE, pos); // PYEXPRESS_HEADER
+        if (npos==sbuf_signatures::NONE) break;             // header not found
 
         pos = npos;
         u_int compressed_length = (   (sbuf[pos+8]
@@ -80,6 +84,8 @@ void scan_hiberfile_scan(scanner_params &sp)
         }
         // shrink decomp_sbuf so that it is only as large as the amount that was actually decompressed.
         decomp_sbuf = decomp_sbuf->realloc(decompress_size);
+        /* When memory is short, wait for it; what was decoded is held until the block is scanned */
+        memory_budget::reservation room(decompress_size);
 
         /* decomp is a buffer that may extend over multiple pages.
          * Unfortunately the pages are not logically connected, because they are physical memory, and it is
@@ -89,7 +95,7 @@ void scan_hiberfile_scan(scanner_params &sp)
          * However, we need to copy the data into each one (a copy!) because they may be processed asynchronously.
          * And this resulted in a lot of overhead, so now we just process it as a block, like regular swap space.
          */
-        sp.recurse( decomp_sbuf );          // will delete the dbuf
+        sbuf_scheduler::recurse( sp, decomp_sbuf );        // will delete the dbuf
         pos += compressed_length;
     }
 }
@@ -56,6 +56,7 @@ bool validDottedQuad(std::string str)
 }
 
 /* Main function */
+static feature_recorder *httplogs_recorderp = nullptr;
 extern "C"
 void scan_httplogs(scanner_params &sp)
 {
@@ -68,8 +69,11 @@ void scan_httplogs(scanner_params &sp)
         return;
     }
 
+    if(sp.phase==scanner_params::PHASE_INIT2){
+	httplogs_recorderp = &sp.named_feature_recorder("httplogs");
+    }
     if(sp.phase==scanner_params::PHASE_SCAN){
-	feature_recorder &httplogs_recorder = sp.named_feature_recorder("httplogs");
+	feature_recorder &httplogs_recorder = *httplogs_recorderp;
         const sbuf_t &sbuf = *(sp.sbuf);
 
         for (size_t p = 0; p < sbuf.pagesize; p++) {
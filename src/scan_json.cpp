@@ -431,6 +431,7 @@ int json_checker::check_char(int next_char)
 
 static const char *json_second_chars = "0123456789.-{[ \t\n\r\""; // valid second chars in a JSON block
 static bool is_json_second_char[256];   // fast lookup to determine if a second char is in JSON or not.
+static feature_recorder *json_recorderp = nullptr;
 extern "C"
 void scan_json(struct scanner_params &sp)
 {
@@ -452,11 +453,12 @@ void scan_json(struct scanner_params &sp)
         return;
     }
 
+    if(sp.phase==scanner_params::PHASE_INIT2){
+        json_recorderp = &sp.named_feature_recorder("json");
+    }
     if(sp.phase==scanner_params::PHASE_SCAN){
-        // do we want to look up the feature_recorder every time through?
-        // Perhaps the scanners should be C++ classes with C linkage
         auto &sbuf = *(sp.sbuf);
-        feature_recorder &fr = sp.named_feature_recorder("json");
+        feature_recorder &fr = *json_recorderp;
 	for(size_t pos = 0;pos+1<sbuf.pagesize;pos++){
 	    /* Find the beginning of a json object. This will improve later... */
 	    if((sbuf[pos]=='{' || sbuf[pos]=='[') && is_json_second_char[sbuf[pos+1]]){
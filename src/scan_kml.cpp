@@ -23,6 +23,7 @@
 
 #include "utf8.h"
 
+static feature_recorder *kml_recorderp = nullptr;
 extern "C"
 void scan_kml(scanner_params &sp)
 {
@@ -38,9 +39,12 @@ void scan_kml(scanner_params &sp)
         sp.info->feature_defs.push_back( feature_recorder_def( FEATURE_FILE_NAME , carve_flag));
 	return;
     }
+    if(sp.phase==scanner_params::PHASE_INIT2){
+	kml_recorderp = &sp.named_feature_recorder(FEATURE_FILE_NAME);
+    }
     if(sp.phase==scanner_params::PHASE_SCAN){
 	const sbuf_t &sbuf = *(sp.sbuf);
-	feature_recorder &kml_recorder = sp.named_feature_recorder( FEATURE_FILE_NAME );
+	feature_recorder &kml_recorder = *kml_recorderp;
 
 	// Search for <xml BEGIN:VCARD\r in the sbuf
 	// we could do this with a loop, or with
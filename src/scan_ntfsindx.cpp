@@ -71,6 +71,7 @@ int8_t check_indxrecord_type(size_t offset, const sbuf_t &sbuf) {
         return 0;
 }
 
+static feature_recorder *ntfsindx_recorderp = nullptr;
 extern "C"
 
 void scan_ntfsindx(scanner_params &sp)
@@ -87,9 +88,12 @@ void scan_ntfsindx(scanner_params &sp)
         sp.info->feature_defs.push_back( feature_recorder_def(FEATURE_FILE_NAME, carve_flag));
         return;
     }
+    if(sp.phase==scanner_params::PHASE_INIT2){
+        ntfsindx_recorderp = &sp.named_feature_recorder(FEATURE_FILE_NAME);
+    }
     if(sp.phase==scanner_params::PHASE_SCAN){
         const sbuf_t &sbuf = *(sp.sbuf);
-        feature_recorder &ntfsindx_recorder = sp.named_feature_recorder(FEATURE_FILE_NAME);
+        feature_recorder &ntfsindx_recorder = *ntfsindx_recorderp;
 
         // search for NTFS $INDEX_ALLOCATION INDX record in the sbuf
         size_t offset = 0;
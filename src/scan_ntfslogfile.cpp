@@ -73,6 +73,7 @@ int8_t check_logfilerecord_signature(size_t offset, const sbuf_t &sbuf) {
     }
 }
 
+static feature_recorder *ntfslogfile_recorderp = nullptr;
 extern "C"
 
 void scan_ntfslogfile(scanner_params &sp)
@@ -90,9 +91,12 @@ void scan_ntfslogfile(scanner_params &sp)
         sp.info->feature_defs.push_back( feature_recorder_def(FEATURE_FILE_NAME, carve_flag));
         return;
     }
+    if(sp.phase==scanner_params::PHASE_INIT2){
+        ntfslogfile_recorderp = &sp.named_feature_recorder(FEATURE_FILE_NAME);
+    }
     if(sp.phase==scanner_params::PHASE_SCAN){
         const sbuf_t &sbuf = (*sp.sbuf);
-        feature_recorder &ntfslogfile_recorder = sp.named_feature_recorder(FEATURE_FILE_NAME);
+        feature_recorder &ntfslogfile_recorder = *ntfslogfile_recorderp;
 
         // search for NTFS $LogFile RCRD record in the sbuf
         size_t offset = 0;
@@ -55,6 +55,7 @@ int8_t check_mftrecord_signature(size_t offset, const sbuf_t &sbuf) {
     }
 }
 
+static feature_recorder *ntfsmft_recorderp = nullptr;
 extern "C"
 
 void scan_ntfsmft(scanner_params &sp)
@@ -71,9 +72,12 @@ void scan_ntfsmft(scanner_params &sp)
         sp.info->scanner_flags.scanner_wants_filesystems = true;
         return;
     }
+    if(sp.phase==scanner_params::PHASE_INIT2){
+        ntfsmft_recorderp = &sp.named_feature_recorder(FEATURE_FILE_NAME);
+    }
     if(sp.phase==scanner_params::PHASE_SCAN){
         const sbuf_t &sbuf = (*sp.sbuf);
-        feature_recorder &ntfsmft_recorder = sp.named_feature_recorder(FEATURE_FILE_NAME);
+        feature_recorder &ntfsmft_recorder = *ntfsmft_recorderp;
 
         // search for NTFS MFT record in the sbuf
         size_t offset = 0;
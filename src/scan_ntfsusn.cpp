@@ -66,6 +66,7 @@ size_t check_usnrecordv2_or_v4_signature(size_t offset, const sbuf_t &sbuf) {
     return 0;
 }
 
+static feature_recorder *ntfsusn_recorderp = nullptr;
 extern "C"
 
 void scan_ntfsusn(scanner_params &sp)
@@ -83,9 +84,12 @@ void scan_ntfsusn(scanner_params &sp)
         sp.info->feature_defs.push_back( feature_recorder_def(FEATURE_FILE_NAME, carve_flag));
         return;
     }
+    if(sp.phase==scanner_params::PHASE_INIT2){
+        ntfsusn_recorderp = &sp.named_feature_recorder(FEATURE_FILE_NAME);
+    }
     if(sp.phase==scanner_params::PHASE_SCAN){
         const sbuf_t &sbuf = *(sp.sbuf);
-        feature_recorder &ntfsusn_recorder = sp.named_feature_recorder(FEATURE_FILE_NAME);
+        feature_recorder &ntfsusn_recorder = *ntfsusn_recorderp;
 
         size_t offset = 0;
         size_t stop = sbuf.pagesize;
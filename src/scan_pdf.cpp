@@ -25,6 +25,8 @@
 #include "sbuf_decompress.h"
 #include "be20_api/scanner_params.h"
 #include "image_process.h"
+#include "memory_budget.h"
+#include "page_classifier.h"
 
 
 
@@ -50,11 +52,7 @@ pdf_extractor::~pdf_extractor()
 
 bool pdf_extractor::mostly_printable_ascii(const sbuf_t &s)
 {
-    size_t count = 0;
-    for(u_int i=0; i<s.pagesize; i++){
-        if (isprint(s[i]) || isspace(s[i])) count++;
-    }
-    return count > (s.pagesize * 9 / 10);
+    return page_classifier::text_bytes(s.get_buf(), s.pagesize) > (s.pagesize * 9 / 10);
 }
 
 /*
@@ -181,6 +179,7 @@ void pdf_extractor::decompress_streams_extract_text()
         if (dbuf==nullptr) {
             continue ;   // could not decompress
         }
+        memory_budget::reservation room(dbuf->bufsize); // what was decoded, held until its text is extracted
 
         if (pdf_dump_hex){
             std::cout << "===== scan_pdf.c:decompress_streams_extract_text: dbuf->pos0 = " << dbuf->pos0 << " =====\n";
@@ -7,6 +7,8 @@
 #include "config.h"
 
 #include "be20_api/scanner_params.h"
+#include "sbuf_scheduler.h"
+#include "scanner_watchdog.h"
 
 #include "utf8.h"
 #include "dfxml_cpp/src/dfxml_writer.h"
@@ -536,6 +538,7 @@ static void unpack_buf(const uint8_t* input, size_t input_len, uint8_t* output,
 
     ComprDataIO mydataio;
     mydataio.SetSkipUnpCRC(true); //skip checking the CRC to allow more processing to occur
+    mydataio.SetUnpackCancel(scanner_watchdog::expired); //stop unpacking past -S scanner_time_budget
     mydataio.SetUnpackToMemory(output,output_len); //Sets flag to save output to memory
 
     extract.SetComprDataIO(mydataio); //Sets the ComprDataIO variable to the custom one that was just built
@@ -622,9 +625,12 @@ void scan_rar(scanner_params &sp)
 	const sbuf_t &sbuf = *(sp.sbuf);
 	const pos0_t &pos0 = sbuf.pos0;
 
+        static const std::string name("rar");
+        scanner_watchdog::scope budget(name, sbuf); // -S scanner_time_budget
+
         RarComponentInfo component;
         RarVolumeInfo volume;
-	for (size_t pos = 0 ; pos + FILE_HEAD_MIN_LEN < sbuf.bufsize ; pos++ ){
+	for (size_t pos = 0 ; pos + FILE_HEAD_MIN_LEN < sbuf.bufsize && !budget.expired() ; pos++ ){
             size_t cc_len = sbuf.bufsize - pos;
 
             // feature files have three columns: forensic path / offset,
@@ -671,7 +677,7 @@ void scan_rar(scanner_params &sp)
                         if (it=='/') it = '_';
                     }
                     unrar_recorder->carve(*dbuf, carve_name, component.iso_timestamp());
-                    sp.recurse(dbuf);
+                    sbuf_scheduler::recurse(sp, dbuf);
                 }
             }
 	}
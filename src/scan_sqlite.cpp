@@ -14,6 +14,7 @@
 
 #include "config.h"
 #include "be20_api/scanner_params.h"
+#include "sbuf_signatures.h"
 
 
 /**
@@ -32,6 +33,7 @@
 
 #define FEATURE_FILE_NAME "sqlite_carved"
 
+static feature_recorder *sqlite_recorderp = nullptr;
 extern "C"
 void scan_sqlite(scanner_params &sp)
 {
@@ -47,15 +49,19 @@ void scan_sqlite(scanner_params &sp)
 	sp.info->feature_defs.push_back( feature_recorder_def(FEATURE_FILE_NAME, carve_flag));
 	return;
     }
+    if(sp.phase==scanner_params::PHASE_INIT2){
+	sqlite_recorderp = &sp.named_feature_recorder(FEATURE_FILE_NAME);
+    }
     if(sp.phase==scanner_params::PHASE_SCAN){
 	const sbuf_t &sbuf = *(sp.sbuf);
-	feature_recorder &sqlite_recorder = sp.named_feature_recorder(FEATURE_FILE_NAME);
+	feature_recorder &sqlite_recorder = *sqlite_recorderp;
 
-	// Search for BEGIN:SQLITE\r in the sbuf
-	// we could do this with a loop, or with
+	// Go from one "SQLite format 3" in the sbuf to the next
+        const auto hits = sbuf_signatures::find(sbuf);
 	for (size_t i = 0;  i + 512 <= sbuf.bufsize;)	{
-	    ssize_t begin = sbuf.find("SQLite format 3\000",i);
-	    if (begin==-1) return;		// no more
+	    const size_t found = hits->next(sbuf_signatures::SQLITE, i);
+	    if (found == sbuf_signatures::NONE) return;		// no more
+	    ssize_t begin = found;
 
 	    /* We found the header */
             uint32_t pagesize = sbuf.get16uBE(begin+16);
@@ -75,6 +75,7 @@ bool check_utmprecord_signature(size_t offset, const sbuf_t &sbuf) {
     return true;
 }
 
+static feature_recorder *utmp_recorderp = nullptr;
 extern "C"
 
 void scan_utmp(scanner_params &sp)
@@ -90,10 +91,13 @@ void scan_utmp(scanner_params &sp)
         sp.info->feature_defs.push_back(feature_recorder_def(FEATURE_FILE_NAME, carve_flag));
         return;
     }
+    if(sp.phase==scanner_params::PHASE_INIT2){
+        utmp_recorderp = &sp.named_feature_recorder(FEATURE_FILE_NAME);
+    }
     if(sp.phase==scanner_params::PHASE_SCAN){
         const sbuf_t &sbuf = *(sp.sbuf);
         //feature_recorder_set &fs = sp.fs;
-        feature_recorder &utmp_recorder = sp.named_feature_recorder(FEATURE_FILE_NAME);
+        feature_recorder &utmp_recorder = *utmp_recorderp;
 
         size_t offset = 0;
         size_t stop = sbuf.pagesize;
@@ -74,6 +74,7 @@ void carve_vcards(const sbuf_t &sbuf, feature_recorder &vcard_recorder)
 }
 
 
+static feature_recorder *vcard_recorderp = nullptr;
 extern "C"
 void scan_vcard(scanner_params &sp)
 {
@@ -88,9 +89,12 @@ void scan_vcard(scanner_params &sp)
         sp.info->feature_defs.push_back( feature_recorder_def("vcard", carve_flag));
 	return;
     }
+    if(sp.phase==scanner_params::PHASE_INIT2){
+	vcard_recorderp = &sp.named_feature_recorder("vcard");
+    }
     if(sp.phase==scanner_params::PHASE_SCAN){
 	const sbuf_t &sbuf       = *sp.sbuf;
-	feature_recorder &vcard_recorder = sp.named_feature_recorder("vcard");
+	feature_recorder &vcard_recorder = *vcard_recorderp;
         carve_vcards(sbuf, vcard_recorder);
     }
 }
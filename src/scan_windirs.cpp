@@ -478,6 +478,7 @@ void scan_ntfsdirs(const sbuf_t &sbuf,feature_recorder &wrecorder)
     }
 }
 
+static feature_recorder *windirs_recorderp = nullptr;
 extern "C"
 void scan_windirs(scanner_params &sp)
 {
@@ -517,8 +518,11 @@ void scan_windirs(scanner_params &sp)
         //debug = sp.info->config->debug;
 	return;
     }
+    if (sp.phase==scanner_params::PHASE_INIT2){
+	windirs_recorderp = &sp.named_feature_recorder("windirs");
+    }
     if (sp.phase==scanner_params::PHASE_SCAN){
-	feature_recorder &wrecorder = sp.named_feature_recorder("windirs");
+	feature_recorder &wrecorder = *windirs_recorderp;
 	scan_fatdirs(*sp.sbuf, wrecorder);
 	scan_ntfsdirs(*sp.sbuf, wrecorder);
     }
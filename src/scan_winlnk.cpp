@@ -34,6 +34,7 @@
 #include "be20_api/scanner_params.h"
 #include "be20_api/unicode_escape.h"
 #include "dfxml_cpp/src/dfxml_writer.h"
+#include "sbuf_signatures.h"
 
 static const size_t SMALLEST_LNK_FILE = 150;  // did you see smaller LNK file?
 
@@ -318,10 +319,12 @@ void scan_winlnk(scanner_params &sp)
 	// phase 1: set up the feature recorder and search for winlnk features
 	const sbuf_t &sbuf = *(sp.sbuf);
 
-        for (size_t pos=0;(pos < sbuf.pagesize) &&  (pos + SMALLEST_LNK_FILE < sbuf.bufsize ); pos++){
+        const auto hits = sbuf_signatures::find(sbuf);
+        for (size_t pos = hits->next(sbuf_signatures::WINLNK, 0);
+             (pos < sbuf.pagesize) &&  (pos + SMALLEST_LNK_FILE < sbuf.bufsize );
+             pos = hits->next(sbuf_signatures::WINLNK, pos+1)){
 
-            // look for Shell Link (.LNK) binary file format magic number
-            // Move this to a b-m search.
+            // at each Shell Link (.LNK) binary file format magic number
             if ( sbuf.get32u(pos+0x00) == 0x0000004c &&      // header size
                  sbuf.get32u(pos+0x04) == 0x00021401 &&      // LinkCLSID 1
                  sbuf.get32u(pos+0x08) == 0x00000000 &&      // LinkCLSID 2
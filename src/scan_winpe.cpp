@@ -1008,6 +1008,8 @@ static size_t get_carve_size (const sbuf_t& sbuf)
     return carve_size;
 }
 
+static feature_recorder *winpe_recorderp = nullptr;
+static feature_recorder *winpe_carved_recorderp = nullptr;
 extern "C"
 void scan_winpe (scanner_params &sp)
 {
@@ -1025,8 +1027,12 @@ void scan_winpe (scanner_params &sp)
         return;
     }
 
+    if(sp.phase == scanner_params::PHASE_INIT2){
+	winpe_recorderp = &sp.named_feature_recorder("winpe");
+	winpe_carved_recorderp = &sp.named_feature_recorder("winpe_carved");
+    }
     if(sp.phase == scanner_params::PHASE_SCAN){    // phase 1
-	feature_recorder &f = sp.named_feature_recorder("winpe");
+	feature_recorder &f = *winpe_recorderp;
         const sbuf_t &sbuf = *(sp.sbuf);
 
 	/*
@@ -1069,7 +1075,7 @@ void scan_winpe (scanner_params &sp)
 		    f.write(data.pos0, first4k.hash(), xml);
 
                     size_t carve_size = get_carve_size(data);
-                    feature_recorder &f_carved = sp.named_feature_recorder("winpe_carved");
+                    feature_recorder &f_carved = *winpe_carved_recorderp;
                     f_carved.carve(data.slice(0, carve_size), ".winpe");
 		}
 	    }
@@ -8,6 +8,9 @@
 #include "be20_api/utils.h"
 #include "be20_api/formatter.h"
 
+#include "memory_budget.h"
+#include "sbuf_scheduler.h"
+
 static int xor_mask = 255;
 extern "C"
 void scan_xor(scanner_params &sp)
@@ -51,6 +54,9 @@ void scan_xor(scanner_params &sp)
 
         const pos0_t pos0_xor = pos0 + (Formatter() << "XOR(" << uint32_t(xor_mask) << ")");
 
+        // when memory is short, wait for it; held until the XOR'd copy is scanned
+        memory_budget::reservation room(sbuf.bufsize);
+
         // managed_malloc throws an exception if allocation fails.
         auto *dbuf = sbuf_t::sbuf_malloc(pos0_xor, sbuf.bufsize, sbuf.pagesize);
         assert( dbuf!= nullptr);
@@ -63,6 +69,6 @@ void scan_xor(scanner_params &sp)
         for(size_t ii = 0; ii < sbuf.bufsize; ii++) {
             dbuf->wbuf(ii, sbuf[ii] ^ xor_mask);
         }
-        sp.recurse(dbuf);
+        sbuf_scheduler::recurse(sp, dbuf);
     }
 }
@@ -6,8 +6,11 @@
 
 
 #include "config.h"
+#include "memory_budget.h"
 #include "sbuf_decompress.h"
 #include "be20_api/scanner_params.h"
+#include "sbuf_scheduler.h"
+#include "sbuf_signatures.h"
 #include "dfxml_cpp/src/dfxml_writer.h"
 #include "utf8.h"
 
@@ -132,6 +135,7 @@ inline void scan_zip_component(scanner_params &sp, feature_recorder &zip_recorde
             }
         }
 
+        memory_budget::reservation room(uncompr_size); // held until decomp is scanned
         auto *decomp = sbuf_decompress::sbuf_new_decompress(sbuf_src, uncompr_size, "ZIP", sbuf_decompress::mode_t::ZIP, header_size);
         if (decomp!=nullptr) {
             xmlstream << "<disposition bytes='" << decomp->bufsize << "'>decompressed</disposition></zipinfo>";
@@ -144,7 +148,7 @@ inline void scan_zip_component(scanner_params &sp, feature_recorder &zip_recorde
             zip_recorder.carve(*decomp, carve_name, mtime);
 
             // recurse. Remember that recurse will free the sbuf
-            sp.recurse( decomp );
+            sbuf_scheduler::recurse( sp, decomp );
         } else {
             xmlstream << "<disposition>decompress-failed</disposition></zipinfo>";
             zip_recorder.write(pos0+pos,name,xmlstream.str());
@@ -152,6 +156,7 @@ inline void scan_zip_component(scanner_params &sp, feature_recorder &zip_recorde
     }
 }
 
+static feature_recorder *zip_recorderp = nullptr;
 extern "C"
 void scan_zip(scanner_params &sp)
 {
@@ -170,18 +175,22 @@ void scan_zip(scanner_params &sp)
 	return;
     }
 
+    if (sp.phase==scanner_params::PHASE_INIT2){
+        zip_recorderp = &sp.named_feature_recorder(ZIP_RECORDER_NAME);
+    }
     if (sp.phase==scanner_params::PHASE_SCAN){
 	const sbuf_t &sbuf = (*sp.sbuf);
 
         if (sbuf.bufsize < MIN_ZIP_SIZE) return;
 
-        feature_recorder &zip_recorder   = sp.named_feature_recorder(ZIP_RECORDER_NAME);
+        feature_recorder &zip_recorder   = *zip_recorderp;
 
-	for(size_t i=0 ; i < sbuf.pagesize && i < sbuf.bufsize-MIN_ZIP_SIZE; i++){
-	    /** Look for signature for beginning of a ZIP component. */
-	    if (sbuf[i]==0x50 && sbuf[i+1]==0x4B && sbuf[i+2]==0x03 && sbuf[i+3]==0x04){
-                scan_zip_component(sp, zip_recorder, i);
-	    }
+        /* Go from one signature for the beginning of a ZIP component to the next */
+        const auto hits = sbuf_signatures::find(sbuf);
+	for(size_t i = hits->next(sbuf_signatures::ZIP, 0);
+            i < sbuf.pagesize && i < sbuf.bufsize-MIN_ZIP_SIZE;
+            i = hits->next(sbuf_signatures::ZIP, i+1)){
+            scan_zip_component(sp, zip_recorder, i);
 	}
     }
 }
@@ -0,0 +1,160 @@
+/*
+ * scanner_watchdog.cpp:
+ *
+ * The time budget of a scanner on an sbuf. See scanner_watchdog.h
+ */
+
+#include "config.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "scanner_watchdog.h"
+
+namespace {
+/* The open scopes of a thread, innermost last. Only the thread changes them. */
+struct thread_frames_t {
+    std::mutex M {};
+    std::vector<scanner_watchdog::frame_t *> frames {};
+};
+
+std::mutex registry_M {};
+std::vector<std::shared_ptr<thread_frames_t>> registry {}; // every thread that opened a scope since start()
+std::atomic<unsigned> generation {0};                      // of start()
+
+std::mutex overruns_M {};
+std::vector<scanner_watchdog::overrun_t> recorded {};
+
+std::mutex watch_M {};
+std::condition_variable watch_cv {};
+bool stopping {false};
+std::thread watcher {};
+
+thread_frames_t &this_thread_frames()
+{
+    thread_local std::shared_ptr<thread_frames_t> frames {};
+    thread_local unsigned registered = 0;
+    if (!frames || registered != generation) {
+        frames = std::make_shared<thread_frames_t>();
+        registered = generation;
+        const std::lock_guard<std::mutex> lock(registry_M);
+        registry.push_back(frames);
+    }
+    return *frames;
+}
+}
+
+void scanner_watchdog::start(double budget_seconds)
+{
+    if (budget_seconds <= 0 || running) return;
+    the_budget = budget_seconds;
+    overruns = 0;
+    generation += 1;
+    {
+        const std::lock_guard<std::mutex> lock(overruns_M);
+        recorded.clear();
+    }
+    stopping = false;
+    watcher = std::thread(&scanner_watchdog::watch);
+    running = true;
+}
+
+std::vector<scanner_watchdog::overrun_t> scanner_watchdog::stop()
+{
+    if (!running) return {};
+    running = false;
+    {
+        const std::lock_guard<std::mutex> lock(watch_M);
+        stopping = true;
+        watch_cv.notify_all();
+    }
+    watcher.join();
+    {
+        const std::lock_guard<std::mutex> lock(registry_M);
+        registry.clear();
+    }
+    const std::lock_guard<std::mutex> lock(overruns_M);
+    std::vector<overrun_t> ret;
+    ret.swap(recorded);
+    return ret;
+}
+
+/* Flag the open scopes that have run past the budget, a few times a budget */
+void scanner_watchdog::watch()
+{
+    const std::chrono::duration<double> budget(the_budget);
+    const std::chrono::duration<double> period(std::clamp(the_budget / 10, 0.01, 1.0));
+    std::unique_lock<std::mutex> lock(watch_M);
+    while (!stopping) {
+        watch_cv.wait_for(lock, period);
+        const auto now = std::chrono::steady_clock::now();
+        const std::lock_guard<std::mutex> rlock(registry_M);
+        for (const auto &tf : registry) {
+            const std::lock_guard<std::mutex> flock(tf->M);
+            for (frame_t *f : tf->frames) {
+                if (f->flagged || now - f->start < budget) continue;
+                f->flagged = true;
+                overruns += 1;
+                const std::lock_guard<std::mutex> olock(overruns_M);
+                if (recorded.size() < MAX_RECORDED) {
+                    f->overrun = recorded.size();
+                    recorded.push_back(overrun_t{*f->scanner, f->sbuf->pos0.str(),
+                                                 std::chrono::duration<double>(now - f->start).count(), false});
+                }
+            }
+        }
+    }
+}
+
+scanner_watchdog::scope::scope(const std::string &scanner, const sbuf_t &sbuf)
+{
+    if (!running) return;
+    thread_frames_t &tf = this_thread_frames();
+    const std::lock_guard<std::mutex> lock(tf.M);
+    if (!tf.frames.empty() && tf.frames.back()->sbuf == &sbuf && *tf.frames.back()->scanner == scanner) {
+        frame = tf.frames.back();
+        return;
+    }
+    own.scanner = &scanner;
+    own.sbuf = &sbuf;
+    own.start = std::chrono::steady_clock::now();
+    frame = &own;
+    tf.frames.push_back(frame);
+}
+
+scanner_watchdog::scope::~scope()
+{
+    if (frame != &own) return;
+    thread_frames_t &tf = this_thread_frames();
+    const std::lock_guard<std::mutex> lock(tf.M);
+    auto it = std::find(tf.frames.begin(), tf.frames.end(), frame);
+    if (it != tf.frames.end()) tf.frames.erase(it);
+    if (own.overrun >= 0) {
+        const std::lock_guard<std::mutex> olock(overruns_M);
+        if (static_cast<size_t>(own.overrun) < recorded.size()) {
+            recorded[own.overrun].seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - own.start).count();
+            recorded[own.overrun].stopped = own.noticed;
+        }
+    }
+}
+
+bool scanner_watchdog::scope::expired() const
+{
+    if (frame == nullptr || !frame->flagged.load(std::memory_order_relaxed)) return false;
+    frame->noticed.store(true, std::memory_order_relaxed);
+    return true;
+}
+
+bool scanner_watchdog::expired()
+{
+    if (!running) return false;
+    thread_frames_t &tf = this_thread_frames();
+    if (tf.frames.empty()) return false;          // only this thread changes its frames
+    frame_t *f = tf.frames.back();
+    if (!f->flagged.load(std::memory_order_relaxed)) return false;
+    f->noticed.store(true, std::memory_order_relaxed);
+    return true;
+}
@@ -0,0 +1,75 @@
+/*
+ * scanner_watchdog.h:
+ *
+ * A time budget for each scanner on each sbuf (-S scanner_time_budget=seconds), so that a
+ * pathological region (deeply nested base64, a corrupt RAR header that unrar crawls through)
+ * holds up one page for a bounded time instead of for as long as max_wait_time allows the whole run.
+ *
+ * A scanner opens a scope for the sbuf it is scanning and polls expired() in its loops; the poll is
+ * a load of a flag. A watchdog thread looks at the open scopes of every thread a few times a budget,
+ * and sets the flag of each that has run past the budget. The scanner then stops scanning the sbuf,
+ * keeping what it has found. With -S scheduler=be2 the scheduler opens a scope around every scanner,
+ * so that the scanners that do not poll are recorded when they overrun too, though they run to the end.
+ *
+ * The overruns are written to report.xml with the scanner and pos0, so that those regions can be
+ * scanned again with a larger budget. With a budget of 0 (the default) there is no watchdog thread
+ * and a scope does nothing.
+ */
+
+#ifndef SCANNER_WATCHDOG_H
+#define SCANNER_WATCHDOG_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "be20_api/sbuf.h"
+
+class scanner_watchdog {
+public:
+    struct overrun_t {
+        std::string scanner {};
+        std::string pos0 {};
+        double   seconds {0};           // on the sbuf, in all
+        bool     stopped {false};       // the scanner polled expired() after it was flagged
+    };
+    static const size_t MAX_RECORDED = 10000;  // overruns kept for report.xml; the rest are only counted
+
+    static void start(double budget_seconds);  // starts the watchdog thread; 0 for no budget
+    static std::vector<overrun_t> stop();      // stops it, once the scanners are done; returns the overruns
+    static double budget() { return the_budget; }
+    static inline std::atomic<uint64_t> overruns {0};
+
+    struct frame_t {                    // an open scope
+        const std::string *scanner {nullptr};
+        const sbuf_t      *sbuf {nullptr};
+        std::chrono::steady_clock::time_point start {};
+        std::atomic<bool> flagged {false};
+        std::atomic<bool> noticed {false};
+        ssize_t           overrun {-1};         // index in the recorded overruns, under the thread's mutex
+    };
+    /* A scanner on an sbuf. A scope for the scanner and sbuf of the innermost open scope of the
+     * thread joins that one, so a scanner's own scope within the scheduler's keeps its start time.
+     */
+    class scope {
+        scope(const scope &that) = delete;
+        scope &operator=(const scope &that) = delete;
+    public:
+        scope(const std::string &scanner, const sbuf_t &sbuf); // both must outlive the scope
+        ~scope();
+        bool expired() const;
+    private:
+        frame_t  own {};
+        frame_t *frame {nullptr};       // own, or the scope this one joined
+    };
+    static bool expired();                     // of the innermost open scope of this thread, for callbacks
+
+private:
+    static inline std::atomic<bool> running {false};
+    static inline double the_budget {0};
+    static void watch();
+};
+
+#endif
@@ -10,6 +10,8 @@
 #include "config.h"
 
 #include <algorithm>
+#include <chrono>
+#include <cstdlib>
 #include <cstring>
 #include <iostream>
 #include <memory>
@@ -17,9 +19,13 @@
 #include <cstdio>
 #include <stdexcept>
 #include <unistd.h>
+#include <map>
 #include <string>
+#include <sys/resource.h>
+#include <sys/stat.h>
 #include <string_view>
 #include <sstream>
+#include <thread>
 
 #include "be20_api/catch.hpp"
 
@@ -30,15 +36,29 @@
 
 #include "test_be.h"
 
+#include "async_reader.h"
 #include "bulk_extractor.h"
+#include "bulk_extractor_batch.h"
+#include "bulk_extractor_shard.h"
 #include "base64_forensic.h"
+#include "block_hash_store.h"
+#include "block_sampler.h"
 #include "bulk_extractor_restarter.h"
 #include "bulk_extractor_scanners.h"
 #include "exif_reader.h"
+#include "image_hasher.h"
 #include "image_process.h"
 #include "jpeg_validator.h"
+#include "known_blocks.h"
+#include "memory_budget.h"
+#include "numa_topology.h"
+#include "page_checkpoint.h"
+#include "page_classifier.h"
+#include "page_tuner.h"
 #include "phase1.h"
 #include "sbuf_decompress.h"
+#include "sbuf_scheduler.h"
+#include "sbuf_signatures.h"
 #include "scan_aes.h"
 #include "scan_base64.h"
 #include "scan_email.h"
@@ -47,6 +67,7 @@
 #include "scan_pdf.h"
 #include "scan_vcard.h"
 #include "scan_wordlist.h"
+#include "scanner_watchdog.h"
 
 #include "test_be.h"
 
@@ -391,6 +412,386 @@ TEST_CASE("e2e-jpeg", "[end-to-end]") {
 
 
 
+TEST_CASE("e2e-read-ahead", "[end-to-end]") {
+    std::filesystem::path inpath = test_dir() / "len6192.jpg";
+    std::string inpath_string = inpath.string();
+    std::filesystem::path outdir = NamedTemporaryDirectory();
+    std::string outdir_string = outdir.string();
+    std::stringstream ss;
+    const char *argv[] = {"bulk_extractor",notify(), "-S","read_ahead_depth=4","-G","1024","-g","512",
+                          "-1q","-o",outdir_string.c_str(), inpath_string.c_str(), nullptr};
+    int ret = run_be(ss, argv);
+    REQUIRE( ret==0 );
+    auto lines = getLines( outdir / "report.xml" );
+    auto pos = std::find(lines.begin(), lines.end(),
+                         "    <hashdigest type='SHA1'>69cee372e6cd7e8e3181aebdb03fc53e18124bff</hashdigest>");
+    REQUIRE( pos != lines.end());
+}
+
+/* A manifest of two images gives two complete reports, and images already scanned are skipped */
+TEST_CASE("e2e-batch", "[end-to-end]") {
+    std::filesystem::path dir = NamedTemporaryDirectory();
+    std::filesystem::path manifest = dir / "manifest.txt";
+    std::ofstream(manifest) << "# image\toutdir\n"
+                            << (test_dir() / "len6192.jpg").string() << "\t" << (dir / "out1").string() << "\n\n"
+                            << (test_dir() / "1.jpg").string() << "\t" << (dir / "out2").string() << "\n";
+    auto entries = bulk_extractor_batch::read_manifest(manifest);
+    REQUIRE( entries.size() == 2 );
+    REQUIRE( entries[1].outdir == dir / "out2" );
+
+    std::string manifest_string = manifest.string();
+    std::stringstream ss;
+    const char *argv[] = {"bulk_extractor",notify(), "-1q", "--batch", manifest_string.c_str(), nullptr};
+    REQUIRE( run_be(ss, argv) == 0 );
+    REQUIRE( bulk_extractor_batch::finished(dir / "out1") );
+    REQUIRE( bulk_extractor_batch::finished(dir / "out2") );
+    auto lines = getLines( dir / "out1" / "report.xml" );
+    REQUIRE( std::find(lines.begin(), lines.end(),
+                       "    <hashdigest type='SHA1'>69cee372e6cd7e8e3181aebdb03fc53e18124bff</hashdigest>") != lines.end());
+
+    std::stringstream again;
+    REQUIRE( run_be(again, argv) == 0 );
+    REQUIRE( again.str().find("already scanned") != std::string::npos );
+
+    std::ofstream(manifest) << "a\tout\nb\tout\n";
+    REQUIRE_THROWS_AS( bulk_extractor_batch::read_manifest(manifest), std::runtime_error );
+    std::ofstream(manifest) << "no tab\n";
+    REQUIRE_THROWS_AS( bulk_extractor_batch::read_manifest(manifest), std::runtime_error );
+}
+
+/* Per-image time of a process for each image against --batch; DEBUG_BENCHMARK_BE is the bulk_extractor to run */
+TEST_CASE("batch_startup_benchmark", "[end-to-end]") {
+    if (!getenv_debug("DEBUG_BENCHMARK")) {
+        std::cerr << "DEBUG_BENCHMARK not set; skipping batch_startup_benchmark" << std::endl;
+        return;
+    }
+    const char *env = getenv("DEBUG_BENCHMARK_BE");
+    const std::string be = env ? env : "./bulk_extractor";
+    const size_t images = 20;
+    std::filesystem::path dir = NamedTemporaryDirectory();
+    const std::string image = (test_dir() / "len6192.jpg").string(); // small, so that starting up is most of the time
+    auto seconds = [](const std::string &cmd) {
+        const auto start = std::chrono::steady_clock::now();
+        REQUIRE( std::system(cmd.c_str()) == 0 );
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    };
+    double separate = 0;
+    for (size_t i = 0; i < images; i++) {
+        separate += seconds(be + " -1q -o " + (dir / ("single" + std::to_string(i))).string() + " " + image + " >/dev/null");
+    }
+    std::filesystem::path manifest = dir / "manifest.txt";
+    {
+        std::ofstream out(manifest);
+        for (size_t i = 0; i < images; i++) {
+            out << image << "\t" << (dir / ("batch" + std::to_string(i))).string() << "\n";
+        }
+    }
+    const double batch = seconds(be + " -1q --batch " + manifest.string() + " >/dev/null");
+    std::cout << "batch_startup_benchmark: " << images << " images; ms per image: a process each "
+              << separate * 1000 / images << ", --batch " << batch * 1000 / images << std::endl;
+}
+
+/* Three shards merged must find the same email addresses, with the same histogram, as one scan of the image */
+TEST_CASE("e2e-shard", "[end-to-end]") {
+    unsigned index = 0, count = 0;
+    bulk_extractor_shard::parse("2/3", index, count);
+    REQUIRE( index == 2 );
+    REQUIRE( count == 3 );
+    REQUIRE_THROWS_AS( bulk_extractor_shard::parse("4/3", index, count), std::invalid_argument );
+    REQUIRE_THROWS_AS( bulk_extractor_shard::range(1, 30, 100000, 4096), std::invalid_argument );
+    REQUIRE( bulk_extractor_shard::range(2, 3, 100000, 4096).start == 8 * 4096 );
+    REQUIRE( bulk_extractor_shard::range(3, 3, 100000, 4096).end == 100000 );
+    REQUIRE( bulk_extractor_shard::unescape("a\\x41\\x5Cb") == "aA\\b" );
+
+    std::string inpath_string = (test_dir() / "nps-2010-emails.100k.raw").string();
+    std::filesystem::path dir = NamedTemporaryDirectory();
+    std::vector<std::string> outdirs;
+    for (const auto &name : {"whole", "shard1", "shard2", "shard3", "merged"}) {
+        outdirs.push_back((dir / name).string());
+    }
+    std::stringstream ss;
+    const char *whole[] = {"bulk_extractor",notify(), "-1q", "-E","email", "-G","16384", "-g","4096",
+                           "-o",outdirs[0].c_str(), inpath_string.c_str(), nullptr};
+    REQUIRE( run_be(ss, whole) == 0 );
+    for (int i = 1; i <= 3; i++) {
+        std::string spec = std::to_string(i) + "/3";
+        const char *shard[] = {"bulk_extractor",notify(), "-1q", "-E","email", "-G","16384", "-g","4096", "--shard",spec.c_str(),
+                               "-o",outdirs[i].c_str(), inpath_string.c_str(), nullptr};
+        REQUIRE( run_be(ss, shard) == 0 );
+    }
+    const char *merge[] = {"bulk_extractor",notify(), "-1q", "-E","email", "--merge",outdirs[3].c_str(),
+                           "--merge",outdirs[1].c_str(), "--merge",outdirs[2].c_str(), "-o",outdirs[4].c_str(), nullptr};
+    REQUIRE( run_be(ss, merge) == 0 );
+    REQUIRE( bulk_extractor_batch::finished(outdirs[4]) );
+
+    auto features = [](const std::filesystem::path &fname) {
+        std::vector<std::string> lines;
+        for (auto line : getLines(fname)) {
+            if (line.compare(0, 3, "\xEF\xBB\xBF") == 0) line.erase(0, 3);
+            if (line.size() > 0 && line[0] != '#') lines.push_back(line);
+        }
+        std::sort(lines.begin(), lines.end());
+        return lines;
+    };
+    for (const auto &fname : {"email.txt", "email_histogram.txt", "domain_histogram.txt"}) {
+        auto expected = features(std::filesystem::path(outdirs[0]) / fname);
+        REQUIRE( expected.size() > 0 );
+        REQUIRE( features(std::filesystem::path(outdirs[4]) / fname) == expected );
+    }
+}
+
+/* be2 must find what be1 does, also on a page of a repeating n-gram, which be20_api gives only to the scanners that ask for it */
+TEST_CASE("e2e-be2-ngram", "[end-to-end]") {
+    std::filesystem::path dir = NamedTemporaryDirectory();
+    std::filesystem::path inpath = dir / "ngram.raw";
+    {
+        std::ofstream out(inpath, std::ios::binary);
+        for (size_t i = 0; i < 16384 / 8; i++) {
+            out << "a@bc.de ";                  // 8 bytes: the whole first page is a repeating n-gram
+        }
+        std::string text;
+        for (size_t i = 0; text.size() < 16384; i++) {
+            text += "line " + std::to_string(i) + " from user" + std::to_string(i) + "@example.com\n";
+        }
+        out << text.substr(0, 16384);
+    }
+    std::string inpath_string = inpath.string();
+    std::vector<std::string> outdirs {(dir / "be1").string(), (dir / "be2").string()};
+    std::stringstream ss;
+    const char *be1[] = {"bulk_extractor",notify(), "-1q", "-E","email", "-G","16384", "-g","4096", "-S","scheduler=be1",
+                         "-o",outdirs[0].c_str(), inpath_string.c_str(), nullptr};
+    REQUIRE( run_be(ss, be1) == 0 );
+    const char *be2[] = {"bulk_extractor",notify(), "-1q", "-E","email", "-G","16384", "-g","4096", "-S","scheduler=be2", "-j","2",
+                         "-o",outdirs[1].c_str(), inpath_string.c_str(), nullptr};
+    REQUIRE( run_be(ss, be2) == 0 );
+
+    auto features = [](const std::filesystem::path &fname) {
+        std::vector<std::string> lines;
+        for (auto line : getLines(fname)) {
+            if (line.compare(0, 3, "\xEF\xBB\xBF") == 0) line.erase(0, 3);
+            if (line.size() > 0 && line[0] != '#') lines.push_back(line);
+        }
+        std::sort(lines.begin(), lines.end());
+        return lines;
+    };
+    auto expected = features(std::filesystem::path(outdirs[0]) / "email.txt");
+    REQUIRE( expected.size() > 0 );
+    REQUIRE( features(std::filesystem::path(outdirs[1]) / "email.txt") == expected );
+}
+
+/* With be1 and checkpoints, every page is marked once it and its recursive sbufs are scanned, and nothing else changes */
+TEST_CASE("e2e-be1-checkpoint", "[end-to-end]") {
+    std::filesystem::path inpath = test_dir() / "jpegs.tar.gz";
+    std::string inpath_string = inpath.string();
+    std::filesystem::path dir = NamedTemporaryDirectory();
+    std::vector<std::string> outdirs {(dir / "plain").string(), (dir / "checkpoint").string()};
+    std::stringstream ss;
+    const char *plain[] = {"bulk_extractor",notify(), "-1q", "-G","4096", "-g","1024", "-j","4",
+                           "-o",outdirs[0].c_str(), inpath_string.c_str(), nullptr};
+    REQUIRE( run_be(ss, plain) == 0 );
+    const char *checkpointed[] = {"bulk_extractor",notify(), "-1q", "-G","4096", "-g","1024", "-j","4", "-S","checkpoint_interval=1",
+                                  "-o",outdirs[1].c_str(), inpath_string.c_str(), nullptr};
+    REQUIRE( run_be(ss, checkpointed) == 0 );
+
+    const uint64_t size = std::filesystem::file_size(inpath);
+    page_checkpoint cp(std::filesystem::path(outdirs[1]) / Phase1::CHECKPOINT_FILENAME, size, 4096);
+    cp.load();
+    REQUIRE( cp.count() == (size + 4095) / 4096 );
+
+    auto features = [](const std::filesystem::path &fname) {
+        std::vector<std::string> lines;
+        for (auto line : getLines(fname)) {
+            if (line.compare(0, 3, "\xEF\xBB\xBF") == 0) line.erase(0, 3);
+            if (line.size() > 0 && line[0] != '#') lines.push_back(line);
+        }
+        std::sort(lines.begin(), lines.end());
+        return lines;
+    };
+    size_t compared = 0;
+    for (const auto &entry : std::filesystem::directory_iterator(outdirs[0])) {
+        if (entry.path().extension() != ".txt" || std::filesystem::file_size(entry.path()) == 0) continue;
+        REQUIRE( features(std::filesystem::path(outdirs[1]) / entry.path().filename()) == features(entry.path()) );
+        compared += 1;
+    }
+    REQUIRE( compared > 0 );
+}
+
+/* split-raw images are read with pread(), so several read-ahead threads may read them at once */
+TEST_CASE("raw_pread_threads", "[phase1]") {
+    image_process *p = image_process::open( test_dir() / "ram_2pages.bin", false, 4096, 1024);
+    REQUIRE( p->pread_is_threadsafe() );
+    std::vector<uint8_t> whole(p->image_size());
+    REQUIRE( p->pread(whole.data(), whole.size(), 0) == p->image_size() );
+
+    std::vector<std::thread> threads;
+    std::atomic<int> mismatches {0};
+    for (int t=0; t<4; t++) {
+        threads.emplace_back([&, t]{
+            std::vector<uint8_t> buf(1000);
+            for (uint64_t off = t * 100; off + buf.size() <= whole.size(); off += 700) {
+                if (p->pread(buf.data(), buf.size(), off) != static_cast<ssize_t>(buf.size())
+                    || memcmp(buf.data(), whole.data() + off, buf.size()) != 0) {
+                    mismatches++;
+                }
+            }
+        });
+    }
+    for (auto &th : threads) th.join();
+    REQUIRE( mismatches == 0 );
+    delete p;
+}
+
+/* Each thread reading an E01 gets its own libewf handle, so chunks are inflated in parallel */
+TEST_CASE("ewf_pread_threads", "[phase1]") {
+    image_process *p = image_process::open( test_dir() / "email_test.E01", false, 65536, 4096);
+    REQUIRE( p->pread_is_threadsafe() );
+    std::vector<uint8_t> whole(std::min(p->image_size(), static_cast<int64_t>(4*1024*1024)));
+    REQUIRE( p->pread(whole.data(), whole.size(), 0) == static_cast<ssize_t>(whole.size()) );
+
+    std::vector<std::thread> threads;
+    std::atomic<int> mismatches {0};
+    for (int t=0; t<4; t++) {
+        threads.emplace_back([&, t]{
+            std::vector<uint8_t> buf(70000);
+            for (uint64_t off = t * 33333; off + buf.size() <= whole.size(); off += 4 * 33333) {
+                if (p->pread(buf.data(), buf.size(), off) != static_cast<ssize_t>(buf.size())
+                    || memcmp(buf.data(), whole.data() + off, buf.size()) != 0) {
+                    mismatches++;
+                }
+            }
+        });
+    }
+    for (auto &th : threads) th.join();
+    REQUIRE( mismatches == 0 );
+
+    auto stats = p->io_stats();
+    auto handles = std::find_if(stats.begin(), stats.end(), [](const auto &kv){ return kv.first=="ewf_handles"; });
+    REQUIRE( handles != stats.end() );
+    REQUIRE( std::stoi(handles->second) >= 1 );
+    delete p;
+}
+
+/* Write a split-raw image with segments of the given lengths into dir; returns the first segment.
+ * Each byte is the low byte of its image offset, so misplaced reads are easy to spot.
+ */
+static std::filesystem::path make_split_raw(std::filesystem::path dir, const std::vector<size_t> &lengths)
+{
+    std::filesystem::path first;
+    uint64_t offset = 0;
+    for (size_t i=0; i<lengths.size(); i++) {
+        char fname[64];
+        snprintf(fname, sizeof(fname), "split.%03zu", i);
+        std::ofstream of(dir / fname, std::ios::out | std::ios::binary);
+        REQUIRE( of.is_open() );
+        for (size_t j=0; j<lengths[i]; j++) {
+            of.put(static_cast<char>(offset++ & 0xff));
+        }
+        of.close();
+        if (i==0) first = dir / fname;
+    }
+    return first;
+}
+
+/* Reads that start anywhere and span several segments, including empty ones */
+TEST_CASE("raw_segment_lookup", "[phase1]") {
+    const std::vector<std::vector<size_t>> layouts {
+        {100, 100, 100, 37},            // equal segments, short last one
+        {100, 37, 0, 250, 11, 0, 64},   // uneven, with empty segments
+    };
+    for (const auto &lengths : layouts) {
+        std::filesystem::path first = make_split_raw(NamedTemporaryDirectory(), lengths);
+        image_process *p = image_process::open( first, false, 64, 16);
+        uint64_t total = 0;
+        for (auto len : lengths) total += len;
+        REQUIRE( p->image_size() == static_cast<int64_t>(total) );
+
+        uint8_t buf[300];
+        for (uint64_t off = 0; off < total; off++) {
+            for (size_t len : {1, 50, 150, 300}) {
+                size_t want = std::min(static_cast<uint64_t>(len), total - off);
+                REQUIRE( p->pread(buf, len, off) == static_cast<ssize_t>(want) );
+                for (size_t j=0; j<want; j++) {
+                    REQUIRE( buf[j] == static_cast<uint8_t>((off + j) & 0xff) );
+                }
+            }
+        }
+        REQUIRE( p->pread(buf, 10, total) == 0 );
+        delete p;
+    }
+}
+
+/* Direct I/O must return the same bytes as buffered reads, for unaligned offsets, lengths and segment ends */
+TEST_CASE("raw_direct_io", "[phase1]") {
+    std::filesystem::path first = make_split_raw(NamedTemporaryDirectory(), {5000, 8192, 3, 12000});
+    image_process *p1 = image_process::open( first, false, 4096, 1024);
+    image_process *p2 = image_process::open( first, false, 4096, 1024);
+    p1->set_direct_io(true);
+    REQUIRE( (p1->io_mode()=="direct" || p1->io_mode()=="buffered") ); // the filesystem may not support it
+    REQUIRE( p2->io_mode()=="buffered" );
+    const uint64_t total = p1->image_size();
+    std::vector<uint8_t> b1(10000), b2(10000);
+    for (uint64_t off = 0; off < total; off += 997) {
+        for (size_t len : {1, 511, 4096, 10000}) {
+            ssize_t r2 = p2->pread(b2.data(), len, off);
+            REQUIRE( p1->pread(b1.data(), len, off) == r2 );
+            REQUIRE( memcmp(b1.data(), b2.data(), r2) == 0 );
+        }
+    }
+    auto it2 = p2->begin();
+    for (auto it1 = p1->begin(); it1!=p1->end(); ++it1, ++it2) {
+        sbuf_t *s1 = it1.sbuf_alloc();
+        sbuf_t *s2 = it2.sbuf_alloc();
+        REQUIRE( s1->bufsize == s2->bufsize );
+        REQUIRE( memcmp(s1->get_buf(), s2->get_buf(), s1->bufsize) == 0 );
+        delete s1;
+        delete s2;
+    }
+    delete p1;
+    delete p2;
+}
+
+/* Segment lookup on a 10,000 segment image. Set DEBUG_BENCHMARK to run it. */
+TEST_CASE("raw_segment_lookup_benchmark", "[phase1]") {
+    if (!getenv_debug("DEBUG_BENCHMARK")){
+        std::cerr << "DEBUG_BENCHMARK not set; skipping raw_segment_lookup_benchmark" << std::endl;
+        return;
+    }
+    const size_t segments = 10000;
+    const size_t lookups  = 1000000;
+    /* every segment stays open */
+    struct rlimit rl;
+    REQUIRE( getrlimit(RLIMIT_NOFILE, &rl) == 0 );
+    if (rl.rlim_cur < segments + 100) {
+        rl.rlim_cur = std::min(static_cast<rlim_t>(segments + 100), rl.rlim_max);
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+    REQUIRE( rl.rlim_cur >= segments + 100 );
+
+    std::map<std::string, std::vector<size_t>> layouts;
+    layouts["equal"] = std::vector<size_t>(segments, 512);
+    for (size_t i=0; i<segments; i++) layouts["uneven"].push_back(256 + (i * 7919) % 512);
+
+    for (const auto &[name, lengths] : layouts) {
+        std::filesystem::path first = make_split_raw(NamedTemporaryDirectory(), lengths);
+        image_process *p = image_process::open( first, false, 4096, 1024);
+        const uint64_t total = p->image_size();
+        std::vector<image_process::extent_t> extents;
+        uint64_t x = 1;
+        size_t found = 0;
+        auto t0 = std::chrono::steady_clock::now();
+        for (size_t i=0; i<lookups; i++) {
+            x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+            REQUIRE( p->get_extents((x >> 16) % total, 1, extents) );
+            found += extents.size();
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - t0;
+        REQUIRE( found == lookups );
+        std::cerr << name << " segments: "
+                  << lookups / elapsed.count() << " lookups/sec" << std::endl;
+        delete p;
+    }
+}
+
 TEST_CASE("e2e-email_test", "[end-to-end]") {
     if (getenv_debug("DEBUG_FAST")){
         std::cerr << "DEBUG_FAST set; skipping e2e-email_test" << std::endl;
@@ -464,6 +865,63 @@ TEST_CASE("restarter", "[restarter]") {
     REQUIRE( cfg.seen_page_ids.find("369098752+") == cfg.seen_page_ids.end() );
 }
 
+/* A restart with a checkpoint must not parse report.xml */
+TEST_CASE("restarter_checkpoint", "[restarter]") {
+    scanner_config   sc;
+    sc.outdir = NamedTemporaryDirectory();
+    std::filesystem::path fname = sc.outdir / Phase1::CHECKPOINT_FILENAME;
+    const uint64_t pagesize = 65536;
+    {
+        page_checkpoint cp(fname, 10 * pagesize + 1, pagesize);
+        REQUIRE( cp.npages == 11 );
+        cp.mark(0);
+        cp.mark(10);
+        cp.save();
+    }
+    {
+        page_checkpoint cp(fname, 10 * pagesize + 1, pagesize);
+        cp.load();
+        REQUIRE( cp.count() == 2 );
+        REQUIRE( cp.done(0) );
+        REQUIRE( !cp.done(5) );
+        REQUIRE( cp.done(10) );
+        cp.mark(5);
+        cp.save();
+    }
+    {
+        page_checkpoint cp(fname, 10 * pagesize + 1, pagesize);
+        cp.load();
+        REQUIRE( cp.count() == 3 );
+        page_checkpoint other(fname, 20 * pagesize, pagesize);
+        REQUIRE_THROWS_AS( other.load(), std::runtime_error );
+    }
+    REQUIRE( page_checkpoint::valid(fname, pagesize) );
+    REQUIRE( !page_checkpoint::valid(fname, pagesize * 2) );
+    {
+        /* --auto_pagesize pages span several units; partly covered units are not done */
+        page_checkpoint cp(sc.outdir / "ranges.bin", 10 * pagesize + 1, pagesize);
+        cp.mark_range(2 * pagesize, 4 * pagesize);
+        REQUIRE( cp.count() == 4 );
+        REQUIRE( cp.done_range(2 * pagesize, 4 * pagesize) );
+        REQUIRE( !cp.done_range(pagesize, 4 * pagesize) );
+        cp.mark_range(pagesize / 2, pagesize);
+        REQUIRE( !cp.done(0) );
+        REQUIRE( !cp.done(1) );
+        cp.mark_range(8 * pagesize, 2 * pagesize + 1);  // the short unit at the end
+        REQUIRE( cp.done(10) );
+    }
+
+    std::ofstream(sc.outdir / Phase1::REPORT_FILENAME) << "not xml\n"; // must not be parsed
+    Phase1::Config   cfg;
+    cfg.opt_pagesize = pagesize;
+    cfg.checkpoint_fname = fname;
+    bulk_extractor_restarter r(sc, cfg);
+    r.restart();
+    REQUIRE( cfg.restart_from_checkpoint );
+    REQUIRE( cfg.seen_page_ids.size() == 0 );
+    REQUIRE( std::filesystem::exists( sc.outdir / Phase1::REPORT_FILENAME ) == false );
+}
+
 
 /****************************************************************
  * Test restarter
@@ -492,6 +950,959 @@ TEST_CASE("image_process", "[phase1]") {
     delete p;
 }
 
+/* Reading with the margin cache must produce exactly the same sbufs as re-reading every margin */
+TEST_CASE("image_process_sequential_read", "[phase1]") {
+    image_process *p1 = image_process::open( test_dir() / "test_json.txt", false, 16, 8);
+    image_process *p2 = image_process::open( test_dir() / "test_json.txt", false, 16, 8);
+    p2->set_sequential_read(false);
+    auto it2 = p2->begin();
+    int times = 0;
+    for(auto it1 = p1->begin(); it1!=p1->end(); ++it1, ++it2){
+        sbuf_t *s1 = it1.sbuf_alloc();
+        sbuf_t *s2 = it2.sbuf_alloc();
+        REQUIRE( s1->pos0.offset == s2->pos0.offset );
+        REQUIRE( s1->bufsize == s2->bufsize );
+        REQUIRE( s1->pagesize == s2->pagesize );
+        REQUIRE( memcmp(s1->get_buf(), s2->get_buf(), s1->bufsize) == 0 );
+        if (s1->bufsize > 16) {
+            REQUIRE( it1.margin_offset == s1->pos0.offset + 16 );
+        }
+        delete s1;
+        delete s2;
+        times += 1;
+    }
+    REQUIRE(times==5);
+    delete p1;
+    delete p2;
+}
+
+/* Mapped pages must match read pages, and the mappings must be released with the image */
+TEST_CASE("image_process_mmap", "[phase1]") {
+    int64_t start_sbuf_count = sbuf_t::sbuf_count;
+    image_process *p1 = image_process::open( test_dir() / "test_json.txt", false, 16, 8);
+    image_process *p2 = image_process::open( test_dir() / "test_json.txt", false, 16, 8);
+    p1->set_mmap(true);
+    auto it2 = p2->begin();
+    std::vector<sbuf_t *> held;
+    for(auto it1 = p1->begin(); it1!=p1->end(); ++it1, ++it2){
+        sbuf_t *s1 = it1.sbuf_alloc();
+        sbuf_t *s2 = it2.sbuf_alloc();
+        REQUIRE( s1->pos0.offset == s2->pos0.offset );
+        REQUIRE( s1->bufsize == s2->bufsize );
+        REQUIRE( s1->pagesize == s2->pagesize );
+        REQUIRE( memcmp(s1->get_buf(), s2->get_buf(), s1->bufsize) == 0 );
+        held.push_back(s1);             // keep some pages alive while later ones are mapped
+        delete s2;
+    }
+    for (auto &s : held) delete s;
+    p1->reclaim();                      // frees the windows of the deleted pages without mapping another
+    REQUIRE( sbuf_t::sbuf_count == start_sbuf_count );
+    delete p1;
+    delete p2;
+    REQUIRE( sbuf_t::sbuf_count == start_sbuf_count );
+}
+
+/* Mapped pages must stay right when the page size grows, over chunks mapped for the smaller pages */
+TEST_CASE("image_process_mmap_pagesize", "[phase1]") {
+    int64_t start_sbuf_count = sbuf_t::sbuf_count;
+    std::filesystem::path first = make_split_raw(NamedTemporaryDirectory(), {2000});
+    image_process *p = image_process::open( first, false, 16, 8);
+    p->set_mmap(true);
+    std::vector<sbuf_t *> held;
+    for (auto it = p->begin(); it != p->end(); ++it) {
+        if (it.raw_offset == 256) {
+            for (auto &s : held) delete s;      // lets the first chunk be mapped again, larger
+            held.clear();
+            p->set_pagesize(64);
+        }
+        if (it.raw_offset == 1024) p->set_pagesize(128);
+        sbuf_t *s = it.sbuf_alloc();
+        REQUIRE( s->pos0.offset == it.raw_offset );
+        REQUIRE( s->pagesize == std::min<uint64_t>(p->pagesize, 2000 - s->pos0.offset) );
+        for (size_t j = 0; j < s->bufsize; j++) {
+            REQUIRE( s->get8u(j) == ((s->pos0.offset + j) & 0xff) );
+        }
+        held.push_back(s);              // pages still in use when the size changes at 1024
+    }
+    for (auto &s : held) delete s;
+    delete p;
+    REQUIRE( sbuf_t::sbuf_count == start_sbuf_count );
+}
+
+/* A fifo must be read once, in order, into the same pages as the file; skipped pages are read past */
+TEST_CASE("process_stream", "[phase1]") {
+    std::filesystem::path fifo = NamedTemporaryDirectory() / "image.fifo";
+    REQUIRE( mkfifo(fifo.string().c_str(), 0600) == 0 );
+    std::thread writer([&fifo] {
+        std::ifstream in(test_dir() / "test_json.txt", std::ios::binary);
+        std::ofstream out(fifo, std::ios::binary);
+        out << in.rdbuf();
+    });
+    image_process *p1 = image_process::open( fifo, false, 16, 8);
+    image_process *p2 = image_process::open( test_dir() / "test_json.txt", false, 16, 8);
+    REQUIRE( !p1->seekable() );
+    REQUIRE( p2->seekable() );
+    auto it2 = p2->begin();
+    int times = 0;
+    for(auto it1 = p1->begin(); it1!=p1->end(); ++it1, ++it2){
+        REQUIRE( it1.raw_offset == it2.raw_offset );
+        if (it1.page_number == 2) continue;
+        sbuf_t *s1 = it1.sbuf_alloc();
+        sbuf_t *s2 = it2.sbuf_alloc();
+        REQUIRE( s1->pos0.offset == s2->pos0.offset );
+        REQUIRE( s1->bufsize == s2->bufsize );
+        REQUIRE( s1->pagesize == s2->pagesize );
+        REQUIRE( memcmp(s1->get_buf(), s2->get_buf(), s1->bufsize) == 0 );
+        delete s1;
+        delete s2;
+        times += 1;
+    }
+    writer.join();
+    REQUIRE( times==4 );
+    REQUIRE( p1->image_size() == p2->image_size() );
+    delete p1;
+    delete p2;
+}
+
+/* The read-ahead stage must deliver the same pages, in order, as reading them one at a time */
+TEST_CASE("async_reader", "[phase1]") {
+    image_process *p1 = image_process::open( test_dir() / "test_json.txt", false, 16, 8);
+    image_process *p2 = image_process::open( test_dir() / "test_json.txt", false, 16, 8);
+    {
+        async_reader reader(*p1, 3, 2, [](const pos0_t &, const std::function<sbuf_t *()> &make, std::vector<std::string> &) {
+            return make();
+        });
+        for(auto it = p1->begin(); it!=p1->end(); ++it){
+            reader.submit(it);
+        }
+        REQUIRE( reader.in_flight() == 5 );
+        int times = 0;
+        for(auto it2 = p2->begin(); it2!=p2->end(); ++it2){
+            async_reader::page_t page = reader.next();
+            REQUIRE( !page.error );
+            sbuf_t *s2 = it2.sbuf_alloc();
+            REQUIRE( page.pos0.offset == s2->pos0.offset );
+            REQUIRE( page.sbuf->bufsize == s2->bufsize );
+            REQUIRE( page.sbuf->pagesize == s2->pagesize );
+            REQUIRE( memcmp(page.sbuf->get_buf(), s2->get_buf(), s2->bufsize) == 0 );
+            delete page.sbuf;
+            delete s2;
+            times += 1;
+        }
+        REQUIRE( times==5 );
+        REQUIRE( reader.empty() );
+    }
+    delete p1;
+    delete p2;
+}
+
+/* Holes in sparse files are found without reading them; data is never reported as a hole */
+TEST_CASE("raw_is_hole", "[phase1]") {
+    std::filesystem::path fname = NamedTemporaryDirectory() / "sparse.raw";
+    {
+        std::ofstream of(fname, std::ios::out | std::ios::binary);
+        of.seekp(65536);
+        std::string data(65536, 'x');
+        of.write(data.c_str(), data.size());
+    }
+    std::filesystem::resize_file(fname, 3 * 65536); // trailing hole
+    image_process *p = image_process::open( fname, false, 65536, 4096);
+    REQUIRE( p->is_hole(65536, 10) == false );
+    REQUIRE( p->is_hole(60000, 10000) == false ); // runs into the data
+    REQUIRE( p->is_hole(130000, 2000) == false );
+    if (p->is_hole(0, 65536)) {                 // only if the filesystem supports holes
+        REQUIRE( p->is_hole(131072, 65536) == true );
+    }
+    delete p;
+
+    const uint8_t zeros[100] {};
+    uint8_t mixed[100] {};
+    mixed[99] = 1;
+    REQUIRE( Phase1::constant_buf(zeros, sizeof(zeros)) );
+    REQUIRE( !Phase1::constant_buf(mixed, sizeof(mixed)) );
+    REQUIRE( !Phase1::constant_buf(zeros, 0) );
+}
+
+/* Blocks are found once added, only under the same configuration, and only after a commit once the store is reopened */
+TEST_CASE("block_hash_store", "[phase1]") {
+    uint64_t h1 = 0, h2 = 0;
+    const std::string fox("The quick brown fox jumps over the lazy dog");
+    block_hash_store::hash128(reinterpret_cast<const uint8_t *>(fox.data()), fox.size(), 0, h1, h2);
+    REQUIRE( h1 == 0xe34bbc7bbc071b6cULL ); // MurmurHash3_x64_128 reference value
+    REQUIRE( h2 == 0x7a433ca9c49a9347ULL );
+
+    std::filesystem::path fname = NamedTemporaryDirectory() / "blocks.db";
+    std::vector<uint8_t> a(8192), b(4096);
+    for (size_t i = 0; i < a.size(); i++) a[i] = i * 13 + i / block_hash_store::BLOCK_SIZE; // two different blocks
+    for (size_t i = 0; i < b.size(); i++) b[i] = i * 7 + 1;
+    {
+        block_hash_store store(fname, 2000, "cfg");
+        REQUIRE( store.check_and_add(a.data(), a.size(), a.size()) == false );
+        REQUIRE( store.check_and_add(a.data(), a.size(), a.size()) == true );
+        REQUIRE( store.blocks_checked == 4 );
+        REQUIRE( store.blocks_added == 2 );
+        store.commit();
+    }
+    {
+        block_hash_store store(fname, 0, "other");
+        REQUIRE( store.check_and_add(a.data(), a.size(), a.size()) == false );
+    }
+    {
+        block_hash_store store(fname, 0, "cfg");
+        REQUIRE( store.check_and_add(a.data(), a.size(), a.size()) == true );
+        REQUIRE( store.check_and_add(b.data(), b.size(), b.size()) == false );
+        // no commit, as if the run had died
+    }
+    {
+        block_hash_store store(fname, 0, "cfg");
+        REQUIRE( store.check_and_add(b.data(), b.size(), b.size()) == false );
+        REQUIRE( store.check_and_add(b.data(), b.size(), b.size()) == true );
+        REQUIRE_THROWS_AS( block_hash_store(fname, 0, "cfg"), std::runtime_error ); // locked by this one
+    }
+
+    /* the margin must have been seen, but is not added as scanned */
+    {
+        block_hash_store store(NamedTemporaryDirectory() / "margin.db", 2000, "cfg");
+        REQUIRE( store.check_and_add(a.data(), 4096, a.size()) == false );
+        REQUIRE( store.check_and_add(a.data(), 4096, a.size()) == false );
+        REQUIRE( store.blocks_checked == 2 );
+        REQUIRE( store.blocks_added == 1 );
+        REQUIRE( store.check_and_add(a.data() + 4096, 4096, 4096) == false );
+        REQUIRE( store.check_and_add(a.data(), 4096, a.size()) == true );
+    }
+    std::filesystem::path other = fname.parent_path() / "not_a_store";
+    std::ofstream(other) << "hello world, this is not a block hash store\n";
+    REQUIRE_THROWS_AS( block_hash_store(other, 0, "cfg"), std::runtime_error );
+}
+
+/* Both database formats must find exactly the blocks they were built from */
+TEST_CASE("known_blocks", "[phase1]") {
+    std::filesystem::path dir = NamedTemporaryDirectory();
+    std::vector<uint8_t> blocks(4 * known_blocks::BLOCK_SIZE);
+    for (size_t i = 0; i < blocks.size(); i++) blocks[i] = i * 31 + i / known_blocks::BLOCK_SIZE;
+    const uint8_t *block1 = blocks.data() + known_blocks::BLOCK_SIZE;
+    const uint8_t *block3 = blocks.data() + 3 * known_blocks::BLOCK_SIZE;
+
+    std::vector<known_blocks::digest_t> digests(2);
+    memcpy(digests[0].data(), dfxml::md5_generator::hash_buf(block3, known_blocks::BLOCK_SIZE).digest, 16);
+    memcpy(digests[1].data(), dfxml::md5_generator::hash_buf(block1, known_blocks::BLOCK_SIZE).digest, 16);
+    known_blocks::write(dir / "known.bin", digests);
+    {
+        std::ofstream of(dir / "known.txt");
+        of << "# block hashes\n";
+        of << dfxml::md5_generator::hash_buf(block1, known_blocks::BLOCK_SIZE).hexdigest() << "\tfile1.dll\n";
+        of << dfxml::md5_generator::hash_buf(block3, known_blocks::BLOCK_SIZE).hexdigest() << "\n";
+    }
+    for (auto name : {"known.bin", "known.txt"}) {
+        known_blocks kb(dir / name);
+        REQUIRE( kb.size() == 2 );
+        for (size_t i = 0; i < 4; i++) {
+            REQUIRE( kb.contains(blocks.data() + i * known_blocks::BLOCK_SIZE) == (i==1 || i==3) );
+        }
+        REQUIRE( kb.blocks_checked == 4 );
+        REQUIRE( kb.blocks_found == 2 );
+        REQUIRE( kb.lookup(blocks.data(), 4).get() == std::vector<bool>{false, true, false, true} );
+        REQUIRE( kb.blocks_checked == 8 );
+    }
+    REQUIRE_THROWS_AS( known_blocks(dir / "missing"), std::runtime_error );
+
+    /* A binary database must have as many digests as its count says, in order */
+    std::string bin;
+    {
+        std::ifstream in(dir / "known.bin", std::ios::binary);
+        bin.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+    REQUIRE( bin.size() == 16 + 2 * 16 );
+    std::ofstream(dir / "unsorted.bin", std::ios::binary) << bin.substr(0, 16) << bin.substr(32, 16) << bin.substr(16, 16);
+    REQUIRE_THROWS_AS( known_blocks(dir / "unsorted.bin"), std::runtime_error );
+    std::string bad_count = bin;
+    bad_count[8] = 3;
+    std::ofstream(dir / "short.bin", std::ios::binary) << bad_count;
+    REQUIRE_THROWS_AS( known_blocks(dir / "short.bin"), std::runtime_error );
+    bad_count[15] = 0x10;               // a count that overflows when multiplied by the digest size
+    bad_count[8] = 2;
+    std::ofstream(dir / "overflow.bin", std::ios::binary) << bad_count;
+    REQUIRE_THROWS_AS( known_blocks(dir / "overflow.bin"), std::runtime_error );
+}
+
+/* The budget counts pages and reservations; a decoder waits for room only while another thread holds some */
+TEST_CASE("memory_budget", "[phase1]") {
+    memory_budget::set_limit(0);
+    memory_budget::set_pages(0);
+    REQUIRE( memory_budget::available(1ULL << 40) );
+    {
+        memory_budget::reservation r(1000);
+        REQUIRE( memory_budget::in_use() == 1000 );
+    }
+    REQUIRE( memory_budget::in_use() == 0 );
+
+    memory_budget::set_limit(10000);
+    memory_budget::set_pages(8000);
+    REQUIRE( memory_budget::available(2000) );
+    REQUIRE( !memory_budget::available(2001) );
+    /* nothing else holds memory, so this goes over; a nested reservation in the same thread does not wait */
+    auto r = std::make_unique<memory_budget::reservation>(5000);
+    auto nested = std::make_unique<memory_budget::reservation>(5000);
+    REQUIRE( memory_budget::in_use() == 18000 );
+    REQUIRE( memory_budget::peak() >= 18000 );
+
+    const uint64_t deferred = memory_budget::deferred;
+    std::atomic<bool> got {false};
+    std::thread other([&got] {
+        memory_budget::reservation r2(1000);
+        got = true;
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    REQUIRE( !got );
+    nested.reset();
+    r.reset();
+    other.join();
+    REQUIRE( got );
+    REQUIRE( memory_budget::deferred == deferred + 1 );
+    REQUIRE( memory_budget::in_use() == 8000 );
+    memory_budget::set_limit(0);
+    memory_budget::set_pages(0);
+}
+
+/* Nodes come from sysfs, memory-only nodes are left out, and threads are spread by CPUs */
+TEST_CASE("numa_topology", "[phase1]") {
+    REQUIRE( numa_topology::parse_cpulist("0-3,8,10-11\n") == std::vector<int>{0, 1, 2, 3, 8, 10, 11} );
+    REQUIRE( numa_topology::parse_cpulist("").empty() );
+
+    std::filesystem::path sysfs = NamedTemporaryDirectory();
+    for (auto name : {"node0", "node1", "node2", "possible"}) {
+        std::filesystem::create_directories(sysfs / name);
+    }
+    std::ofstream(sysfs / "node0" / "cpulist") << "0-5\n";
+    std::ofstream(sysfs / "node1" / "cpulist") << "6,7\n";
+    std::ofstream(sysfs / "node2" / "cpulist") << "\n";
+    numa_topology numa(sysfs);
+    REQUIRE( numa.size() == 2 );
+    REQUIRE( numa.nodes[1].id == 1 );
+    auto where = numa.spread(8);
+    REQUIRE( std::count(where.begin(), where.end(), 0) == 6 );
+    REQUIRE( numa_topology(sysfs / "missing").size() == 0 );
+    REQUIRE( numa_topology::threads().count(getpid()) == 1 );
+
+    /* be2 deals the tasks of a page to the workers of its node, and counts where they ran */
+    std::ofstream(sysfs / "node0" / "cpulist") << "0\n";
+    std::ofstream(sysfs / "node1" / "cpulist") << "0\n";
+    numa_topology two(sysfs);
+    REQUIRE( two.size() == 2 );
+    static const uint8_t zeros[64] {};
+    std::vector<sbuf_scheduler::scanner_fn_t> scanners;
+    for (auto name : {"a", "b", "c"}) {
+        scanners.push_back({name, [](const sbuf_t &) { std::this_thread::sleep_for(std::chrono::microseconds(100)); }});
+    }
+    sbuf_scheduler sched(scanners, 4, true, nullptr, nullptr, 0, nullptr, nullptr, &two);
+    for (size_t i = 0; i < 40; i++) {
+        sched.submit(sbuf_t::sbuf_new(pos0_t("", i), zeros, sizeof(zeros), sizeof(zeros)), i % 2);
+    }
+    sched.join();
+    REQUIRE( sched.numa_stats(0).pages == 20 );
+    REQUIRE( sched.numa_stats(1).pages == 20 );
+    uint64_t local = 0, remote = 0;
+    for (size_t n = 0; n < two.size(); n++) {
+        local += sched.numa_stats(n).tasks_local;
+        remote += sched.numa_stats(n).tasks_remote;
+    }
+    REQUIRE( local + remote == 40 * scanners.size() );
+    REQUIRE( local > 0 );
+}
+
+/* Pages grow when they are quick and shrink when slow, within the margin, the memory budget and the image left */
+TEST_CASE("page_tuner", "[phase1]") {
+    const uint64_t MiB = 1024 * 1024;
+    page_tuner::inputs_t in;
+    in.pagesize = 16 * MiB;
+    in.margin = 4 * MiB;
+    in.workers = 4;
+    in.bytes_left = 1ULL << 40;
+
+    REQUIRE( page_tuner::choose(in).pagesize == 16 * MiB );     // nothing measured
+    in.page_seconds = 5;
+    REQUIRE( page_tuner::choose(in).pagesize == 16 * MiB );     // within [MIN_SECONDS, MAX_SECONDS]
+
+    in.page_seconds = 0.1;                                      // 30x too quick
+    REQUIRE( page_tuner::choose(in).pagesize == 256 * MiB );
+    in.page_seconds = 0.5;                                      // 6x: 96 MiB, rounded down
+    REQUIRE( page_tuner::choose(in).pagesize == 64 * MiB );
+    in.page_seconds = 100;                                      // shrinks, but not below the margin
+    REQUIRE( page_tuner::choose(in).pagesize == 4 * MiB );
+    in.margin = 0;
+    REQUIRE( page_tuner::choose(in).pagesize == page_tuner::MIN_PAGESIZE );
+
+    in.page_seconds = 0.1;
+    in.memory_per_page = 16 * MiB;
+    in.memory_left = 256 * MiB;                                 // 2 pages for each of 4 workers
+    auto choice = page_tuner::choose(in);
+    REQUIRE( choice.pagesize == 32 * MiB );
+    REQUIRE( choice.reason.find("memory") != std::string::npos );
+
+    in.memory_left = 0;
+    in.bytes_left = 256 * MiB;                                  // 4 pages for each of 4 workers
+    REQUIRE( page_tuner::choose(in).pagesize == 16 * MiB );
+
+    for (double s : {0.01, 0.3, 0.7, 2.0, 13.0, 77.0}) {
+        in.page_seconds = s;
+        uint64_t ps = page_tuner::choose(in).pagesize;
+        REQUIRE( ps % page_tuner::MIN_PAGESIZE == 0 );
+        REQUIRE( (ps & (ps - 1)) == 0 );
+    }
+}
+
+/* Sampled runs must match the per-block decision, passes must not overlap, and the same seed must give the same sample */
+TEST_CASE("block_sampler", "[phase1]") {
+    const uint64_t max_blocks = 100000;
+    for (auto mode : {block_sampler::BERNOULLI, block_sampler::STRATIFIED}) {
+        block_sampler s1(max_blocks, 0.25, 3, 42, mode);
+        std::vector<unsigned> times_sampled(max_blocks);
+        std::vector<uint64_t> per_pass(3);
+        uint64_t start = 0, count = 0, last_end = 0;
+        unsigned last_pass = 0;
+        while (s1.next(start, count)) {
+            REQUIRE( count > 0 );
+            if (s1.get_pass() == last_pass) {
+                REQUIRE( start > last_end ); // runs are in order, and adjacent blocks were merged
+            }
+            for (uint64_t b = start; b < start + count; b++) {
+                REQUIRE( s1.sampled(b, s1.get_pass()) );
+                times_sampled[b]++;
+            }
+            per_pass[s1.get_pass()] += count;
+            last_end  = start + count;
+            last_pass = s1.get_pass();
+        }
+        REQUIRE( *std::max_element(times_sampled.begin(), times_sampled.end()) == 1 );
+        for (auto n : per_pass) {
+            REQUIRE( n > max_blocks * 0.24 );
+            REQUIRE( n < max_blocks * 0.26 );
+        }
+        block_sampler s2(max_blocks, 0.25, 1, 42, mode);
+        block_sampler s3(max_blocks, 0.25, 1, 43, mode);
+        int differ = 0;
+        for (uint64_t b = 0; b < 1000; b++) {
+            REQUIRE( s2.sampled(b, 0) == s1.sampled(b, 0) );
+            if (s3.sampled(b, 0) != s2.sampled(b, 0)) differ++;
+        }
+        REQUIRE( differ > 0 );
+
+        /* next_pass() leaves the rest of a pass, as Phase 1 does at -Y; the later passes are still sampled */
+        block_sampler s4(max_blocks, 0.25, 3, 42, mode);
+        std::vector<uint64_t> first_blocks(3, max_blocks);
+        while (s4.next(start, count)) {
+            first_blocks[s4.get_pass()] = std::min(first_blocks[s4.get_pass()], start);
+            if (start >= max_blocks / 2) s4.next_pass();
+        }
+        for (auto b : first_blocks) REQUIRE( b < max_blocks / 2 );
+    }
+    REQUIRE_THROWS_AS( block_sampler(1000, 0.5, 3, 0, block_sampler::BERNOULLI), std::invalid_argument );
+    REQUIRE_THROWS_AS( block_sampler::mode_for("reservoir"), std::invalid_argument );
+}
+
+/* The hashing stage must produce the digests of the whole file, and none after a gap */
+TEST_CASE("image_hasher", "[phase1]") {
+    image_process *p = image_process::open( test_dir() / "test_json.txt", false, 16, 8);
+    {
+        image_hasher hasher("sha1,sha256,md5", 2);
+        for(auto it = p->begin(); it!=p->end(); ++it){
+            sbuf_t *sbuf = it.sbuf_alloc();
+            hasher.update(*sbuf);
+            delete sbuf;                // the hasher keeps its own copy
+        }
+        auto digests = hasher.digests();
+        REQUIRE( digests.size() == 3 );
+        REQUIRE( digests[0] == std::make_pair(std::string("SHA1"),   std::string("efae75a8e244b7c95b8074e4f09933c2d31b3a62")));
+        REQUIRE( digests[1] == std::make_pair(std::string("SHA256"), std::string("a9d2687f74e6a33e487449327fe103de1c7a9eb97754cc92fdfac6b6f34a0f36")));
+        REQUIRE( digests[2] == std::make_pair(std::string("MD5"),    std::string("28532c5696140d3958b17d0ec2a536f0")));
+    }
+    {
+        image_hasher hasher("sha1");
+        auto it = p->begin();
+        ++it;                           // skip the first page
+        sbuf_t *sbuf = it.sbuf_alloc();
+        hasher.update(*sbuf);
+        delete sbuf;
+        REQUIRE( hasher.gap() );
+        REQUIRE( hasher.digests().size() == 0 );
+    }
+    REQUIRE_THROWS_AS( image_hasher("sha3"), std::invalid_argument );
+    delete p;
+}
+
+/* Every scanner must see every page once, in both modes, and every page must be freed */
+TEST_CASE("sbuf_scheduler", "[phase1]") {
+    static const uint8_t buf[64] {};
+    const size_t npages = 200;
+    for (bool per_scanner : {false, true}) {
+        int64_t start_sbuf_count = sbuf_t::sbuf_count;
+        std::vector<std::atomic<unsigned>> seen(npages * 3);
+        std::atomic<unsigned> done {0};
+        std::vector<sbuf_scheduler::scanner_fn_t> scanners;
+        for (size_t s = 0; s < 3; s++) {
+            scanners.push_back({"s" + std::to_string(s), [&seen, s](const sbuf_t &sbuf) {
+                seen[sbuf.pos0.offset * 3 + s] += 1;
+                if (s == 2 && sbuf.pos0.offset == 7) throw std::runtime_error("scanner failed");
+                if (s == 1 && sbuf.pos0.offset == 9) throw 9;   // not a std::exception
+            }});
+        }
+        {
+            sbuf_scheduler sched(scanners, 4, per_scanner, [&done](const sbuf_t &) { done += 1; });
+            for (size_t i = 0; i < npages; i++) {
+                while (sched.pages_in_flight() > 8) sched.wait();
+                sched.submit(sbuf_t::sbuf_new(pos0_t("", i), buf, sizeof(buf), sizeof(buf)));
+            }
+            sched.join();
+            REQUIRE( sched.pages_done() == npages );
+            REQUIRE( sched.tasks_run() == (per_scanner ? npages * 3 : npages) );
+            REQUIRE( sched.scanner_errors() == 2 );
+            auto errors = sched.errors_seen();
+            REQUIRE( errors.size() == 2 );
+            std::sort(errors.begin(), errors.end(), [](const auto &a, const auto &b) { return a.scanner < b.scanner; });
+            REQUIRE( errors[0].scanner == "s1" );
+            REQUIRE( errors[0].what == "unknown exception" );
+            REQUIRE( errors[1].scanner == "s2" );
+            REQUIRE( errors[1].pos0 == pos0_t("", 7).str() );
+            REQUIRE( errors[1].what == "scanner failed" );
+            REQUIRE( sched.stats(1).calls == npages );
+            REQUIRE( sched.page_seconds(0.5) <= sched.page_seconds(1.0) );
+        }
+        REQUIRE( done == npages );
+        for (const auto &n : seen) REQUIRE( n == 1 );
+        REQUIRE( sbuf_t::sbuf_count == start_sbuf_count );
+    }
+}
+
+/* A recursive sbuf must be a task of the page it came from: scanned once, freed, and done before the page is */
+TEST_CASE("sbuf_scheduler_recursion", "[phase1]") {
+    const uint32_t npages = 50;
+    int64_t start_sbuf_count = sbuf_t::sbuf_count;
+    std::vector<std::atomic<int>> children_left(npages); // of each page, queued and not yet scanned
+    std::atomic<unsigned> scanned {0}, refused {0}, early {0};
+    /* the page number is in the first bytes of each sbuf; each sbuf above depth 2 has two children */
+    auto spawn = [&](const sbuf_t &sbuf) {
+        if (sbuf.depth() >= 2) return;
+        const uint32_t page = sbuf.get32u(0);
+        for (int i = 0; i < 2; i++) {
+            children_left[page] += 1;
+            sbuf_t *child = sbuf_t::sbuf_new(sbuf.pos0 + "TEST", reinterpret_cast<const uint8_t *>(&page), sizeof(page), sizeof(page));
+            if (!sbuf_scheduler::offer(child)) {
+                refused += 1;
+                delete child;
+            }
+        }
+    };
+    std::vector<sbuf_scheduler::scanner_fn_t> scanners;
+    scanners.push_back({"spawn", spawn});
+    scanners.push_back({"other", [](const sbuf_t &) {}});
+    auto process = [&](sbuf_t *sbuf) {
+        spawn(*sbuf);
+        scanned += 1;
+        children_left[sbuf->get32u(0)] -= 1;
+        delete sbuf;
+    };
+    {
+        sbuf_scheduler sched(scanners, 4, true,
+                             [&](const sbuf_t &sbuf) { if (children_left[sbuf.get32u(0)] != 0) early += 1; },
+                             process, 1);
+        for (uint32_t i = 0; i < npages; i++) {
+            sched.submit(sbuf_t::sbuf_new(pos0_t("", i), reinterpret_cast<const uint8_t *>(&i), sizeof(i), sizeof(i)));
+        }
+        sched.join();
+        REQUIRE( sched.pages_done() == npages );
+        auto depths = sched.depth_stats();
+        REQUIRE( depths.size() == 2 );
+        REQUIRE( depths[1].tasks == npages * 2 );
+        REQUIRE( depths[2].tasks == npages * 4 );
+        REQUIRE( depths[1].max_running == 1 );
+        REQUIRE( depths[2].max_running == 1 );
+        REQUIRE( depths[2].max_queued <= sbuf_scheduler::QUEUE_PER_DEPTH_WORKER );
+    }
+    REQUIRE( refused == 0 );
+    REQUIRE( scanned == npages * 6 );
+    REQUIRE( early == 0 );
+    REQUIRE( sbuf_t::sbuf_count == start_sbuf_count );
+    REQUIRE( memory_budget::in_use() == 0 );  // the queued sbufs' bytes were released
+
+    /* with no room in the memory budget, the worker that finds a recursive sbuf scans it */
+    memory_budget::set_limit(1);
+    scanned = 0;
+    {
+        sbuf_scheduler sched(scanners, 4, true, nullptr, process, 1);
+        for (uint32_t i = 0; i < npages; i++) {
+            sched.submit(sbuf_t::sbuf_new(pos0_t("", i), reinterpret_cast<const uint8_t *>(&i), sizeof(i), sizeof(i)));
+        }
+        sched.join();
+        auto depths = sched.depth_stats();
+        REQUIRE( depths[1].inlined == npages * 2 );
+        REQUIRE( depths[2].inlined == npages * 4 );
+        REQUIRE( depths[1].max_queued == 0 );
+    }
+    memory_budget::set_limit(0);
+    REQUIRE( scanned == npages * 6 );
+    REQUIRE( sbuf_t::sbuf_count == start_sbuf_count );
+
+    /* outside of a scheduler the scanner recurses as before */
+    uint32_t page = 0;
+    sbuf_t *sbuf = sbuf_t::sbuf_new(pos0_t("", 0), reinterpret_cast<const uint8_t *>(&page), sizeof(page), sizeof(page));
+    REQUIRE( !sbuf_scheduler::offer(sbuf) );
+    delete sbuf;
+}
+
+/* A scope past the budget must be flagged, and recorded with its scanner and pos0 */
+TEST_CASE("scanner_watchdog", "[phase1]") {
+    static const uint8_t buf[16] {};
+    sbuf_t *sbuf = sbuf_t::sbuf_new(pos0_t("", 4096), buf, sizeof(buf), sizeof(buf));
+    const std::string name("slow");
+    {
+        scanner_watchdog::scope budget(name, *sbuf); // no budget
+        REQUIRE( !budget.expired() );
+    }
+    scanner_watchdog::start(0.2);
+    {
+        scanner_watchdog::scope budget(name, *sbuf);
+        REQUIRE( !budget.expired() );
+        auto t0 = std::chrono::steady_clock::now();
+        while (!budget.expired() && std::chrono::steady_clock::now() - t0 < std::chrono::seconds(10)) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+        REQUIRE( budget.expired() );
+        scanner_watchdog::scope inner(name, *sbuf);   // joins the scope above
+        REQUIRE( inner.expired() );
+        REQUIRE( scanner_watchdog::expired() );
+    }
+    {
+        scanner_watchdog::scope quick(name, *sbuf);
+        REQUIRE( !quick.expired() );
+    }
+    auto overruns = scanner_watchdog::stop();
+    REQUIRE( overruns.size() == 1 );
+    REQUIRE( scanner_watchdog::overruns == 1 );
+    REQUIRE( overruns[0].scanner == "slow" );
+    REQUIRE( overruns[0].pos0 == sbuf->pos0.str() );
+    REQUIRE( overruns[0].seconds >= 0.2 );
+    REQUIRE( overruns[0].stopped );
+    REQUIRE( !scanner_watchdog::expired() );
+    delete sbuf;
+}
+
+/* Each kind of block must get its class, and no key schedule may start in a block scan_aes skips */
+TEST_CASE("page_classifier", "[phase1]") {
+    const size_t BS = page_classifier::BLOCK_SIZE;
+    std::vector<uint8_t> buf(BS * 7);
+    uint64_t x = 88172645463325252ULL;  // xorshift64, for bytes that look encrypted
+    auto random_byte = [&x]() { x ^= x << 13; x ^= x >> 7; x ^= x << 17; return static_cast<uint8_t>(x >> 24); };
+    const std::string text("The quick brown fox jumps over the lazy dog.\n");
+    for (size_t i = 0; i < BS; i++) {
+        buf[BS + i]     = text[i % text.size()];                     // text
+        buf[BS * 2 + i] = (i % 2) ? 0 : text[(i / 2) % text.size()]; // UTF-16LE
+        buf[BS * 3 + i] = random_byte();                             // high-entropy
+        buf[BS * 4 + i] = random_byte();
+        buf[BS * 5 + i] = random_byte();                             // high-entropy, but with a word in it
+        buf[BS * 6 + i] = (i < BS / 2) ? text[i % text.size()] : 0;  // mixed
+    }
+    memcpy(&buf[BS * 5 + 1000], "someone@example.com", 19);
+    page_classifier::map_t map = page_classifier::classify(buf.data(), buf.size());
+    REQUIRE( map == page_classifier::map_t{page_classifier::ZERO, page_classifier::TEXT, page_classifier::UTF16,
+                                           page_classifier::ENTROPY, page_classifier::ENTROPY,
+                                           page_classifier::MIXED, page_classifier::MIXED} );
+    REQUIRE( page_classifier::classify(buf.data(), BS + 10).size() == 2 );
+    REQUIRE( page_classifier::text_bytes(&buf[BS], BS) == BS );
+    REQUIRE( page_classifier::text_bytes(&buf[0], BS) == 0 );
+    REQUIRE( std::string(page_classifier::class_name(page_classifier::UTF16)) == "utf16" );
+    REQUIRE( page_classifier::class_index(page_classifier::MIXED) == 4 );
+
+    /* a block is skipped only if the next one is too */
+    const uint8_t aes = page_classifier::interest("aes");
+    const uint8_t email = page_classifier::interest("email");
+    REQUIRE( page_classifier::interest("zip") == page_classifier::ALL );
+    REQUIRE( !page_classifier::may_start_in(map, 0, aes) );
+    REQUIRE( page_classifier::may_start_in(map, 2, aes) );      // the next is high-entropy
+    REQUIRE( !page_classifier::may_start_in(map, 3, email) );
+    REQUIRE( page_classifier::may_start_in(map, 4, email) );
+    REQUIRE( !page_classifier::may_start_before(map, BS * 2, aes) );
+    REQUIRE( page_classifier::may_start_before(map, BS * 2 + 1, aes) );
+
+    /* a key schedule split across two text blocks makes at least one of them something else */
+    std::vector<uint8_t> page(BS * 2);
+    for (size_t i = 0; i < page.size(); i++) page[i] = text[i % text.size()];
+    for (size_t split = 0; split <= 176; split += 8) {
+        std::vector<uint8_t> p2(page);
+        for (size_t i = 0; i < 176; i++) p2[BS - split + i] = random_byte();
+        map = page_classifier::classify(p2.data(), p2.size());
+        REQUIRE( page_classifier::may_start_in(map, split ? 0 : 1, aes) );
+    }
+
+    /* the scheduler asks a gate once per page and leaves out the scanners it says no to */
+    static const uint8_t zeros[64] {};
+    std::atomic<unsigned> gated {0}, ran {0}, ran_skipped {0};
+    std::vector<sbuf_scheduler::scanner_fn_t> scanners;
+    scanners.push_back({"run", [&ran](const sbuf_t &) { ran += 1; }});
+    scanners.push_back({"skip", [&ran_skipped](const sbuf_t &) { ran_skipped += 1; }});
+    {
+        sbuf_scheduler sched(scanners, 4, true, nullptr, nullptr, 0,
+                             [&gated](const sbuf_t &) { gated += 1; return std::vector<bool>{true, false}; });
+        for (size_t i = 0; i < 20; i++) {
+            sched.submit(sbuf_t::sbuf_new(pos0_t("", i), zeros, sizeof(zeros), sizeof(zeros)));
+        }
+        sched.join();
+        REQUIRE( sched.stats(1).skipped == 20 );
+        REQUIRE( sched.stats(1).calls == 0 );
+    }
+    REQUIRE( gated == 20 );
+    REQUIRE( ran == 20 );
+    REQUIRE( ran_skipped == 0 );
+
+    /* pages that the whole_t picks go to process_t instead, and their scanners' tasks do nothing */
+    std::atomic<unsigned> processed {0};
+    ran = 0;
+    {
+        sbuf_scheduler sched(scanners, 4, true, nullptr,
+                             [&processed](sbuf_t *sbuf) { processed += 1; delete sbuf; }, 0, nullptr,
+                             [](const sbuf_t &sbuf) { return sbuf.pos0.offset % 2 == 0; });
+        for (size_t i = 0; i < 20; i++) {
+            sched.submit(sbuf_t::sbuf_new(pos0_t("", i), zeros, sizeof(zeros), sizeof(zeros)));
+        }
+        sched.join();
+        REQUIRE( sched.pages_whole() == 10 );
+        REQUIRE( sched.stats(0).skipped == 10 );
+    }
+    REQUIRE( processed == 10 );
+    REQUIRE( ran == 10 );
+}
+
+/* Every signature must be found where it is, once per sbuf and thread, and nowhere else */
+TEST_CASE("sbuf_signatures", "[phase1]") {
+    std::vector<uint8_t> buf(8192);
+    auto plant = [&buf](size_t pos, const std::vector<uint8_t> &bytes) { std::copy(bytes.begin(), bytes.end(), buf.begin() + pos); };
+    plant(100, {0x50, 0x4b, 0x03, 0x04});
+    plant(200, {0x1f, 0x8b, 0x08});
+    plant(300, {0x7f, 'E', 'L', 'F'});
+    plant(400, {0xff, 0xd8, 0xff, 0xe1});
+    plant(450, {0xff, 0xd8, 0xff, 0x00});       // not a JPEG
+    plant(500, {'8', 'B', 'P', 'S', 0x00, 0x01});
+    plant(600, {'I', 'I', 42, 0});
+    plant(700, {'M', 'M', 0, 42});
+    plant(800, {0x4c, 0, 0, 0, 0x01, 0x14, 0x02, 0, 0, 0, 0, 0, 0xc0, 0, 0, 0, 0, 0, 0, 0x46});
+    plant(1000, {'S', 'Q', 'L', 'i', 't', 'e', ' ', 'f', 'o', 'r', 'm', 'a', 't', ' ', '3', 0});
+    plant(2000, {0x81, 0x81, 0x78, 0x70, 0x72, 0x65, 0x73, 0x73});
+    plant(3000, {0x50, 0x4b, 0x03, 0x04});
+    plant(buf.size() - 6, {0x7f, 'E', 'L', 'F'});
+    plant(buf.size() - 2, {0x50, 0x4b});        // runs off the end
+
+    sbuf_signatures::hits_t hits = sbuf_signatures::scan(buf.data(), buf.size());
+    REQUIRE( hits.offsets[sbuf_signatures::ZIP] == std::vector<size_t>{100, 3000} );
+    REQUIRE( hits.offsets[sbuf_signatures::GZIP] == std::vector<size_t>{200} );
+    REQUIRE( hits.offsets[sbuf_signatures::ELF] == std::vector<size_t>{300, buf.size() - 6} );
+    REQUIRE( hits.offsets[sbuf_signatures::JPEG] == std::vector<size_t>{400} );
+    REQUIRE( hits.offsets[sbuf_signatures::PSD] == std::vector<size_t>{500} );
+    REQUIRE( hits.offsets[sbuf_signatures::TIFF_II] == std::vector<size_t>{600} );
+    REQUIRE( hits.offsets[sbuf_signatures::TIFF_MM] == std::vector<size_t>{700} );
+    REQUIRE( hits.offsets[sbuf_signatures::WINLNK] == std::vector<size_t>{800} );
+    REQUIRE( hits.offsets[sbuf_signatures::SQLITE] == std::vector<size_t>{1000} );
+    REQUIRE( hits.offsets[sbuf_signatures::HIBERFILE] == std::vector<size_t>{2000} );
+    REQUIRE( hits.next(sbuf_signatures::ZIP, 101) == 3000 );
+    REQUIRE( hits.next(sbuf_signatures::ZIP, 3001) == sbuf_signatures::NONE );
+    REQUIRE( hits.next({sbuf_signatures::TIFF_MM, sbuf_signatures::JPEG}, 401) == 700 );
+    REQUIRE( std::string(sbuf_signatures::name(sbuf_signatures::WINLNK)) == "winlnk" );
+
+    /* the scanners of an sbuf in a thread share one pass */
+    sbuf_t *sbuf = sbuf_t::sbuf_new(pos0_t("", 0), buf.data(), buf.size(), buf.size());
+    sbuf_t *other = sbuf_t::sbuf_new(pos0_t("", 8192), buf.data(), buf.size(), buf.size());
+    const uint64_t passes = sbuf_signatures::passes;
+    auto first = sbuf_signatures::find(*sbuf);
+    REQUIRE( sbuf_signatures::find(*sbuf) == first );
+    REQUIRE( sbuf_signatures::passes == passes + 1 );
+    REQUIRE( first->offsets[sbuf_signatures::ZIP] == hits.offsets[sbuf_signatures::ZIP] );
+    REQUIRE( sbuf_signatures::find(*other) != first );  // as when a scanner recurses
+    REQUIRE( sbuf_signatures::find(*sbuf) == first );
+    REQUIRE( sbuf_signatures::passes == passes + 2 );
+    std::thread([&]() { sbuf_signatures::find(*sbuf); }).join();
+    REQUIRE( sbuf_signatures::passes == passes + 3 );
+    delete other;
+    delete sbuf;
+}
+
+/* One pass for every signature against a pass for each, as the scanners did with sbuf[].
+ * Set DEBUG_BENCHMARK to run it.
+ */
+TEST_CASE("sbuf_signatures_benchmark", "[phase1]") {
+    if (!getenv_debug("DEBUG_BENCHMARK")){
+        std::cerr << "DEBUG_BENCHMARK not set; skipping sbuf_signatures_benchmark" << std::endl;
+        return;
+    }
+    std::vector<uint8_t> buf(16 * 1024 * 1024);
+    uint64_t x = 88172645463325252ULL;
+    for (auto &b : buf) { x ^= x << 13; x ^= x >> 7; x ^= x << 17; b = static_cast<uint8_t>(x >> 24); }
+    sbuf_t *sbuf = sbuf_t::sbuf_new(pos0_t("", 0), buf.data(), buf.size(), buf.size());
+    const std::vector<std::vector<uint8_t>> magics {
+        {0x50, 0x4b, 0x03, 0x04}, {0x1f, 0x8b, 0x08}, {0x7f, 'E', 'L', 'F'}, {0xff, 0xd8, 0xff},
+        {'8', 'B', 'P', 'S'}, {'I', 'I', 42, 0}, {'M', 'M', 0, 42}, {0x4c, 0, 0, 0}, {0x81, 0x81, 0x78, 0x70}};
+
+    auto t0 = std::chrono::steady_clock::now();
+    size_t found = 0;
+    for (const auto &magic : magics) {
+        for (size_t i = 0; i + magic.size() < sbuf->bufsize; i++) {
+            size_t j = 0;
+            while (j < magic.size() && (*sbuf)[i + j] == magic[j]) j++;
+            if (j == magic.size()) found++;
+        }
+    }
+    std::chrono::duration<double> each = std::chrono::steady_clock::now() - t0;
+
+    t0 = std::chrono::steady_clock::now();
+    sbuf_signatures::hits_t hits = sbuf_signatures::scan(sbuf->get_buf(), sbuf->bufsize);
+    std::chrono::duration<double> one = std::chrono::steady_clock::now() - t0;
+    std::cerr << "a pass for each of " << magics.size() << " signatures: " << buf.size() / each.count() / 1e6 << " MB/s ("
+              << found << " found); one pass: " << buf.size() / one.count() / 1e6 << " MB/s" << std::endl;
+    delete sbuf;
+}
+
+/* A task per page (be1) against a task per page and scanner (be2), over four quick scanners
+ * and one that is slow on every tenth page. Set DEBUG_BENCHMARK to run it.
+ */
+TEST_CASE("sbuf_scheduler_benchmark", "[phase1]") {
+    if (!getenv_debug("DEBUG_BENCHMARK")){
+        std::cerr << "DEBUG_BENCHMARK not set; skipping sbuf_scheduler_benchmark" << std::endl;
+        return;
+    }
+    static const uint8_t buf[4096] {};
+    const size_t npages = 2000;
+    const unsigned workers = std::max(2U, std::thread::hardware_concurrency());
+    auto spin = [](double seconds) {
+        auto t0 = std::chrono::steady_clock::now();
+        while (std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count() < seconds) {}
+    };
+    std::vector<sbuf_scheduler::scanner_fn_t> scanners;
+    for (int i = 0; i < 4; i++) {
+        scanners.push_back({"quick" + std::to_string(i), [spin](const sbuf_t &) { spin(0.0005); }});
+    }
+    scanners.push_back({"slow", [spin](const sbuf_t &sbuf) { if (sbuf.pos0.offset % 10 == 0) spin(0.02); }});
+    for (bool per_scanner : {false, true}) {
+        sbuf_scheduler sched(scanners, workers, per_scanner);
+        auto t0 = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < npages; i++) {
+            while (sched.pages_in_flight() > workers * 2) sched.wait();
+            sched.submit(sbuf_t::sbuf_new(pos0_t("", i), buf, sizeof(buf), sizeof(buf)));
+        }
+        sched.join();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - t0;
+        std::cerr << (per_scanner ? "be2" : "be1") << ": " << workers << " workers "
+                  << npages / elapsed.count() << " pages/sec"
+                  << " p50 " << sched.page_seconds(0.5) << "s"
+                  << " p99 " << sched.page_seconds(0.99) << "s"
+                  << " steals " << sched.steals() << std::endl;
+    }
+}
+
+/* The same over real images and the builtin scanners, recursing into what they decompress. The
+ * images are those in DEBUG_BENCHMARK_IMAGES, separated by colons, or by default the first 100k of
+ * the emails dataset, a FAT32 image of assorted files, and a .docx, which is a ZIP archive.
+ * Set DEBUG_BENCHMARK to run it.
+ */
+TEST_CASE("sbuf_scheduler_images_benchmark", "[phase1]") {
+    if (!getenv_debug("DEBUG_BENCHMARK")){
+        std::cerr << "DEBUG_BENCHMARK not set; skipping sbuf_scheduler_images_benchmark" << std::endl;
+        return;
+    }
+    std::vector<std::filesystem::path> images;
+    if (const char *env = getenv("DEBUG_BENCHMARK_IMAGES")) {
+        std::stringstream paths(env);
+        for (std::string path; std::getline(paths, path, ':'); ) {
+            if (!path.empty()) images.push_back(path);
+        }
+    } else {
+        images = {test_dir() / "nps-2010-emails.100k.raw", test_dir() / "1mb_fat32.dmg", test_dir() / "testfilex.docx"};
+    }
+    const unsigned workers = std::max(2U, std::thread::hardware_concurrency());
+    for (const auto &image : images) {
+        for (bool per_scanner : {false, true}) {
+            scanner_config sc;
+            sc.outdir = NamedTemporaryDirectory();
+            sc.enable_all_scanners();
+            sc.allow_recurse = true;
+            feature_recorder_set::flags_t frs_flags;
+            scanner_set ss(sc, frs_flags, nullptr);
+            ss.add_scanners(scanners_builtin);
+            ss.apply_scanner_commands();
+            ss.phase_scan();
+            std::vector<sbuf_scheduler::scanner_fn_t> scanners;
+            for (const auto &name : ss.get_enabled_scanners()) {
+                scanner_t *scanner = ss.get_scanner_by_name(name);
+                scanners.push_back({name, [&ss, scanner](const sbuf_t &sbuf) {
+                    scanner_params sp(ss.sc, &ss, nullptr, scanner_params::PHASE_SCAN, &sbuf);
+                    (*scanner)(sp);
+                }});
+            }
+
+            image_process *p = image_process::open(image, false, 65536, 4096);
+            uint64_t bytes = 0;
+            {
+                sbuf_scheduler sched(scanners, workers, per_scanner, nullptr, [&ss](sbuf_t *sbuf) { ss.schedule_sbuf(sbuf); });
+                auto t0 = std::chrono::steady_clock::now();
+                for (auto it = p->begin(); it != p->end(); ++it) {
+                    while (sched.pages_in_flight() > workers * 2) sched.wait();
+                    sbuf_t *sbuf = it.sbuf_alloc();
+                    bytes += sbuf->pagesize;
+                    sched.submit(sbuf);
+                }
+                sched.join();
+                std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - t0;
+                std::cerr << image.filename().string() << " " << (per_scanner ? "be2" : "be1") << ": " << workers << " workers "
+                          << bytes / elapsed.count() / 1e6 << " MB/s"
+                          << " p50 " << sched.page_seconds(0.5) << "s"
+                          << " p99 " << sched.page_seconds(0.99) << "s"
+                          << " steals " << sched.steals() << std::endl;
+            }
+            delete p;
+            ss.shutdown();
+        }
+    }
+}
+
+/* A recorder looked up by name on every sbuf, as the scanners used to, against a handle taken
+ * once in PHASE_INIT2, from 64 threads at a time. Set DEBUG_BENCHMARK to run it.
+ */
+TEST_CASE("feature_recorder_lookup_benchmark", "[phase1]") {
+    if (!getenv_debug("DEBUG_BENCHMARK")){
+        std::cerr << "DEBUG_BENCHMARK not set; skipping feature_recorder_lookup_benchmark" << std::endl;
+        return;
+    }
+    scanner_config sc;
+    sc.outdir = NamedTemporaryDirectory();
+    sc.enable_all_scanners();
+    feature_recorder_set::flags_t frs_flags;
+    scanner_set ss(sc, frs_flags, nullptr);
+    ss.add_scanners(scanners_builtin);
+    ss.apply_scanner_commands();
+    ss.phase_scan();
+
+    const unsigned nthreads = 64;
+    const size_t lookups = 100000;
+    feature_recorder *handle = &ss.named_feature_recorder("json");
+    for (bool by_name : {true, false}) {
+        std::atomic<size_t> found {0};
+        std::vector<std::thread> threads;
+        auto t0 = std::chrono::steady_clock::now();
+        for (unsigned t = 0; t < nthreads; t++) {
+            threads.emplace_back([&]() {
+                size_t n = 0;
+                for (size_t i = 0; i < lookups; i++) {
+                    feature_recorder &fr = by_name ? ss.named_feature_recorder("json") : *handle;
+                    if (&fr == handle) n++;
+                }
+                found += n;
+            });
+        }
+        for (auto &t : threads) t.join();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - t0;
+        REQUIRE( found == nthreads * lookups );
+        std::cerr << (by_name ? "by name: " : "handle:  ") << nthreads << " threads "
+                  << nthreads * lookups / elapsed.count() << " lookups/sec" << std::endl;
+    }
+    ss.shutdown();
+}
+
 /****************************************************************
  ** Test the path printer
  **/